@@ -0,0 +1,243 @@
+/*
+ * CompressedImage.cc - Disk images inside .gz and .zip files
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * CompressedImage.cc - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 21:12:36 2026
+ * Revision : $Id$
+ */
+
+#include "CompressedImage.h"
+#include "Disk.h"
+#include "Log.h"
+#include "MappedFile.h"
+
+#include <string.h>
+#include <zlib.h>
+
+#define GZIP_MAGIC0 0x1F
+#define GZIP_MAGIC1 0x8B
+#define GZIP_HEADER_LEN 10
+#define GZIP_TRAILER_LEN 8              // CRC-32, then the length mod 2^32
+
+#define ZIP_LOCAL_SIGNATURE 0x04034B50
+#define ZIP_CENTRAL_SIGNATURE 0x02014B50
+#define ZIP_END_SIGNATURE 0x06054B50
+#define ZIP_LOCAL_LEN 30
+#define ZIP_CENTRAL_LEN 46
+#define ZIP_END_LEN 22
+#define ZIP_MAX_COMMENT_LEN 0xFFFF
+#define ZIP_FLAG_ENCRYPTED 0x0001
+#define ZIP_METHOD_STORED 0
+#define ZIP_METHOD_DEFLATED 8
+
+/* Whether 'filename' is to be opened through here, from its extension */
+bool
+CompressedImage::isCompressed(std::string filename)
+{
+	std::string extension = Disk::getExtension(filename);
+
+	return(extension == "gz" || extension == "zip");
+}
+
+/*
+ * Decompress the image in 'filename'. 'imageName' receives the name of
+ * the image inside it, which tells its format. Returns NULL on error.
+ */
+MappedFile *
+CompressedImage::open(std::string filename, std::string *imageName)
+{
+	MappedFile *compressed = MappedFile::open(filename);
+	MappedFile *image = NULL;
+
+	if (! compressed)
+		return(NULL);
+
+	if (Disk::getExtension(filename) == "gz")
+		image = openGzip(filename, compressed->getData(), compressed->getSize(), imageName);
+	else
+		image = openZip(filename, compressed->getData(), compressed->getSize(), imageName);
+
+	MappedFile::release(compressed);
+
+	return(image);
+}
+
+/* The image is the whole stream, and is named after the file without its .gz */
+MappedFile *
+CompressedImage::openGzip(std::string filename, const uint8_t *data, size_t size, std::string *imageName)
+{
+	if (size < GZIP_HEADER_LEN + GZIP_TRAILER_LEN || data[0] != GZIP_MAGIC0 || data[1] != GZIP_MAGIC1) {
+		LOG(LOG_DISK, LOG_ERROR, "%s: Not a gzip file\n", filename.c_str());
+		return(NULL);
+	}
+
+	uint32_t imageLen = get32(&data[size - 4]);
+
+	if (imageLen == 0 || imageLen > COMPRESSED_MAX_IMAGE_LEN) {
+		LOG(LOG_DISK, LOG_ERROR, "%s: Unexpected size once decompressed (%u bytes)\n", filename.c_str(), imageLen);
+		return(NULL);
+	}
+
+	*imageName = filename.substr(0, filename.size() - 3);
+
+	MappedFile *image = MappedFile::allocate(*imageName, imageLen);
+
+	// zlib reads the gzip header and checks the CRC itself
+	if (image && ! inflateAll(data, size, image->getWritableData(), imageLen, 16 + MAX_WBITS)) {
+		LOG(LOG_DISK, LOG_ERROR, "%s: Corrupted gzip file\n", filename.c_str());
+		MappedFile::release(image);
+		image = NULL;
+	}
+
+	return(image);
+}
+
+/* The entries are found through the central directory, at the end of the archive */
+MappedFile *
+CompressedImage::openZip(std::string filename, const uint8_t *data, size_t size, std::string *imageName)
+{
+	const uint8_t *end = NULL;
+
+	// The end record is followed by a comment of up to 64K
+	for (size_t x = ZIP_END_LEN; x <= size && x <= ZIP_END_LEN + ZIP_MAX_COMMENT_LEN; x++) {
+		if (get32(&data[size - x]) == ZIP_END_SIGNATURE) {
+			end = &data[size - x];
+			break;
+		}
+	}
+
+	if (! end) {
+		LOG(LOG_DISK, LOG_ERROR, "%s: Not a zip file\n", filename.c_str());
+		return(NULL);
+	}
+
+	uint16_t nbEntries = get16(&end[10]);
+	size_t pos = get32(&end[16]);
+	const uint8_t *entry = NULL;
+
+	for (int x = 0; x < nbEntries; x++) {
+		const uint8_t *p = &data[pos];
+
+		if (pos + ZIP_CENTRAL_LEN > size || get32(p) != ZIP_CENTRAL_SIGNATURE)
+			break;
+
+		uint16_t nameLen = get16(&p[28]);
+
+		if (pos + ZIP_CENTRAL_LEN + nameLen > size)
+			break;
+
+		std::string name((const char *) &p[ZIP_CENTRAL_LEN], nameLen);
+
+		// The first file will do, unless a disk image comes later
+		if (nameLen > 0 && name[nameLen - 1] != '/' && (! entry || Disk::isImageName(name))) {
+			entry = p;
+			*imageName = name;
+
+			if (Disk::isImageName(name))
+				break;
+		}
+
+		pos += ZIP_CENTRAL_LEN + nameLen + get16(&p[30]) + get16(&p[32]);
+	}
+
+	if (! entry) {
+		LOG(LOG_DISK, LOG_ERROR, "%s: No disk image in the archive\n", filename.c_str());
+		return(NULL);
+	}
+
+	uint16_t flags = get16(&entry[8]);
+	uint16_t method = get16(&entry[10]);
+	uint32_t crc = get32(&entry[16]);
+	uint32_t compressedLen = get32(&entry[20]);
+	uint32_t imageLen = get32(&entry[24]);
+	size_t local = get32(&entry[42]);
+
+	if ((flags & ZIP_FLAG_ENCRYPTED) || (method != ZIP_METHOD_STORED && method != ZIP_METHOD_DEFLATED)) {
+		LOG(LOG_DISK, LOG_ERROR, "%s: %s is encrypted or compressed with an unsupported method\n", filename.c_str(), imageName->c_str());
+		return(NULL);
+	}
+
+	if (imageLen == 0 || imageLen > COMPRESSED_MAX_IMAGE_LEN) {
+		LOG(LOG_DISK, LOG_ERROR, "%s: Unexpected size for %s (%u bytes)\n", filename.c_str(), imageName->c_str(), imageLen);
+		return(NULL);
+	}
+
+	// The local header has its own name and extra field lengths
+	if (local + ZIP_LOCAL_LEN > size || get32(&data[local]) != ZIP_LOCAL_SIGNATURE) {
+		LOG(LOG_DISK, LOG_ERROR, "%s: Corrupted zip file\n", filename.c_str());
+		return(NULL);
+	}
+
+	size_t start = local + ZIP_LOCAL_LEN + get16(&data[local + 26]) + get16(&data[local + 28]);
+
+	if (start + compressedLen > size) {
+		LOG(LOG_DISK, LOG_ERROR, "%s: Truncated zip file\n", filename.c_str());
+		return(NULL);
+	}
+
+	MappedFile *image = MappedFile::allocate(*imageName, imageLen);
+
+	if (! image)
+		return(NULL);
+
+	bool ok;
+	uint8_t *out = image->getWritableData();
+
+	if (method == ZIP_METHOD_STORED) {
+		ok = (compressedLen == imageLen);
+
+		if (ok)
+			memcpy(out, &data[start], imageLen);
+	} else {
+		ok = inflateAll(&data[start], compressedLen, out, imageLen, -MAX_WBITS);
+	}
+
+	if (! ok || crc32(crc32(0L, Z_NULL, 0), out, imageLen) != crc) {
+		LOG(LOG_DISK, LOG_ERROR, "%s: %s is corrupted\n", filename.c_str(), imageName->c_str());
+		MappedFile::release(image);
+		image = NULL;
+	}
+
+	return(image);
+}
+
+/*
+ * Inflate 'in' into exactly 'outLen' bytes of 'out' in a single call.
+ * 'windowBits' picks the gzip wrapper or a raw deflate stream.
+ */
+bool
+CompressedImage::inflateAll(const uint8_t *in, size_t inLen, uint8_t *out, size_t outLen, int windowBits)
+{
+	z_stream stream;
+
+	memset(&stream, 0x00, sizeof(stream));
+
+	if (inflateInit2(&stream, windowBits) != Z_OK)
+		return(false);
+
+	stream.next_in = (Bytef *) in;
+	stream.avail_in = inLen;
+	stream.next_out = out;
+	stream.avail_out = outLen;
+
+	int ret = inflate(&stream, Z_FINISH);
+
+	inflateEnd(&stream);
+
+	return(ret == Z_STREAM_END && stream.total_out == outLen);
+}
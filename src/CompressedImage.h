@@ -0,0 +1,59 @@
+/*
+ * CompressedImage.h - Disk images inside .gz and .zip files
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * CompressedImage.h - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 21:12:36 2026
+ * Revision : $Id$
+ */
+
+#ifndef _COMPRESSEDIMAGE_H
+#define _COMPRESSEDIMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+class MappedFile;
+
+// Nothing we load is bigger than this once decompressed
+#define COMPRESSED_MAX_IMAGE_LEN (32 * 1024 * 1024)
+
+/*
+ * Opens a disk image compressed with gzip, or stored in a zip archive.
+ * The compressed file is mapped and inflated with zlib in one pass,
+ * straight into memory that is then used like a mapped image: there is
+ * no temporary file. The size of the result is known beforehand, from
+ * the gzip trailer or the zip central directory.
+ *
+ * In a zip archive, the first entry with the extension of a disk image
+ * is used, or the first entry if none has one.
+ */
+class CompressedImage
+{
+public:
+	static bool isCompressed(std::string filename);
+	static MappedFile *open(std::string filename, std::string *imageName);
+
+private:
+	static MappedFile *openGzip(std::string filename, const uint8_t *data, size_t size, std::string *imageName);
+	static MappedFile *openZip(std::string filename, const uint8_t *data, size_t size, std::string *imageName);
+	static bool inflateAll(const uint8_t *in, size_t inLen, uint8_t *out, size_t outLen, int windowBits);
+};
+
+#endif
@@ -22,32 +22,35 @@
  */
 
 #include <assert.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <iostream>
-#include <fstream>
 #include <iomanip>
 #include <sstream>
 
+#include "CompressedImage.h"
 #include "Disk.h"
+#include "DiskOverlay.h"
+#include "DiskWriter.h"
+#include "Gcr.h"
+#include "Log.h"
+#include "MappedFile.h"
+#include "WozImage.h"
 
 using namespace std;
 
 void dumpHex(uint8_t *data, uint16_t len);
 
-// Translation table for 6-and-2 encoding
-uint8_t XLAT62[64] = {
-	0x96, 0x97, 0x9A, 0x9B, 0x9D, 0x9E, 0x9F, 0xA6, 
-	0xA7, 0xAB, 0xAC, 0xAD, 0xAE, 0xAF, 0xB2, 0xB3,
-	0xB4, 0xB5, 0xB6, 0xB7, 0xB9, 0xBA, 0xBB, 0xBC,
-	0xBD, 0xBE, 0xBF, 0xCB,	0xCD, 0xCE, 0xCF, 0xD3,
-	0xD6, 0xD7, 0xD9, 0xDA, 0xDB, 0xDC, 0xDD, 0xDE,
-	0xDF, 0xE5, 0xE6, 0xE7, 0xE9, 0xEA, 0xEB, 0xEC,
-	0xED, 0xEE, 0xEF, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6,
-	0xF7, 0xF9, 0xFA, 0xFB,	0xFC, 0xFD, 0xFE, 0xFF };
+// Extensions of the images Disk opens, as found in archives and libraries
+static const char *DISK_IMAGE_EXTENSIONS[] = { "dsk", "do", "po", "d13", "nib", "woz", NULL };
 
 // .DSK are generally in DOS 3.3 order, meaning the sectors are translated as
 // follows.
-unsigned int DOS33_SECTOR_XLAT[16] = {
+unsigned int DOS33_SECTOR_XLAT[DISK_SECTORS_PER_TRACK] = {
 	0,	// 0
 	7,	// 1
 	14,	// 2
@@ -66,19 +69,87 @@ unsigned int DOS33_SECTOR_XLAT[16] = {
 	15	// 15
 };
 
+// .po images are in ProDOS order: two sectors per 512-bytes block
+unsigned int PRODOS_SECTOR_XLAT[DISK_SECTORS_PER_TRACK] = {
+	0,	// 0
+	8,	// 1
+	1,	// 2
+	9,	// 3
+	2,	// 4
+	10,	// 5
+	3,	// 6
+	11,	// 7
+	4,	// 8
+	12,	// 9
+	5,	// 10
+	13,	// 11
+	6,	// 12
+	14,	// 13
+	7,	// 14
+	15	// 15
+};
+
+// .d13 images are in physical order
+unsigned int DOS32_SECTOR_XLAT[DISK_SECTORS_PER_TRACK_13] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12
+};
+
+// Where the DOS 3.3 VTOC and ProDOS volume directory live
+#define DOS33_VTOC_TRACK 17
+#define PRODOS_VOLDIR_BLOCK 2
+#define PRODOS_BLOCK_LEN 512
+
+uint8_t addressPrologue[] = { 0xD5, 0xAA, 0x96 };
+uint8_t addressPrologue13[] = { 0xD5, 0xAA, 0xB5 };  // 13-sector disks
+uint8_t dataPrologue[] = { 0xD5, 0xAA, 0xAD };
+uint8_t epilogue[] = { 0xDE, 0xAA, 0xEB };
+
 Disk::Disk(void)
 	: diskImageFilename(""),
+	  overlayFilename(""),
+	  overlayLockFd(-1),
+	  imageFile(NULL),
 	  diskImageData(NULL),
 	  diskImageOpened(false),
 	  motorEnabled(false),
+	  writeProtected(false),
+	  format(DISK_FORMAT_UNKNOWN),
+	  trackLength(DISK_RAW_TRACK_LEN),
+	  woz(NULL),
+	  sectorXlat(DOS33_SECTOR_XLAT),
+	  sectorsPerTrack(DISK_SECTORS_PER_TRACK),
 	  currentVolume(0xFE),
 	  currentTrack(0),
-	  currentSector(0),
-	  currentSectorPosition(0),
-	  shaftPosition(0)
+	  trackPosition(0),
+	  shaftPosition(0),
+	  trackData(NULL),
+	  dirtyMap(NULL),
+	  writeCursor(0),
+	  writer(NULL),
+	  clock(NULL),
+	  motorOnCycle(0),
+	  spinDownCycle(0),
+	  rotation(0),
+	  statsMotorCycle(0)
 {
 	for (int x = 0; x < DISK_NB_PHASES; x++)
 		phases[x] = false;
+
+	for (int x = 0; x < DISK_TRACKS_PER_DISK; x++) {
+		trackBuilt[x] = false;
+		trackDirty[x] = false;
+		unsavedSectors[x] = 0;
+	}
+
+	memset(&stats, 0x00, sizeof(stats));
+}
+
+Disk::~Disk(void)
+{
+	closeFile();
+
+	delete[] trackData;
+	delete[] dirtyMap;
 }
 
 bool
@@ -92,75 +163,1041 @@ void
 Disk::reset(void)
 {
 	currentTrack = 0;
-	currentSector = 0;
-	currentSectorPosition = 0;
+	trackPosition = 0;
+	rotation = 0;
+	motorOnCycle = clock ? *clock : 0;
 }
 
+/*
+ * Save what was written to the current image and let go of it. Returns
+ * false if the changes couldn't be saved.
+ */
 bool
-Disk::openFile(std::string filename)
+Disk::releaseImage(void)
 {
-	bool success = false;
+	bool saved = flush();
 
-	// Clear previous file data before reading another
-	if (diskImageData) {
-		delete[] diskImageData;
-		diskImageData = NULL;
+	if (writer) {
+		delete writer;
+		writer = NULL;
 	}
 
-	diskImageData = new uint8_t[DISK_IMAGE_LEN];
-	diskImageFilename = filename;
+	delete woz;
+	woz = NULL;
 
-	ifstream file(diskImageFilename.c_str(), ios::in | ios::binary);
+	MappedFile::release(imageFile);
+	imageFile = NULL;
+	diskImageData = NULL;
+	diskImageOpened = false;
+	overlayFilename = "";
 
-	if (file.is_open()) {
-		// XXX: Check to make sure the disk is the appropriate size
-		file.read((char *) diskImageData, DISK_IMAGE_LEN);
-		// XXX: Make sure the read succeeded.
-		file.close();
-		success = true;
-		diskImageOpened = true;
-		cout << "Loaded disk " << diskImageFilename << " OK." << endl;
+	DiskOverlay::unlockBase(overlayLockFd);
+	overlayLockFd = -1;
 
-		printf("Building track %d, sector %d\n", currentTrack / 2, currentSector);
-		buildSector(currentSector, sectorRawData);
-	} else {
+	if (! trackData) {
+		trackData = new uint8_t[DISK_TRACKS_PER_DISK * DISK_RAW_TRACK_LEN];
+		dirtyMap = new uint8_t[DISK_TRACKS_PER_DISK * DISK_DIRTY_MAP_LEN];
+	}
+
+	// The tracks of the previous image are stale
+	for (int x = 0; x < DISK_TRACKS_PER_DISK; x++)
+		trackBuilt[x] = false;
+
+	return(saved);
+}
+
+/*
+ * Map 'filename'. Write-protected images are shared with everyone using
+ * the same file. Writable ones get a private copy-on-write mapping: the
+ * writer thread saves the sectors to the file. Compressed images are
+ * decompressed in memory, and their format is that of the image inside.
+ */
+bool
+Disk::mapImage(std::string filename, bool writable)
+{
+	std::string imageName = filename;
+
+	if (CompressedImage::isCompressed(filename))
+		imageFile = CompressedImage::open(filename, &imageName);
+	else if (writable)
+		imageFile = MappedFile::openPrivate(filename);
+	else
+		imageFile = MappedFile::open(filename);
+
+	if (! imageFile) {
 		cerr << "Unable to open " << filename << endl;
-		delete[] diskImageData;
-		diskImageData = NULL;
+		return(false);
 	}
 
-	return(success);
+	return(useImage(filename, imageName));
+}
+
+/*
+ * Find the format and sector order of imageFile, from its contents and
+ * 'imageName'. On error, the image is released.
+ */
+bool
+Disk::useImage(std::string filename, std::string imageName)
+{
+	format = guessFormat(imageName, imageFile->getData(), imageFile->getSize());
+
+	if (format == DISK_FORMAT_WOZ)
+		woz = WozImage::parse(imageFile->getData(), imageFile->getSize());
+
+	if (format == DISK_FORMAT_UNKNOWN || (format == DISK_FORMAT_WOZ && ! woz)) {
+		cerr << filename << ": Not a .dsk, .nib or .woz disk image (" << imageFile->getSize() << " bytes)" << endl;
+		MappedFile::release(imageFile);
+		imageFile = NULL;
+		return(false);
+	}
+
+	sectorsPerTrack = DISK_SECTORS_PER_TRACK;
+
+	if (format == DISK_FORMAT_DSK && imageFile->getSize() == DISK_IMAGE_13_LEN) {
+		sectorsPerTrack = DISK_SECTORS_PER_TRACK_13;
+		sectorXlat = DOS32_SECTOR_XLAT;
+	} else if (format == DISK_FORMAT_DSK)
+		sectorXlat = guessOrder(imageName, imageFile->getData());
+
+	if (format == DISK_FORMAT_NIB)
+		trackLength = DISK_NIB_TRACK_LEN;
+	else if (sectorsPerTrack == DISK_SECTORS_PER_TRACK_13)
+		trackLength = DISK_RAW_TRACK_53_LEN;
+	else
+		trackLength = DISK_RAW_TRACK_LEN;
+
+	diskImageData = imageFile->getData();
+	diskImageOpened = true;
+
+	return(true);
 }
 
+/*
+ * Pick the format of an image from its signature or extension, or from
+ * its size when the extension says nothing.
+ */
+enum disk_formats
+Disk::guessFormat(std::string filename, const uint8_t *data, size_t size)
+{
+	if (WozImage::isWoz(data, size))
+		return(DISK_FORMAT_WOZ);
+
+	std::string extension = getExtension(filename);
+
+	if (extension == "nib")
+		return(size == DISK_NIB_IMAGE_LEN ? DISK_FORMAT_NIB : DISK_FORMAT_UNKNOWN);
+
+	if (extension == "d13")
+		return(size == DISK_IMAGE_13_LEN ? DISK_FORMAT_DSK : DISK_FORMAT_UNKNOWN);
+
+	if (extension == "po")
+		return(size == DISK_IMAGE_LEN ? DISK_FORMAT_DSK : DISK_FORMAT_UNKNOWN);
+
+	// 13-sector images are often named .dsk too
+	if (extension == "dsk" || extension == "do")
+		return((size == DISK_IMAGE_LEN || size == DISK_IMAGE_13_LEN) ? DISK_FORMAT_DSK : DISK_FORMAT_UNKNOWN);
+
+	if (size == DISK_IMAGE_LEN || size == DISK_IMAGE_13_LEN)
+		return(DISK_FORMAT_DSK);
+
+	if (size == DISK_NIB_IMAGE_LEN)
+		return(DISK_FORMAT_NIB);
+
+	return(DISK_FORMAT_UNKNOWN);
+}
+
+/* Returns the extension of 'filename', in lowercase. A dot in a directory name doesn't count. */
+std::string
+Disk::getExtension(std::string filename)
+{
+	std::string extension("");
+	size_t dot = filename.rfind('.');
+	size_t slash = filename.rfind('/');
+
+	if (dot != filename.npos && (slash == filename.npos || dot > slash)) {
+		extension = filename.substr(dot + 1);
+
+		for (size_t x = 0; x < extension.size(); x++)
+			extension[x] = tolower(extension[x]);
+	}
+
+	return(extension);
+}
+
+/* Whether the extension of 'filename' is one of an image, not counting .gz or .zip */
+bool
+Disk::isImageName(std::string filename)
+{
+	std::string extension = getExtension(filename);
+
+	for (int x = 0; DISK_IMAGE_EXTENSIONS[x]; x++) {
+		if (extension == DISK_IMAGE_EXTENSIONS[x])
+			return(true);
+	}
+
+	return(false);
+}
+
+/* Offset in the image of DOS 3.3 sector 'sector' of 'track', for an image ordered by 'xlat' */
+static unsigned int
+dosSectorOffset(uint8_t track, uint8_t sector, const unsigned int *xlat)
+{
+	unsigned int physical = 0;
+
+	// Find the physical sector holding the DOS sector...
+	for (int x = 0; x < DISK_SECTORS_PER_TRACK; x++) {
+		if (DOS33_SECTOR_XLAT[x] == sector)
+			physical = x;
+	}
+
+	// ... and where this image keeps it
+	return((track * DISK_SECTORS_PER_TRACK + xlat[physical]) * DISK_BYTES_PER_SECTOR);
+}
+
+/*
+ * Is there a DOS 3.3 catalog in 'data', read in the order of 'xlat'? The
+ * VTOC (sector 0) and the first catalog sector (usually 15) are at the
+ * same place in both orders, but the catalog sectors after it aren't:
+ * they must keep linking to the sector before them.
+ */
+static bool
+hasDosCatalog(const uint8_t *data, const unsigned int *xlat)
+{
+	const uint8_t *vtoc = &data[dosSectorOffset(DOS33_VTOC_TRACK, 0, xlat)];
+	uint8_t catalogTrack = vtoc[0x01];
+	uint8_t catalogSector = vtoc[0x02];
+
+	if (vtoc[0x27] != 122 || vtoc[0x34] != DISK_TRACKS_PER_DISK || vtoc[0x35] != DISK_SECTORS_PER_TRACK
+	    || catalogTrack == 0 || catalogTrack >= DISK_TRACKS_PER_DISK || catalogSector < 3 || catalogSector >= DISK_SECTORS_PER_TRACK)
+		return(false);
+
+	for (int sector = catalogSector; sector > catalogSector - 2; sector--) {
+		const uint8_t *catalog = &data[dosSectorOffset(catalogTrack, sector, xlat)];
+
+		if (catalog[0x01] != catalogTrack || catalog[0x02] != sector - 1)
+			return(false);
+	}
+
+	return(true);
+}
+
+/* Does 'block' look like the key block of a ProDOS volume directory? */
+static bool
+isProdosVolumeDirectory(const uint8_t *block)
+{
+	return(block[0x00] == 0 && block[0x01] == 0                  // No previous block
+		&& (block[0x04] & 0xF0) == 0xF0 && (block[0x04] & 0x0F) > 0 // Volume header, name length
+		&& block[0x23] == 0x27 && block[0x24] == 0x0D);      // Entry length, entries per block
+}
+
+/*
+ * Pick the sector order of a 140K image: the extension says it when it's
+ * .po or .do. Otherwise, look for a ProDOS volume directory or a DOS 3.3
+ * catalog where each order would put it. DOS order is the default.
+ */
+const unsigned int *
+Disk::guessOrder(std::string filename, const uint8_t *data)
+{
+	std::string extension = getExtension(filename);
+
+	if (extension == "po")
+		return(PRODOS_SECTOR_XLAT);
+
+	if (extension == "do")
+		return(DOS33_SECTOR_XLAT);
+
+	// Block 2 is right there in a ProDOS-order image. In a DOS-order
+	// one, its first half (ProDOS sector 4 of track 0) is physical
+	// sector 8.
+	if (isProdosVolumeDirectory(&data[PRODOS_VOLDIR_BLOCK * PRODOS_BLOCK_LEN]))
+		return(PRODOS_SECTOR_XLAT);
+
+	if (isProdosVolumeDirectory(&data[DOS33_SECTOR_XLAT[8] * DISK_BYTES_PER_SECTOR]))
+		return(DOS33_SECTOR_XLAT);
+
+	if (hasDosCatalog(data, DOS33_SECTOR_XLAT))
+		return(DOS33_SECTOR_XLAT);
+
+	if (hasDosCatalog(data, PRODOS_SECTOR_XLAT))
+		return(PRODOS_SECTOR_XLAT);
+
+	return(DOS33_SECTOR_XLAT);
+}
+
+/* Start the thread saving the written sectors to 'filename' */
 void
+Disk::startWriter(std::string filename, const struct overlay_header *header)
+{
+	writer = new DiskWriter(filename);
+
+	writer->setSectorsPerTrack(sectorsPerTrack);
+
+	if (header)
+		writer->setOverlay(header);
+
+	if (! writer->start()) {
+		delete writer;
+		writer = NULL;
+		writeProtected = true;
+	}
+}
+
+/*
+ * Read-only files make a write-protected disk. So do compressed ones:
+ * the sectors can't be saved back into them.
+ */
+bool
+Disk::isWritable(std::string filename)
+{
+	return(access(filename.c_str(), W_OK) == 0 && ! CompressedImage::isCompressed(filename));
+}
+
+bool
+Disk::openFile(std::string filename)
+{
+	// Complete the writes interrupted by a crash before reading
+	if (isWritable(filename))
+		DiskWriter::replay(filename);
+
+	if (! prepareFile(filename))
+		return(false);
+
+	enableWriting();
+
+	cout << "Loaded disk " << diskImageFilename << " OK";
+	if (format == DISK_FORMAT_DSK && sectorXlat == PRODOS_SECTOR_XLAT)
+		cout << " (ProDOS order)";
+	if (sectorsPerTrack == DISK_SECTORS_PER_TRACK_13)
+		cout << " (13 sectors)";
+	if (writeProtected)
+		cout << " (write-protected)";
+	cout << "." << endl;
+
+	return(true);
+}
+
+/*
+ * Map 'filename' without replaying its journal, starting the writer or
+ * printing anything, so that it can be done from any thread. The disk
+ * can't be written to before enableWriting() is called.
+ */
+bool
+Disk::prepareFile(std::string filename)
+{
+	releaseImage();
+	diskImageFilename = filename;
+	writeProtected = ! isWritable(filename);
+
+	if (! mapImage(diskImageFilename, ! writeProtected))
+		return(false);
+
+	// XXX: Writing .nib and .woz images isn't supported: the writer
+	// thread only knows about sectors.
+	if (format == DISK_FORMAT_NIB || format == DISK_FORMAT_WOZ)
+		writeProtected = true;
+
+	return(true);
+}
+
+/* Start saving what is written to a disk opened with prepareFile() */
+void
+Disk::enableWriting(void)
+{
+	if (diskImageOpened && ! writeProtected && ! writer)
+		startWriter(diskImageFilename, NULL);
+}
+
+/*
+ * Open 'filename' write-protected, for tools that only read the sectors:
+ * no journal is replayed, no writer is started and nothing is printed.
+ */
+bool
+Disk::openImage(std::string filename)
+{
+	releaseImage();
+	diskImageFilename = filename;
+	writeProtected = true;
+
+	return(mapImage(diskImageFilename, false));
+}
+
+/*
+ * Same, with an image already in memory, such as one just converted.
+ * 'imageName' tells its format. The Disk releases 'file' when done.
+ */
+bool
+Disk::openImage(MappedFile *file, std::string imageName)
+{
+	releaseImage();
+	diskImageFilename = imageName;
+	writeProtected = true;
+	imageFile = file;
+
+	return(useImage(imageName, imageName));
+}
+
+/*
+ * Open 'baseFilename' without ever writing to it: the sectors written go
+ * to 'deltaFilename', which is created if needed. The base can be shared
+ * by any number of emulators, each with its own delta.
+ */
+bool
+Disk::openOverlay(std::string baseFilename, std::string deltaFilename)
+{
+	struct overlay_header header;
+
+	releaseImage();
+	diskImageFilename = baseFilename;
+
+	DiskWriter::replay(deltaFilename);
+
+	// Keeps merge() away from the base while this disk uses it
+	overlayLockFd = DiskOverlay::lockBase(baseFilename);
+
+	if (overlayLockFd < 0 || ! mapImage(baseFilename, true)) {
+		releaseImage();
+		return(false);
+	}
+
+	if (format != DISK_FORMAT_DSK || sectorsPerTrack != DISK_SECTORS_PER_TRACK) {
+		cerr << baseFilename << ": Overlays only work with 16-sector .dsk images" << endl;
+		releaseImage();
+		return(false);
+	}
+
+	if (! DiskOverlay::load(deltaFilename, imageFile->getWritableData(), &header)) {
+		releaseImage();
+		return(false);
+	}
+
+	overlayFilename = deltaFilename;
+	writeProtected = false;
+	startWriter(deltaFilename, &header);
+
+	cout << "Loaded disk " << baseFilename << " with overlay " << deltaFilename;
+	cout << " (" << header.nbSectors << " sectors changed)." << endl;
+
+	return(true);
+}
+
+/*
+ * Write the sectors of the overlay into the base image and empty the
+ * overlay. Refused while other emulators use the same base.
+ */
+bool
+Disk::mergeOverlay(void)
+{
+	std::string base = diskImageFilename;
+	std::string delta = overlayFilename;
+
+	if (delta == "") {
+		cerr << "No overlay to merge" << endl;
+		return(false);
+	}
+
+	if (access(base.c_str(), W_OK) != 0 || CompressedImage::isCompressed(base)) {
+		cerr << base << " is read-only or compressed, can't merge " << delta << endl;
+		return(false);
+	}
+
+	releaseImage();
+
+	bool success = DiskOverlay::merge(base, delta);
+
+	return(openOverlay(base, delta) && success);
+}
+
+/* Forget the sectors written to the overlay: the disk is back to its base image */
+bool
+Disk::discardOverlay(void)
+{
+	std::string base = diskImageFilename;
+	std::string delta = overlayFilename;
+
+	if (delta == "") {
+		cerr << "No overlay to discard" << endl;
+		return(false);
+	}
+
+	releaseImage();
+
+	bool success = DiskOverlay::reset(delta);
+
+	return(openOverlay(base, delta) && success);
+}
+
+/* Returns false if what was written to the disk couldn't be saved */
+bool
 Disk::closeFile(void)
 {
+	bool saved = releaseImage();
+
 	diskImageFilename = "";
+
+	return(saved);
 }
 
+/* Whether the disk spins, including the second after motorOff() */
 bool
 Disk::isMotorEnabled(void)
 {
+	updateMotor();
+
 	return(motorEnabled);
 }
 
 void
 Disk::motorOn(void)
 {
-	printf("Disk motor ON\n");
-	motorEnabled = true;
+	updateMotor();
+
+	// The controller is hit with $C0E9 repeatedly: only the first
+	// access starts the rotation. A motor spinning down just keeps
+	// going.
+	if (! motorEnabled) {
+		LOG(LOG_DISK, LOG_DEBUG, "Disk motor ON\n");
+		motorOnCycle = clock ? *clock : 0;
+		statsMotorCycle = motorOnCycle;
+		motorEnabled = true;
+	}
+
+	spinDownCycle = 0;
 }
 
+/* The motor keeps turning for DISK_SPINDOWN_CYCLES, unless it's turned on again */
 void
 Disk::motorOff(void)
 {
-	printf("Disk motor OFF\n");
+	updateMotor();
+
+	if (! motorEnabled || spinDownCycle)
+		return;
+
+	if (clock)
+		spinDownCycle = *clock + DISK_SPINDOWN_CYCLES;
+	else
+		stopMotor();
+}
+
+/* Stop the motor now, as when the controller selects the other drive */
+void
+Disk::stopMotor(void)
+{
+	updateMotor();
+
+	if (motorEnabled)
+		motorStopped(clock ? *clock : 0);
+}
+
+/* Stop the motor once the spin-down is over */
+void
+Disk::updateMotor(void)
+{
+	if (motorEnabled && spinDownCycle && clock && *clock >= spinDownCycle)
+		motorStopped(spinDownCycle);
+}
+
+/* The motor stopped at 'cycle': freeze the disk where it stopped */
+void
+Disk::motorStopped(uint64_t cycle)
+{
+	LOG(LOG_DISK, LOG_DEBUG, "Disk motor OFF\n");
+
+	if (clock) {
+		rotation += cycle - motorOnCycle;
+		stats.motorOnCycles += cycle - statsMotorCycle;
+	}
+
 	motorEnabled = false;
+	spinDownCycle = 0;
+}
+
+/* Drive the rotation from 'clock', a counter of CPU cycles that never resets */
+void
+Disk::setClock(const uint64_t *clock)
+{
+	this->clock = clock;
+	motorOnCycle = clock ? *clock : 0;
+}
+
+/* Returns how many cycles the disk has rotated since the start of the track */
+uint64_t
+Disk::getRotation(void)
+{
+	updateMotor();
+
+	uint64_t r = rotation;
+
+	if (motorEnabled && clock)
+		r += *clock - motorOnCycle;
+
+	return(r);
+}
+
+bool
+Disk::isWriteProtected(void)
+{
+	return(writeProtected);
+}
+
+/* Returns the index of the nibble under the head */
+uint16_t
+Disk::getNibblePosition(void)
+{
+	if (clock)
+		return((getRotation() / DISK_CYCLES_PER_NIBBLE) % trackLength);
+
+	return(trackPosition);
+}
+
+/* The controller switched to write mode: nibbles are written from the head */
+void
+Disk::beginWrite(void)
+{
+	writeCursor = getNibblePosition();
+}
+
+/* The controller switched back to read mode */
+void
+Disk::endWrite(void)
+{
+	// Without a clock, resume reading after what was written
+	if (! clock)
+		trackPosition = writeCursor;
 }
 
+/*
+ * Write a nibble under the head. The sectors aren't decoded here: the
+ * nibble is only recorded in the track and marked dirty, to be decoded
+ * when the track is flushed.
+ */
 void
 Disk::writeByte(unsigned char byte)
 {
+	uint8_t trackNumber = currentTrack / 2;
+
+	if (! diskImageOpened || writeProtected || trackNumber >= DISK_TRACKS_PER_DISK)
+		return;
+
+	getTrack(trackNumber);
+
+	uint8_t *track = &trackData[trackNumber * DISK_RAW_TRACK_LEN];
+	uint8_t *dirty = &dirtyMap[trackNumber * DISK_DIRTY_MAP_LEN];
+
+	track[writeCursor] = byte;
+	stats.bytesWritten++;
+	dirty[writeCursor / 8] |= 1 << (writeCursor % 8);
+	trackDirty[trackNumber] = true;
+
+	if (++writeCursor >= trackLength)
+		writeCursor = 0;
+}
+
+/*
+ * Write every modified sector back to the image and wait until it's
+ * saved. Returns false if the writer couldn't save it.
+ */
+bool
+Disk::flush(void)
+{
+	if (! diskImageOpened || ! writer)
+		return(true);
+
+	for (int x = 0; x < DISK_TRACKS_PER_DISK; x++) {
+		if (trackDirty[x])
+			flushTrack(x);
+	}
+
+	// Once the writer caught up, the queue has room for what's left
+	bool saved = writer->sync();
+
+	saveTracks();
+
+	return(writer->sync() && saved);
+}
+
+/*
+ * Hand the sectors that changed to the writer thread. When its queue is
+ * full, they stay in unsavedSectors and go with the next flush.
+ */
+void
+Disk::saveTracks(void)
+{
+	struct diskwriter_batch batch;
+
+	for (int t = 0; t < DISK_TRACKS_PER_DISK; t++) {
+		if (! unsavedSectors[t])
+			continue;
+
+		batch.track = t;
+		batch.sectors = unsavedSectors[t];
+
+		for (int s = 0; s < sectorsPerTrack; s++) {
+			if (batch.sectors & (1 << s))
+				memcpy(batch.data[s], &diskImageData[(t * sectorsPerTrack + s) * DISK_BYTES_PER_SECTOR], DISK_BYTES_PER_SECTOR);
+		}
+
+		if (! writer->submit(&batch)) {
+			LOG(LOG_DISK, LOG_DEBUG, "Disk writer busy, track %d saved later\n", t);
+			break;
+		}
+
+		unsavedSectors[t] = 0;
+	}
+}
+
+/*
+ * If an address field starting with 'prologue' is at 'pos' in the
+ * 'length' nibbles of 'track', return where the data of its sector
+ * starts (past the data prologue, possibly wrapping around the track).
+ * Returns -1 if there is no valid address field there, or no data field
+ * right after it.
+ */
+static int
+findDataField(const uint8_t *track, unsigned int length, unsigned int pos, const uint8_t *prologue, uint8_t *sectorNumber)
+{
+	uint8_t addr[8];
+
+	if (track[pos] != prologue[0]
+	    || track[(pos + 1) % length] != prologue[1]
+	    || track[(pos + 2) % length] != prologue[2])
+		return(-1);
+
+	// Volume, track, sector and checksum, odd-even encoded
+	unsigned int idx = pos + DISK_PROLOGUE_LEN;
+
+	for (int x = 0; x < 8; x++)
+		addr[x] = track[idx++ % length];
+
+	uint8_t volume = ((addr[0] << 1) | 0x01) & addr[1];
+	uint8_t trk = ((addr[2] << 1) | 0x01) & addr[3];
+	uint8_t sector = ((addr[4] << 1) | 0x01) & addr[5];
+	uint8_t checksum = ((addr[6] << 1) | 0x01) & addr[7];
+
+	if ((volume ^ trk ^ sector) != checksum)
+		return(-1);
+
+	*sectorNumber = sector;
+
+	// The data field follows shortly after
+	for (unsigned int x = idx; x < idx + DISK_DATAFIELD_SEARCH_LEN; x++) {
+		if (track[x % length] == dataPrologue[0]
+		    && track[(x + 1) % length] == dataPrologue[1]
+		    && track[(x + 2) % length] == dataPrologue[2])
+			return(x + DISK_PROLOGUE_LEN);
+	}
+
+	return(-1);
+}
+
+/*
+ * Look for the sectors that were written to in 'trackNumber', decode them and
+ * write them back to the image.
+ */
+void
+Disk::flushTrack(uint8_t trackNumber)
+{
+	uint8_t *track = &trackData[trackNumber * DISK_RAW_TRACK_LEN];
+	uint8_t *dirty = &dirtyMap[trackNumber * DISK_DIRTY_MAP_LEN];
+	bool is13 = (sectorsPerTrack == DISK_SECTORS_PER_TRACK_13);
+	const uint8_t *prologue = is13 ? addressPrologue13 : addressPrologue;
+	unsigned int fieldLen = (is13 ? DISK_USERDATA_53_LEN : DISK_USERDATA_LEN) + DISK_DATAFIELD_CKSUM_LEN;
+	uint8_t field[DISK_USERDATA_53_LEN + DISK_DATAFIELD_CKSUM_LEN];
+	uint8_t sectorData[DISK_BYTES_PER_SECTOR];
+
+	LOG(LOG_DISK, LOG_DEBUG, "Flushing track %d\n", trackNumber);
+
+	for (int pos = 0; pos < trackLength; pos++) {
+		uint8_t sector;
+		int dataPos = findDataField(track, trackLength, pos, prologue, &sector);
+
+		if (dataPos < 0 || sector >= sectorsPerTrack)
+			continue;
+
+		// Only decode the sectors that were written to
+		bool written = false;
+
+		for (unsigned int x = 0; x < fieldLen; x++) {
+			int n = (dataPos + x) % trackLength;
+
+			field[x] = track[n];
+
+			if (dirty[n / 8] & (1 << (n % 8)))
+				written = true;
+		}
+
+		if (! written)
+			continue;
+
+		bool valid = is13 ? Gcr::decode5And3(field, sectorData) : Gcr::decode6And2(field, sectorData);
+
+		if (! valid) {
+			LOG(LOG_DISK, LOG_WARN, "Bad data checksum in track %d sector %d, not saved\n", trackNumber, sector);
+			continue;
+		}
+
+		stats.sectorsDecoded++;
+
+		writeSector(trackNumber, sector, sectorData);
+	}
+
+	memset(dirty, 0x00, DISK_DIRTY_MAP_LEN);
+	trackDirty[trackNumber] = false;
+
+	saveTracks();
+}
+
+/* Copy 'data' to a (physical) sector of the image, to be saved by the writer */
+void
+Disk::writeSector(uint8_t trackNumber, uint8_t sectorNumber, uint8_t *data)
+{
+	unsigned int translatedSector = sectorXlat[sectorNumber];
+	unsigned int diskIdx = (trackNumber * sectorsPerTrack + translatedSector) * DISK_BYTES_PER_SECTOR;
+
+	LOG(LOG_DISK, LOG_DEBUG, "Writing track %d sector %d\n", trackNumber, sectorNumber);
+
+	memcpy(&imageFile->getWritableData()[diskIdx], data, DISK_BYTES_PER_SECTOR);
+	unsavedSectors[trackNumber] |= 1 << translatedSector;
+}
+
+/* Whether the image is made of DOS 3.3 sectors that can be accessed directly */
+bool
+Disk::hasSectors(void)
+{
+	return(diskImageOpened && format == DISK_FORMAT_DSK && sectorsPerTrack == DISK_SECTORS_PER_TRACK);
+}
+
+/* Nibblize every track now, rather than when the head gets there */
+void
+Disk::buildTracks(void)
+{
+	if (! diskImageOpened || format == DISK_FORMAT_NIB || format == DISK_FORMAT_WOZ)
+		return;
+
+	for (int x = 0; x < DISK_TRACKS_PER_DISK; x++) {
+		if (! trackBuilt[x])
+			buildTrack(x);
+	}
+}
+
+/*
+ * Exchange images with 'other', with their track buffers, pending writes
+ * and writer thread. What belongs to the drive (head, motor, rotation,
+ * counters) stays. Only pointers and a few small arrays are copied.
+ */
+void
+Disk::swapImage(Disk *other)
+{
+	std::swap(diskImageFilename, other->diskImageFilename);
+	std::swap(overlayFilename, other->overlayFilename);
+	std::swap(overlayLockFd, other->overlayLockFd);
+	std::swap(imageFile, other->imageFile);
+	std::swap(diskImageData, other->diskImageData);
+	std::swap(diskImageOpened, other->diskImageOpened);
+	std::swap(writeProtected, other->writeProtected);
+	std::swap(format, other->format);
+	std::swap(trackLength, other->trackLength);
+	std::swap(woz, other->woz);
+	std::swap(sectorXlat, other->sectorXlat);
+	std::swap(sectorsPerTrack, other->sectorsPerTrack);
+	std::swap(currentVolume, other->currentVolume);
+	std::swap(trackData, other->trackData);
+	std::swap(dirtyMap, other->dirtyMap);
+	std::swap(writer, other->writer);
+
+	for (int x = 0; x < DISK_TRACKS_PER_DISK; x++) {
+		std::swap(trackBuilt[x], other->trackBuilt[x]);
+		std::swap(trackDirty[x], other->trackDirty[x]);
+		std::swap(unsavedSectors[x], other->unsavedSectors[x]);
+	}
+
+	// The tracks may not have the same length
+	trackPosition %= trackLength;
+	writeCursor %= trackLength;
+}
+
+/* Copy the counters to 'out', with the motor's current run */
+void
+Disk::getStats(struct disk_stats *out)
+{
+	updateMotor();
+
+	*out = stats;
+
+	if (motorEnabled && clock)
+		out->motorOnCycles += *clock - statsMotorCycle;
+}
+
+void
+Disk::resetStats(void)
+{
+	memset(&stats, 0x00, sizeof(stats));
+	statsMotorCycle = clock ? *clock : 0;
+}
+
+/*
+ * Move the head to 'trackNumber' at once, as if the stepper motor had
+ * been driven there, saving the track it leaves if it was written to.
+ */
+void
+Disk::seek(uint8_t trackNumber)
+{
+	int previous = currentTrack / 2;
+
+	if (trackNumber >= DISK_TRACKS_PER_DISK)
+		return;
+
+	if (previous != trackNumber && previous < DISK_TRACKS_PER_DISK && trackDirty[previous])
+		flushTrack(previous);
+
+	if (currentTrack != trackNumber * 2) {
+		stats.seeks++;
+		stats.halfTracksStepped += abs(currentTrack - trackNumber * 2);
+	}
+
+	currentTrack = trackNumber * 2;
+
+	// A whole track is aligned with phase 0 or 2
+	shaftPosition = (currentTrack * 2) % (DISK_NB_PHASES * 2);
+	previousShaftPosition = shaftPosition;
+}
+
+/* Copy DOS 3.3 (logical) sector 'sectorNumber' of 'trackNumber' to 'out' */
+bool
+Disk::readDosSector(uint8_t trackNumber, uint8_t sectorNumber, uint8_t *out)
+{
+	if (! hasSectors() || trackNumber >= DISK_TRACKS_PER_DISK || sectorNumber >= DISK_SECTORS_PER_TRACK)
+		return(false);
+
+	// Nibbles written to the track are only in trackData until then
+	if (trackDirty[trackNumber])
+		flushTrack(trackNumber);
+
+	memcpy(out, &diskImageData[dosSectorOffset(trackNumber, sectorNumber, sectorXlat)], DISK_BYTES_PER_SECTOR);
+
+	return(true);
+}
+
+/*
+ * The nibbles of 'trackNumber', as the drive reads them, and their number
+ * in 'length'. Returns NULL for .woz images, which only have flux.
+ */
+const uint8_t *
+Disk::getTrackNibbles(uint8_t trackNumber, uint16_t *length)
+{
+	if (! diskImageOpened || format == DISK_FORMAT_WOZ || trackNumber >= DISK_TRACKS_PER_DISK)
+		return(NULL);
+
+	*length = trackLength;
+
+	return(getTrack(trackNumber));
+}
+
+/*
+ * Copy the sectors of 'trackNumber' to 'out' by physical sector number,
+ * DISK_BYTES_PER_SECTOR each. The sectors of .nib and .woz images are
+ * decoded from the nibbles, 6-and-2 or 5-and-3 as the address field
+ * says. Returns the mask of the sectors found.
+ */
+uint16_t
+Disk::readTrack(uint8_t trackNumber, uint8_t *out)
+{
+	uint16_t found = 0;
+
+	if (! diskImageOpened || trackNumber >= DISK_TRACKS_PER_DISK)
+		return(0);
+
+	if (format == DISK_FORMAT_DSK) {
+		if (trackDirty[trackNumber])
+			flushTrack(trackNumber);
+
+		for (int s = 0; s < sectorsPerTrack; s++) {
+			unsigned int diskIdx = (trackNumber * sectorsPerTrack + sectorXlat[s]) * DISK_BYTES_PER_SECTOR;
+
+			memcpy(&out[s * DISK_BYTES_PER_SECTOR], &diskImageData[diskIdx], DISK_BYTES_PER_SECTOR);
+			found |= 1 << s;
+		}
+
+		return(found);
+	}
+
+	// A .woz track has no fixed length, but no more nibbles than a .nib
+	// track. One more sector's worth holds every sector whole at least once.
+	uint8_t nibbles[DISK_NIB_TRACK_LEN + DISK_RAW_SECTOR_53_LEN];
+	const uint8_t *track = nibbles;
+	unsigned int length = sizeof(nibbles);
+
+	if (format == DISK_FORMAT_NIB) {
+		track = &diskImageData[trackNumber * DISK_NIB_TRACK_LEN];
+		length = DISK_NIB_TRACK_LEN;
+	} else {
+		uint64_t cycles = 0;
+
+		for (unsigned int x = 0; x < length; x++)
+			nibbles[x] = woz->readNextByte(trackNumber * 4, &cycles);
+	}
+
+	uint8_t field[DISK_USERDATA_53_LEN + DISK_DATAFIELD_CKSUM_LEN];
+
+	// Stop once all 16 sectors are in: the scan is most of the work
+	for (unsigned int pos = 0; pos < length && found != 0xFFFF; pos++) {
+		uint8_t sector;
+		bool is13 = false;
+
+		if (track[pos] != addressPrologue[0])
+			continue;
+
+		int dataPos = findDataField(track, length, pos, addressPrologue, &sector);
+
+		if (dataPos < 0) {
+			dataPos = findDataField(track, length, pos, addressPrologue13, &sector);
+			is13 = true;
+		}
+
+		if (dataPos < 0 || sector >= DISK_SECTORS_PER_TRACK || (found & (1 << sector)))
+			continue;
+
+		unsigned int fieldLen = (is13 ? DISK_USERDATA_53_LEN : DISK_USERDATA_LEN) + DISK_DATAFIELD_CKSUM_LEN;
+
+		for (unsigned int x = 0; x < fieldLen; x++)
+			field[x] = track[(dataPos + x) % length];
+
+		uint8_t *sectorData = &out[sector * DISK_BYTES_PER_SECTOR];
+		bool valid = is13 ? Gcr::decode5And3(field, sectorData) : Gcr::decode6And2(field, sectorData);
+
+		if (valid) {
+			found |= 1 << sector;
+			stats.sectorsDecoded++;
+
+			// Nothing else starts in the data field
+			pos = dataPos + fieldLen - 1;
+		}
+	}
+
+	return(found);
+}
+
+/* Replace DOS 3.3 (logical) sector 'sectorNumber' of 'trackNumber' with 'data' */
+bool
+Disk::writeDosSector(uint8_t trackNumber, uint8_t sectorNumber, const uint8_t *data)
+{
+	if (! hasSectors() || writeProtected || trackNumber >= DISK_TRACKS_PER_DISK || sectorNumber >= DISK_SECTORS_PER_TRACK)
+		return(false);
+
+	if (trackDirty[trackNumber])
+		flushTrack(trackNumber);
+
+	unsigned int offset = dosSectorOffset(trackNumber, sectorNumber, sectorXlat);
+
+	memcpy(&imageFile->getWritableData()[offset], data, DISK_BYTES_PER_SECTOR);
+	unsavedSectors[trackNumber] |= 1 << ((offset / DISK_BYTES_PER_SECTOR) % DISK_SECTORS_PER_TRACK);
+
+	// The nibbles are built again the next time the head gets there
+	trackBuilt[trackNumber] = false;
+
+	saveTracks();
+
+	return(true);
 }
 
 /*
@@ -297,8 +1334,19 @@ Disk::updateHeadTrack(void)
 	bool ret = false;
 
 	if (previousTrack != currentTrack) {
-		printf("Changed track %d -> %d\n", previousTrack / 2, currentTrack / 2);
+		LOG(LOG_DISK, LOG_DEBUG, "Changed track %d -> %d\n", previousTrack / 2, currentTrack / 2);
 		ret = true;
+
+		stats.halfTracksStepped++;
+
+		if (currentTrack / 2 != previousTrack / 2)
+			stats.seeks++;
+
+		// Leaving a track that was written to: save its sectors
+		int previous = previousTrack / 2;
+
+		if (previous != currentTrack / 2 && previous < DISK_TRACKS_PER_DISK && trackDirty[previous])
+			flushTrack(previous);
 	}
 
 	return(ret);
@@ -340,16 +1388,15 @@ Disk::changePhase(uint8_t phaseNumber, bool value)
 	assert(phaseNumber < DISK_NB_PHASES);
 
 	// printf("phase %d: %d -> %d\n", phaseNumber, phases[phaseNumber], value);
+	if (phases[phaseNumber] != value)
+		stats.phaseChanges++;
+
 	phases[phaseNumber] = value;
 
 	if (updateShaftPosition())
 		updateHeadTrack();
 }
 
-uint8_t addressPrologue[] = { 0xD5, 0xAA, 0x96 };
-uint8_t dataPrologue[] = { 0xD5, 0xAA, 0xAD };
-uint8_t epilogue[] = { 0xDE, 0xAA, 0xEB };
-
 /*
  * Returns the next byte from the disk
  */
@@ -357,149 +1404,104 @@ uint8_t
 Disk::readNextByte(void)
 {
 	// Depends on the track and track position. Returns MSB=1 when valid byte is ready to be read.
-	int8_t byte;
+	uint8_t byte;
+
+	if (diskImageOpened && format == DISK_FORMAT_WOZ) {
+		// Half-track N is quarter track N * 2
+		if (clock)
+			byte = woz->readLatch(currentTrack * 2, getRotation());
+		else
+			byte = woz->readNextByte(currentTrack * 2, &rotation);
+	} else if (diskImageOpened && currentTrack / 2 >= DISK_TRACKS_PER_DISK) {
+		// Past the last track: nothing to read
+		byte = 0x00;
+	} else if (diskImageOpened && clock) {
+		const uint8_t *track = getTrack(currentTrack / 2);
+		uint64_t r = getRotation();
+		uint32_t nibble = (r / DISK_CYCLES_PER_NIBBLE) % trackLength;
+		uint32_t elapsed = r % DISK_CYCLES_PER_NIBBLE;
+
+		if (elapsed < DISK_LATCH_HOLD_CYCLES) {
+			// The previous nibble just completed and is still in
+			// the latch
+			if (nibble == 0)
+				nibble = trackLength;
+
+			byte = track[nibble - 1];
+		} else {
+			// Still shifting in the bits of this nibble: the high
+			// bit isn't there yet.
+			byte = track[nibble] >> (8 - elapsed / DISK_CYCLES_PER_BIT);
+		}
+	} else if (diskImageOpened) {
+		const uint8_t *track = getTrack(currentTrack / 2);
 
-	// printf("READ[trk:%d sec:%d  pos:%d]: ", currentTrack, currentSector, currentSectorPosition);
+		byte = track[trackPosition];
 
-	if (diskImageOpened) {
-		byte = sectorRawData[currentSectorPosition];
-		currentSectorPosition++;
-		// printf("0x%02X\n", (unsigned char) byte);
+		// The disk spins: wrap around to the start of the track
+		if (++trackPosition >= trackLength)
+			trackPosition = 0;
 	} else {
-		printf("Disk image not opened. Returning garbage.\n");
+		LOG(LOG_DISK, LOG_DEBUG, "Disk image not opened. Returning garbage.\n");
 		byte = 0xff;
 	}
 
-	if (currentSectorPosition >= DISK_RAW_SECTOR_LEN) {
-		currentSectorPosition = 0;
-		currentSector++;
-		currentSector %= DISK_SECTORS_PER_TRACK;
-		
-		printf("Building track %d, sector %d\n", currentTrack / 2, currentSector);
-		buildSector(currentSector, sectorRawData);
+	// 0xFF is a sync byte, but also a valid data nibble: only an
+	// incomplete nibble tells that the CPU is waiting on the disk
+	if (diskImageOpened) {
+		if (byte & 0x80)
+			stats.nibblesRead++;
+		else
+			stats.latchWaits++;
 	}
 
 	return(byte);
 }
 
-#define BUFF_ODD 0
-#define BUFF_EVEN 1
-
-void oddEvenEncode(uint8_t byte, uint8_t *buf)
+/*
+ * Returns the nibblized data of 'trackNumber', building it on first use.
+ * .nib images already hold the nibbles: they are served as they are.
+ */
+const uint8_t *
+Disk::getTrack(uint8_t trackNumber)
 {
-	uint8_t odd, even;
+	if (format == DISK_FORMAT_NIB)
+		return(&diskImageData[trackNumber * DISK_NIB_TRACK_LEN]);
 
-	odd = ((byte & 0xAA) >> 1) | 0xAA;
-	even = (byte & 0x55) | 0xAA;
+	if (! trackBuilt[trackNumber])
+		buildTrack(trackNumber);
 
-	buf[BUFF_ODD] = odd;
-	buf[BUFF_EVEN] = even;
+	return(&trackData[trackNumber * DISK_RAW_TRACK_LEN]);
 }
 
-/* Encode 256 bytes from 'in' into 342 bytes in 'out' */
-void encode5And3(uint8_t *in, uint8_t *out)
+/* Nibblize all the sectors of a track, one after the other */
+void
+Disk::buildTrack(uint8_t trackNumber)
 {
-	int srcIdx = 0;
-	uint8_t smallBuf[3];
-	uint8_t bufA[51];
-	uint8_t bufB[51];
-	uint8_t bufC[51];
-	uint8_t bufD[51];
-	//uint8_t bufE[51];
-
-	for (int x = 51; x > 0; x++) {
-		uint8_t byte = in[srcIdx++];
-		smallBuf[0] = byte;
-		bufA[x] = byte >> 3;
-		
-		byte = in[srcIdx++];
-		smallBuf[1] = byte;
-		bufB[x] = byte >> 3;
+	uint8_t *out = &trackData[trackNumber * DISK_RAW_TRACK_LEN];
 
-		byte = in[srcIdx++];
-		smallBuf[2] = byte;
-		bufC[x] = byte >> 3;
+	LOG(LOG_DISK, LOG_DEBUG, "Building track %d\n", trackNumber);
 
-		byte = in[srcIdx++];
-		smallBuf[2] = (smallBuf[2] << 1) | (byte & 0x01);
-		byte >>= 1;
-		smallBuf[1] = (smallBuf[1] << 1) | (byte & 0x01);
-		byte >>= 1;
-		smallBuf[0] = (smallBuf[0] << 1) | (byte & 0x01);
-		byte >>= 1;
-		bufD[x] = byte;
+	unsigned int sectorLength = (sectorsPerTrack == DISK_SECTORS_PER_TRACK_13) ? DISK_RAW_SECTOR_53_LEN : DISK_RAW_SECTOR_LEN;
 
-		byte = in[srcIdx++];
-		smallBuf[2] = (smallBuf[2] << 1) | (byte & 0x01);
-		byte >>= 1;
-		smallBuf[1] = (smallBuf[1] << 1) | (byte & 0x01);
-		byte >>= 1;
-		smallBuf[0] = (smallBuf[0] << 1) | (byte & 0x01);
-		byte >>= 1;
-		bufD[x] = byte;
+	for (int sector = 0; sector < sectorsPerTrack; sector++)
+		buildSector(trackNumber, sector, &out[sector * sectorLength]);
 
-		smallBuf[0] = smallBuf[0] & 0x1F;
-		smallBuf[1] = smallBuf[1] & 0x1F;
-		smallBuf[2] = smallBuf[2] & 0x1F;
-
-		// XXX: Incomplete
-	}
+	trackBuilt[trackNumber] = true;
 }
 
-/* Create the low bytes for use in 6-and-2 encoding */
-uint8_t low2(uint8_t in) {
-	uint8_t byte = in & 0x03;
-	uint8_t bit0 = byte & 0x01;
-	uint8_t bit1 = (byte & 0x02) >> 1;
-
-	return(bit0 << 1 | bit1);
-}
+#define BUFF_ODD 0
+#define BUFF_EVEN 1
 
-/*
- Take a 256-bytes block and encode it 6-and-2 into 342 bytes. Returns the
- "checksum". (The last byte, really.)
-*/
-uint8_t encode6And2(uint8_t *in, uint8_t *out)
+void oddEvenEncode(uint8_t byte, uint8_t *buf)
 {
-	memset(out, 0x00, DISK_USERDATA_LEN);
-
-	// Create the low (2 bits) bytes at buf[0x00..85]
-	for (int x = 0; x < 0x56; x++) {
-		// The last two bytes are special for b3 and the last byte is
-		// special for b1, because 0x56 can't be divided by 3
-		uint8_t b3 = x < 0x54 ? low2(in[0x56 * 2 + x]) : 0;
-		uint8_t b2 = low2(in[0x56 + x]);
-		uint8_t b1 = low2(in[x]);
-
-		out[x] = b3 << 4 | b2 << 2 | b1;
-
-		assert(out[x] < 64);
-	}
-
-	// Create the high (6 bits) bytes at buf[85..341]
-	for (int src = 0, dst = 0x56; src < 256; src++, dst++) {
-		out[dst] = in[src] >> 2;
-	}
-
-	// Chain-XOR every byte and create the checksum
-	uint8_t tmp = 0;
-	uint8_t last = 0;
-
-	for (int x = 0; x < DISK_USERDATA_LEN; x++) {
-		assert(tmp < 64);
-
-		tmp = out[x] ^ last;
-
-		last = out[x];
-		out[x] = XLAT62[tmp];
-
-		assert(out[x] >= 0x80);
-	}
+	uint8_t odd, even;
 
-	// The last byte of the buffer is the checksum. It is XOR'd against
-	// itself during reading/decoding, 0 indicating success.
+	odd = ((byte & 0xAA) >> 1) | 0xAA;
+	even = (byte & 0x55) | 0xAA;
 
-	return(last);
+	buf[BUFF_ODD] = odd;
+	buf[BUFF_EVEN] = even;
 }
 
 void
@@ -534,18 +1536,18 @@ dumpHex(uint8_t *data, uint16_t len)
 }
 
 /*
-Prepare a buffer representing a disk sector
-All disk reads will be served from this buffer until it reaches the end of the buffer.
+Prepare a buffer representing a disk sector: DISK_RAW_SECTOR_LEN bytes
+including gaps, address field and data field, or DISK_RAW_SECTOR_53_LEN
+for a 13-sector disk. 'trackNumber' is in DOS-parlance [0..34].
 */
 bool
-Disk::buildSector(uint8_t sectorNumber, uint8_t *out)
+Disk::buildSector(uint8_t trackNumber, uint8_t sectorNumber, uint8_t *out)
 {
 	uint8_t *data = out;
 	uint16_t idx = 0;
 	uint8_t encodeBuffer[2];
-
-	// currentTrack is 0..79, so divide by 2 to get the current track in DOS-parlance
-	uint8_t thisTrack = currentTrack / 2;
+	uint8_t thisTrack = trackNumber;
+	bool is13 = (sectorsPerTrack == DISK_SECTORS_PER_TRACK_13);
 
 	// Gap 1
 	// XXX: Shouldn't these sync bytes be 10 bits (0xFF + '0' '0' ?)  Not clear what the hardware hides
@@ -555,7 +1557,7 @@ Disk::buildSector(uint8_t sectorNumber, uint8_t *out)
 	/***** ADDRESS FIELD *****/
 	// Prologue
 	for (int x = 0; x < DISK_PROLOGUE_LEN; x++)
-		data[idx++] = addressPrologue[x];
+		data[idx++] = is13 ? addressPrologue13[x] : addressPrologue[x];
 
 	// Volume number
 	oddEvenEncode(currentVolume, encodeBuffer);
@@ -568,12 +1570,12 @@ Disk::buildSector(uint8_t sectorNumber, uint8_t *out)
 	data[idx++] = encodeBuffer[BUFF_EVEN];
 
 	// Sector
-	oddEvenEncode(currentSector, encodeBuffer);
+	oddEvenEncode(sectorNumber, encodeBuffer);
 	data[idx++] = encodeBuffer[BUFF_ODD];
 	data[idx++] = encodeBuffer[BUFF_EVEN];
 
 	// Checksum
-	uint8_t checksum = currentVolume ^ thisTrack ^ currentSector;
+	uint8_t checksum = currentVolume ^ thisTrack ^ sectorNumber;
 	oddEvenEncode(checksum, encodeBuffer);
 	data[idx++] = encodeBuffer[BUFF_ODD];
 	data[idx++] = encodeBuffer[BUFF_EVEN];
@@ -591,24 +1593,28 @@ Disk::buildSector(uint8_t sectorNumber, uint8_t *out)
 	for (int x = 0; x < DISK_PROLOGUE_LEN; x++)
 		data[idx++] = dataPrologue[x];
 
-	// Encode 6-and-2
-	// Since currentTrack is [0..79], divide by 2 to get the .DSK equivalent of [0..34]
-	unsigned int translatedSector = DOS33_SECTOR_XLAT[currentSector];
-	unsigned int diskIdx = (thisTrack * DISK_SECTORS_PER_TRACK + translatedSector) * DISK_BYTES_PER_SECTOR;
-	// printf("(currentTrack(%d) * DISK_SECTORS_PER_TRACK(%d) + currentSector(%d)) * DISK_BYTES_PER_SECTOR(%d) == %u\n", thisTrack, DISK_SECTORS_PER_TRACK, currentSector, DISK_BYTES_PER_SECTOR, diskIdx);
-	uint8_t *currentSectorData = &diskImageData[diskIdx];
+	// Encode 6-and-2, or 5-and-3
+	unsigned int translatedSector = sectorXlat[sectorNumber];
+	unsigned int diskIdx = (thisTrack * sectorsPerTrack + translatedSector) * DISK_BYTES_PER_SECTOR;
+	const uint8_t *currentSectorData = &diskImageData[diskIdx];
 	
 	// printf("Decoded data:\n");
 	// dumpHex(currentSectorData, 256);	
 
-	checksum = encode6And2(currentSectorData, &data[idx]);
+	if (is13) {
+		checksum = Gcr::encode5And3(currentSectorData, &data[idx]);
+		idx += DISK_USERDATA_53_LEN;
+		data[idx++] = XLAT53[checksum];
+	} else {
+		checksum = Gcr::encode6And2(currentSectorData, &data[idx]);
 
-	// printf("Encoded data:\n");
-	// dumpHex(&data[idx], DISK_USERDATA_LEN);
-	idx += DISK_USERDATA_LEN;
+		// printf("Encoded data:\n");
+		// dumpHex(&data[idx], DISK_USERDATA_LEN);
+		idx += DISK_USERDATA_LEN;
 
-	// Data Field Checksum
-	data[idx++] = XLAT62[checksum];
+		// Data Field Checksum
+		data[idx++] = XLAT62[checksum];
+	}
 
 	// Data Field Epilogue
 	for (int x = 0; x < DISK_EPILOGUE_LEN; x++)
@@ -618,7 +1624,9 @@ Disk::buildSector(uint8_t sectorNumber, uint8_t *out)
 	for (int x = 0; x < DISK_GAP3_LEN; x++)
 		data[idx++] = DISK_SYNC_BYTE;
 
-	assert(idx == DISK_RAW_SECTOR_LEN);
+	assert(idx == (is13 ? DISK_RAW_SECTOR_53_LEN : DISK_RAW_SECTOR_LEN));
+
+	stats.sectorsBuilt++;
 
 	return(true);
 }
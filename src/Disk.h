@@ -27,6 +27,18 @@
 #ifndef _DISK_H
 #define _DISK_H
 
+enum disk_formats {
+	DISK_FORMAT_UNKNOWN = 0,
+	DISK_FORMAT_DSK,        // 256-bytes sectors, DOS 3.3 or ProDOS order
+	DISK_FORMAT_NIB,        // Nibbles, DISK_NIB_TRACK_LEN per track
+	DISK_FORMAT_WOZ         // Flux bits, see WozImage.h
+};
+
+class DiskWriter;
+class MappedFile;
+class WozImage;
+struct overlay_header;
+
 #define DISK_MAX_TRACK 79
 #define DISK_TRACKS_PER_DISK 35
 #define DISK_SECTORS_PER_TRACK 16
@@ -35,7 +47,7 @@
 #define DISK_SYNC_BYTE 0xff
 
 // Length of a disk image
-#define DISK_IMAGE_LEN DISK_TRACKS_PER_DISK * DISK_SECTORS_PER_TRACK * DISK_BYTES_PER_SECTOR
+#define DISK_IMAGE_LEN (DISK_TRACKS_PER_DISK * DISK_SECTORS_PER_TRACK * DISK_BYTES_PER_SECTOR)
 
 #define DISK_GAP1_LEN 10
 #define DISK_GAP2_LEN 5
@@ -49,46 +61,180 @@
 #define DISK_ADDR_SEC_LEN 2
 #define DISK_ADDR_CKSUM_LEN 2
 
-#define DISK_ADDRFIELD_LEN DISK_PROLOGUE_LEN + DISK_EPILOGUE_LEN + DISK_ADDR_VOL_LEN + DISK_ADDR_TRK_LEN + DISK_ADDR_SEC_LEN + DISK_ADDR_CKSUM_LEN
-#define DISK_DATAFIELD_LEN DISK_PROLOGUE_LEN + DISK_USERDATA_LEN + DISK_DATAFIELD_CKSUM_LEN + DISK_EPILOGUE_LEN
-#define DISK_RAW_SECTOR_LEN DISK_GAP1_LEN + DISK_ADDRFIELD_LEN + DISK_GAP2_LEN + DISK_DATAFIELD_LEN + DISK_GAP3_LEN
+#define DISK_ADDRFIELD_LEN (DISK_PROLOGUE_LEN + DISK_EPILOGUE_LEN + DISK_ADDR_VOL_LEN + DISK_ADDR_TRK_LEN + DISK_ADDR_SEC_LEN + DISK_ADDR_CKSUM_LEN)
+#define DISK_DATAFIELD_LEN (DISK_PROLOGUE_LEN + DISK_USERDATA_LEN + DISK_DATAFIELD_CKSUM_LEN + DISK_EPILOGUE_LEN)
+#define DISK_RAW_SECTOR_LEN (DISK_GAP1_LEN + DISK_ADDRFIELD_LEN + DISK_GAP2_LEN + DISK_DATAFIELD_LEN + DISK_GAP3_LEN)
+#define DISK_RAW_TRACK_LEN (DISK_SECTORS_PER_TRACK * DISK_RAW_SECTOR_LEN)
+
+// 13-sector disks (DOS 3.2 and earlier) are encoded 5-and-3, which takes
+// more nibbles per sector. Their tracks still fit in DISK_RAW_TRACK_LEN.
+#define DISK_SECTORS_PER_TRACK_13 13
+#define DISK_IMAGE_13_LEN (DISK_TRACKS_PER_DISK * DISK_SECTORS_PER_TRACK_13 * DISK_BYTES_PER_SECTOR)
+#define DISK_USERDATA_53_LEN 410
+#define DISK_DATAFIELD_53_LEN (DISK_PROLOGUE_LEN + DISK_USERDATA_53_LEN + DISK_DATAFIELD_CKSUM_LEN + DISK_EPILOGUE_LEN)
+#define DISK_RAW_SECTOR_53_LEN (DISK_GAP1_LEN + DISK_ADDRFIELD_LEN + DISK_GAP2_LEN + DISK_DATAFIELD_53_LEN + DISK_GAP3_LEN)
+#define DISK_RAW_TRACK_53_LEN (DISK_SECTORS_PER_TRACK_13 * DISK_RAW_SECTOR_53_LEN)
+
+// The disk spins at 300 RPM and delivers one bit every 4 CPU cycles
+#define DISK_CYCLES_PER_BIT 4
+#define DISK_CYCLES_PER_NIBBLE (8 * DISK_CYCLES_PER_BIT)
+// Cycles during which the latch holds a complete nibble (bit 7 set)
+#define DISK_LATCH_HOLD_CYCLES 8
+// The controller keeps the motor on about a second after it's turned off
+#define DISK_SPINDOWN_CYCLES 1023000
+
+// .nib images hold the raw nibbles of every track
+#define DISK_NIB_TRACK_LEN 6656
+#define DISK_NIB_IMAGE_LEN (DISK_TRACKS_PER_DISK * DISK_NIB_TRACK_LEN)
+
+// One bit per nibble of a track, set when the nibble was written
+#define DISK_DIRTY_MAP_LEN ((DISK_RAW_TRACK_LEN + 7) / 8)
+// How far past an address field to look for its data field
+#define DISK_DATAFIELD_SEARCH_LEN 48
+
+// Physical sector -> sector in a .dsk image (DOS 3.3 order) or a .po image
+extern unsigned int DOS33_SECTOR_XLAT[DISK_SECTORS_PER_TRACK];
+extern unsigned int PRODOS_SECTOR_XLAT[DISK_SECTORS_PER_TRACK];
+
+// What a drive did since the emulator started, or since the last reset
+struct disk_stats {
+	uint64_t seeks;                      // Arrivals on another track
+	uint64_t phaseChanges;               // Stepper magnets turned on or off
+	uint64_t halfTracksStepped;
+	uint64_t nibblesRead;                // Complete nibbles in the latch
+	uint64_t latchWaits;                 // Reads of the latch before a nibble completed
+	uint64_t sectorsBuilt;               // Encoded into a track
+	uint64_t sectorsDecoded;             // Decoded from the nibbles written
+	uint64_t motorOnCycles;
+	uint64_t bytesWritten;               // Nibbles written by the controller
+};
 
 class Disk
 {
 public:
 	Disk(void);
+	~Disk(void);
 	bool init(void);
 	void reset(void);
 	bool openFile(std::string filename);
-	void closeFile(void);
+	bool openOverlay(std::string baseFilename, std::string deltaFilename);
+	bool mergeOverlay(void);
+	bool discardOverlay(void);
+	bool closeFile(void);
 	uint8_t readNextByte(void);
 	void motorOn(void);
 	void motorOff(void);
 	bool isMotorEnabled(void);
+	void stopMotor(void);
+	bool isSpinningDown(void) { return(spinDownCycle != 0); }
+	bool isLoaded(void) { return(diskImageOpened); }
 	void writeByte(unsigned char byte);
+	void beginWrite(void);
+	void endWrite(void);
+	bool isWriteProtected(void);
+	bool flush(void);
 	void phaseOn(unsigned char phaseNumber);
 	void phaseOff(unsigned char phaseNumber);
+	void setClock(const uint64_t *clock);
 
+	// Direct sector access, for the RWTS accelerator
+	bool hasSectors(void);
+	uint8_t getVolume(void) { return(currentVolume); }
+	void seek(uint8_t trackNumber);
+	bool readDosSector(uint8_t trackNumber, uint8_t sectorNumber, uint8_t *out);
+	bool writeDosSector(uint8_t trackNumber, uint8_t sectorNumber, const uint8_t *data);
+
+	void getStats(struct disk_stats *out);
+	void resetStats(void);
+
+	// Disk sets: images prepared ahead of time in a Disk of their own
+	bool prepareFile(std::string filename);
+	void enableWriting(void);
+	void buildTracks(void);
+	void swapImage(Disk *other);
+	std::string getFilename(void) { return(diskImageFilename); }
+
+	static std::string getExtension(std::string filename);
+	static bool isImageName(std::string filename);
+
+	// Read-only access to any image, for tools like dskindex and dskconv
+	bool openImage(std::string filename);
+	bool openImage(MappedFile *file, std::string imageName);
+	uint8_t getSectorsPerTrack(void) { return(sectorsPerTrack); }
+	enum disk_formats getFormat(void) { return(format); }
+	uint16_t readTrack(uint8_t trackNumber, uint8_t *out);
+	const uint8_t *getTrackNibbles(uint8_t trackNumber, uint16_t *length);
 
 private:
+	bool releaseImage(void);
+	bool mapImage(std::string filename, bool writable);
+	bool useImage(std::string filename, std::string imageName);
+	static enum disk_formats guessFormat(std::string filename, const uint8_t *data, size_t size);
+	static const unsigned int *guessOrder(std::string filename, const uint8_t *data);
+	static bool isWritable(std::string filename);
+	void startWriter(std::string filename, const struct overlay_header *header);
 	bool updateShaftPosition(void);
 	bool updateHeadTrack(void);
 	void changePhase(uint8_t phaseNumber, bool value);
-	bool buildSector(uint8_t sectorNumber, uint8_t *out);
+	bool buildSector(uint8_t trackNumber, uint8_t sectorNumber, uint8_t *out);
+	void buildTrack(uint8_t trackNumber);
+	const uint8_t *getTrack(uint8_t trackNumber);
+	uint64_t getRotation(void);
+	void updateMotor(void);
+	void motorStopped(uint64_t cycle);
+	uint16_t getNibblePosition(void);
+	void flushTrack(uint8_t trackNumber);
+	void writeSector(uint8_t trackNumber, uint8_t sectorNumber, uint8_t *data);
+	void saveTracks(void);
 
 private:
 	std::string diskImageFilename;
-	uint8_t *diskImageData;
+	std::string overlayFilename;         // Delta receiving the writes, or "" when writing to the image
+	int overlayLockFd;                   // Shared lock on the base of the overlay, or -1
+	MappedFile *imageFile;
+	const uint8_t *diskImageData;
 	bool diskImageOpened;
 	bool phases[DISK_NB_PHASES];         // Status (on/off) of stepper motor phases (magnets)
 	bool motorEnabled;		     // Whether the disk unit's motor is ON or OFF
+	bool writeProtected;		     // The image file can't be written to
+	enum disk_formats format;
+	uint16_t trackLength;                // Nibbles per track
+	WozImage *woz;                       // Bitstreams of a .woz image
+	const unsigned int *sectorXlat;      // Physical sector -> sector in the image
+	uint8_t sectorsPerTrack;             // 16, or 13 for a 5-and-3 image
 	uint8_t currentVolume;
 	uint8_t currentTrack;                    // Track under the head [0..79]
-	uint8_t currentSector;               // Sector under the head [0..15]
-	uint16_t currentSectorPosition;      // Byte under the head in the current sector [0..?] (gap1 + address field + gap2 + data field(342) + gap3)
+	uint16_t trackPosition;              // Nibble under the head in the current track [0..trackLength-1]
 	unsigned char shaftPosition;         // Position of the shaft within the magnets
 	unsigned char previousShaftPosition; // Position of the shaft within the magnets
-	uint8_t sectorRawData[DISK_RAW_SECTOR_LEN]; // 6-and-2, nibblized sector data for currentSector including gaps, address field and data field
+
+	// 6-and-2 nibblized data of every track (gaps, address fields and
+	// data fields), built the first time the head reaches the track.
+	uint8_t *trackData;                  // DISK_TRACKS_PER_DISK * DISK_RAW_TRACK_LEN
+	bool trackBuilt[DISK_TRACKS_PER_DISK];
+
+	// Nibbles written by the CPU go straight into trackData. They are
+	// only decoded back into sectors when the track is flushed.
+	uint8_t *dirtyMap;                   // DISK_TRACKS_PER_DISK * DISK_DIRTY_MAP_LEN
+	bool trackDirty[DISK_TRACKS_PER_DISK];
+	uint16_t writeCursor;                // Where the next written nibble goes
+
+	// Sectors updated in diskImageData but not yet handed to the writer
+	// thread, in image order.
+	DiskWriter *writer;
+	uint16_t unsavedSectors[DISK_TRACKS_PER_DISK];
+
+	// The head position is derived from the CPU cycle counter: the disk
+	// rotates 'rotation' cycles from the start of the track while the
+	// motor was previously on, plus the cycles since 'motorOnCycle'.
+	// Without a clock, the disk advances one nibble per read.
+	const uint64_t *clock;
+	uint64_t motorOnCycle;
+	uint64_t spinDownCycle;              // When the motor stops after motorOff(), or 0
+	uint64_t rotation;
+
+	struct disk_stats stats;
+	uint64_t statsMotorCycle;            // When the motor-on cycles were last counted
 };
 
 #endif
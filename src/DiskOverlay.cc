@@ -0,0 +1,208 @@
+/*
+ * DiskOverlay.cc - Copy-on-write delta files for shared disk images
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * DiskOverlay.cc - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 15:10:48 2026
+ * Revision : $Id$
+ */
+
+#include "DiskOverlay.h"
+#include "Log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+/* Write an empty header: the delta holds no sectors */
+static bool
+writeEmptyHeader(int fd)
+{
+	struct overlay_header header;
+
+	memset(&header, 0x00, sizeof(header));
+	header.magic = OVERLAY_MAGIC;
+	header.version = OVERLAY_VERSION;
+	header.baseSize = DISK_IMAGE_LEN;
+
+	return(ftruncate(fd, 0) == 0
+		&& pwrite(fd, &header, sizeof(header), 0) == sizeof(header)
+		&& fsync(fd) == 0);
+}
+
+void
+DiskOverlay::setSector(struct overlay_header *header, unsigned int sector)
+{
+	if (! hasSector(header, sector)) {
+		header->bitmap[sector / 8] |= 1 << (sector % 8);
+		header->nbSectors++;
+	}
+}
+
+bool
+DiskOverlay::hasSector(const struct overlay_header *header, unsigned int sector)
+{
+	return(header->bitmap[sector / 8] & (1 << (sector % 8)));
+}
+
+/*
+ * Copy the sectors of the delta over 'image', a DISK_IMAGE_LEN copy of
+ * the base. The delta file is created if it doesn't exist.
+ */
+bool
+DiskOverlay::load(std::string deltaFilename, uint8_t *image, struct overlay_header *header)
+{
+	bool success = true;
+	int fd = open(deltaFilename.c_str(), O_RDWR | O_CREAT, 0644);
+
+	if (fd < 0) {
+		LOG(LOG_DISK, LOG_ERROR, "Unable to open %s: %s\n", deltaFilename.c_str(), strerror(errno));
+		return(false);
+	}
+
+	ssize_t len = pread(fd, header, sizeof(*header), 0);
+
+	if (len == 0) {
+		// New delta
+		success = writeEmptyHeader(fd) && pread(fd, header, sizeof(*header), 0) == sizeof(*header);
+	} else if (len != sizeof(*header) || header->magic != OVERLAY_MAGIC || header->version != OVERLAY_VERSION) {
+		LOG(LOG_DISK, LOG_ERROR, "%s is not a disk overlay\n", deltaFilename.c_str());
+		success = false;
+	} else if (header->baseSize != DISK_IMAGE_LEN) {
+		LOG(LOG_DISK, LOG_ERROR, "%s was made for a %u bytes image\n", deltaFilename.c_str(), header->baseSize);
+		success = false;
+	} else {
+		for (unsigned int x = 0; success && x < OVERLAY_NB_SECTORS; x++) {
+			if (hasSector(header, x)) {
+				off_t offset = OVERLAY_DATA_OFFSET + x * DISK_BYTES_PER_SECTOR;
+
+				success = pread(fd, &image[x * DISK_BYTES_PER_SECTOR], DISK_BYTES_PER_SECTOR, offset) == DISK_BYTES_PER_SECTOR;
+			}
+		}
+
+		if (! success)
+			LOG(LOG_DISK, LOG_ERROR, "%s is truncated\n", deltaFilename.c_str());
+	}
+
+	close(fd);
+
+	return(success);
+}
+
+/*
+ * Take a shared lock on the base, held while an emulator uses it. This
+ * waits if a merge is rewriting the base. Returns the descriptor to give
+ * to unlockBase(), or -1.
+ */
+int
+DiskOverlay::lockBase(std::string baseFilename)
+{
+	int fd = open(baseFilename.c_str(), O_RDONLY);
+
+	if (fd < 0 || flock(fd, LOCK_SH) != 0) {
+		LOG(LOG_DISK, LOG_ERROR, "Unable to lock %s: %s\n", baseFilename.c_str(), strerror(errno));
+
+		if (fd >= 0)
+			close(fd);
+
+		return(-1);
+	}
+
+	return(fd);
+}
+
+void
+DiskOverlay::unlockBase(int lockFd)
+{
+	if (lockFd >= 0)
+		close(lockFd);
+}
+
+/*
+ * Write the sectors of the delta into the base image, then empty the
+ * delta. If this is interrupted, the delta is still complete and merging
+ * again finishes the job. Fails if another emulator has the base open:
+ * the caller must have released its own lock.
+ */
+bool
+DiskOverlay::merge(std::string baseFilename, std::string deltaFilename)
+{
+	struct overlay_header header;
+	uint8_t sector[DISK_BYTES_PER_SECTOR];
+	bool success = true;
+
+	int deltaFd = open(deltaFilename.c_str(), O_RDWR);
+	int baseFd = open(baseFilename.c_str(), O_WRONLY);
+
+	if (deltaFd < 0 || baseFd < 0) {
+		LOG(LOG_DISK, LOG_ERROR, "Unable to open %s: %s\n", deltaFd < 0 ? deltaFilename.c_str() : baseFilename.c_str(), strerror(errno));
+		success = false;
+	} else if (flock(baseFd, LOCK_EX | LOCK_NB) != 0) {
+		if (errno == EWOULDBLOCK)
+			LOG(LOG_DISK, LOG_ERROR, "%s is in use by another emulator, not merging %s\n", baseFilename.c_str(), deltaFilename.c_str());
+		else
+			LOG(LOG_DISK, LOG_ERROR, "Unable to lock %s: %s\n", baseFilename.c_str(), strerror(errno));
+
+		success = false;
+	} else if (pread(deltaFd, &header, sizeof(header), 0) != sizeof(header) || header.magic != OVERLAY_MAGIC) {
+		LOG(LOG_DISK, LOG_ERROR, "%s is not a disk overlay\n", deltaFilename.c_str());
+		success = false;
+	} else {
+		for (unsigned int x = 0; success && x < OVERLAY_NB_SECTORS; x++) {
+			if (! hasSector(&header, x))
+				continue;
+
+			off_t offset = x * DISK_BYTES_PER_SECTOR;
+
+			success = pread(deltaFd, sector, sizeof(sector), OVERLAY_DATA_OFFSET + offset) == sizeof(sector)
+				&& pwrite(baseFd, sector, sizeof(sector), offset) == sizeof(sector);
+		}
+
+		success = success && fsync(baseFd) == 0 && writeEmptyHeader(deltaFd);
+
+		if (success)
+			LOG(LOG_DISK, LOG_INFO, "Merged %u sectors into %s\n", header.nbSectors, baseFilename.c_str());
+		else
+			LOG(LOG_DISK, LOG_ERROR, "Unable to merge %s into %s: %s\n", deltaFilename.c_str(), baseFilename.c_str(), strerror(errno));
+	}
+
+	if (deltaFd >= 0)
+		close(deltaFd);
+
+	if (baseFd >= 0)
+		close(baseFd);
+
+	return(success);
+}
+
+/* Forget every sector of the delta */
+bool
+DiskOverlay::reset(std::string deltaFilename)
+{
+	int fd = open(deltaFilename.c_str(), O_RDWR | O_CREAT, 0644);
+	bool success = fd >= 0 && writeEmptyHeader(fd);
+
+	if (! success)
+		LOG(LOG_DISK, LOG_ERROR, "Unable to reset %s: %s\n", deltaFilename.c_str(), strerror(errno));
+
+	if (fd >= 0)
+		close(fd);
+
+	return(success);
+}
@@ -0,0 +1,77 @@
+/*
+ * DiskOverlay.h - Copy-on-write delta files for shared disk images
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * DiskOverlay.h - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 15:10:48 2026
+ * Revision : $Id$
+ */
+
+#ifndef _DISKOVERLAY_H
+#define _DISKOVERLAY_H
+
+#include <stdint.h>
+
+#include <string>
+
+#include "Disk.h"
+
+#define OVERLAY_MAGIC 0x564F3241        // "A2OV"
+#define OVERLAY_VERSION 1
+#define OVERLAY_NB_SECTORS (DISK_TRACKS_PER_DISK * DISK_SECTORS_PER_TRACK)
+#define OVERLAY_BITMAP_LEN ((OVERLAY_NB_SECTORS + 7) / 8)
+
+// Sector N of the image is stored at OVERLAY_DATA_OFFSET + N * 256 in
+// the delta file. The sectors that were never written are holes, so
+// the file only takes as much room as the tracks that were modified.
+#define OVERLAY_DATA_OFFSET 4096
+
+/*
+ * Header of a delta file, padded to the size of a sector so the writer
+ * thread can journal it like one.
+ */
+struct overlay_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t baseSize;              // Size of the base image
+	uint32_t nbSectors;             // Number of bits set in 'bitmap'
+	uint8_t bitmap[OVERLAY_BITMAP_LEN];     // Bit N set: sector N is in the delta
+	uint8_t reserved[DISK_BYTES_PER_SECTOR - 16 - OVERLAY_BITMAP_LEN];
+};
+
+/*
+ * An overlay is a read-only base image shared by any number of
+ * emulators, plus a small delta file per emulator that holds the
+ * sectors it wrote.
+ *
+ * Each emulator using the base holds a shared flock() on it. merge()
+ * needs an exclusive one, so it refuses to rewrite a base that others
+ * are reading.
+ */
+class DiskOverlay
+{
+public:
+	static bool load(std::string deltaFilename, uint8_t *image, struct overlay_header *header);
+	static bool merge(std::string baseFilename, std::string deltaFilename);
+	static int lockBase(std::string baseFilename);
+	static void unlockBase(int lockFd);
+	static bool reset(std::string deltaFilename);
+	static void setSector(struct overlay_header *header, unsigned int sector);
+	static bool hasSector(const struct overlay_header *header, unsigned int sector);
+};
+
+#endif
@@ -0,0 +1,211 @@
+/*
+ * DiskSet.cc - The disks of one title, prepared ahead of time
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * DiskSet.cc - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 22:03:48 2026
+ * Revision : $Id$
+ */
+
+#include "DiskSet.h"
+#include "DiskWriter.h"
+#include "Log.h"
+
+#include <stdio.h>
+
+DiskSet::DiskSet(Disk *drive)
+	: drive(drive),
+	  ready(NULL),
+	  deferred(NULL),
+	  current(-1),
+	  insertFirst(false),
+	  running(false),
+	  stop(false)
+{
+}
+
+DiskSet::~DiskSet(void)
+{
+	close();
+}
+
+/*
+ * Start preparing 'filenames' in the background. The first one is
+ * inserted by poll() once it's ready.
+ */
+bool
+DiskSet::load(const std::vector<std::string> &filenames)
+{
+	close();
+
+	if (filenames.size() == 0)
+		return(false);
+
+	this->filenames = filenames;
+	ready = new bool[filenames.size()];
+	deferred = new bool[filenames.size()];
+	stop = false;
+
+	for (unsigned int x = 0; x < filenames.size(); x++) {
+		images.push_back(new Disk());
+		images[x]->init();
+		ready[x] = false;
+		deferred[x] = false;
+	}
+
+	if (pthread_create(&thread, NULL, threadMain, this) != 0) {
+		perror("pthread_create()");
+		close();
+		return(false);
+	}
+
+	running = true;
+	insertFirst = true;
+
+	return(true);
+}
+
+/* Called regularly from the emulation thread: insert the first image when it's ready */
+void
+DiskSet::poll(void)
+{
+	if (insertFirst && isReady(0)) {
+		insertFirst = false;
+		insert(0);
+	}
+}
+
+/* Put the drive's own image back, and let go of the others */
+void
+DiskSet::close(void)
+{
+	// The worker finishes the image it's on, and leaves the others
+	if (running) {
+		__atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+		pthread_join(thread, NULL);
+		running = false;
+	}
+
+	if (current >= 0)
+		drive->swapImage(images[current]);
+
+	for (unsigned int x = 0; x < images.size(); x++)
+		delete images[x];
+
+	images.clear();
+	filenames.clear();
+	delete[] ready;
+	ready = NULL;
+	delete[] deferred;
+	deferred = NULL;
+	current = -1;
+	insertFirst = false;
+}
+
+/* Whether image 'index' is prepared */
+bool
+DiskSet::isReady(unsigned int index)
+{
+	return(index < images.size() && __atomic_load_n(&ready[index], __ATOMIC_ACQUIRE));
+}
+
+/* Put image 'index' in the drive. Returns false if it isn't ready yet, or couldn't be opened. */
+bool
+DiskSet::insert(unsigned int index)
+{
+	if (index >= images.size())
+		return(false);
+
+	insertFirst = false;
+
+	if (! isReady(index)) {
+		printf("%s isn't ready yet\n", filenames[index].c_str());
+		return(false);
+	}
+
+	if ((int) index == current)
+		return(true);
+
+	// The Disk of the image in the drive holds what the drive had
+	// before: swapping again puts both back where they were.
+	if (current >= 0)
+		drive->swapImage(images[current]);
+
+	current = -1;
+
+	if (deferred[index]) {
+		deferred[index] = false;
+		images[index]->openFile(filenames[index]);
+	}
+
+	if (! images[index]->isLoaded()) {
+		printf("%s couldn't be opened\n", filenames[index].c_str());
+		return(false);
+	}
+
+	drive->swapImage(images[index]);
+	drive->enableWriting();
+	current = index;
+
+	printf("Inserted disk %u: %s\n", index + 1, filenames[index].c_str());
+
+	return(true);
+}
+
+/* Insert the image after the current one, wrapping around */
+bool
+DiskSet::insertNext(void)
+{
+	if (images.size() == 0)
+		return(false);
+
+	return(insert((current + 1) % images.size()));
+}
+
+void
+DiskSet::print(void)
+{
+	for (unsigned int x = 0; x < images.size(); x++) {
+		const char *state = "loading";
+
+		if (isReady(x))
+			state = images[x]->isLoaded() || deferred[x] || (int) x == current ? "ready" : "failed";
+
+		printf("%c %2u %-8s %s\n", (int) x == current ? '*' : ' ', x + 1, state, filenames[x].c_str());
+	}
+}
+
+/* Open and nibblize the images one after the other, until close() */
+void *
+DiskSet::threadMain(void *arg)
+{
+	DiskSet *set = (DiskSet *) arg;
+
+	for (unsigned int x = 0; x < set->images.size() && ! __atomic_load_n(&set->stop, __ATOMIC_ACQUIRE); x++) {
+		Disk *image = set->images[x];
+
+		if (DiskWriter::hasJournal(set->filenames[x]))
+			set->deferred[x] = true;
+		else if (image->prepareFile(set->filenames[x]))
+			image->buildTracks();
+
+		LOG(LOG_DISK, LOG_DEBUG, "Disk set image %u ready: %s\n", x + 1, set->filenames[x].c_str());
+		__atomic_store_n(&set->ready[x], true, __ATOMIC_RELEASE);
+	}
+
+	return(NULL);
+}
@@ -0,0 +1,79 @@
+/*
+ * DiskSet.h - The disks of one title, prepared ahead of time
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * DiskSet.h - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 22:03:48 2026
+ * Revision : $Id$
+ */
+
+#ifndef _DISKSET_H
+#define _DISKSET_H
+
+#include <pthread.h>
+
+#include <string>
+#include <vector>
+
+#include "Disk.h"
+
+/*
+ * The images of one title (the sides of a game, say), for one drive.
+ * When the set is loaded, a worker thread opens, decompresses and
+ * nibblizes each of them in a Disk of its own. Inserting one in the
+ * drive then only swaps images between the two Disks (Disk::swapImage()):
+ * nothing is read or encoded on the emulation thread.
+ *
+ * The worker stays away from anything that writes: an image is only
+ * saved to once it's inserted, and one left with a journal by a crash
+ * is opened normally at insertion, which replays the journal.
+ *
+ * The image that was in the drive before the set is kept aside, and
+ * goes back in the drive when the set is closed.
+ */
+class DiskSet
+{
+public:
+	DiskSet(Disk *drive);
+	~DiskSet(void);
+	bool load(const std::vector<std::string> &filenames);
+	void close(void);
+	void poll(void);
+	bool insert(unsigned int index);
+	bool insertNext(void);
+	bool isReady(unsigned int index);
+	unsigned int getSize(void) { return(images.size()); }
+	int getCurrent(void) { return(current); }
+	void print(void);
+
+private:
+	static void *threadMain(void *arg);
+
+	Disk *drive;
+	std::vector<std::string> filenames;
+	std::vector<Disk *> images;     // images[current] holds what the drive had before
+	bool *ready;                    // Set by the worker once images[x] is prepared
+	bool *deferred;                 // images[x] has a journal: it's opened when inserted
+	int current;                    // Image in the drive, or -1
+	bool insertFirst;               // Insert image 0 as soon as it's ready
+
+	pthread_t thread;
+	bool running;
+	bool stop;                      // Tells the worker to give up on the images left
+};
+
+#endif
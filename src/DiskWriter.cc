@@ -0,0 +1,488 @@
+/*
+ * DiskWriter.cc - Background write-back of disk images
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * DiskWriter.cc - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 14:02:37 2026
+ * Revision : $Id$
+ */
+
+#include "DiskWriter.h"
+#include "Log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DISKWRITER_QUEUE_MASK (DISKWRITER_QUEUE_SIZE - 1)
+
+// How long the writer waits for more batches between commits
+#define DISKWRITER_SLEEP_NS (10 * 1000 * 1000)
+
+#define JOURNAL_MAGIC 0x4E524A44        // "DJRN"
+#define JOURNAL_TMP_SUFFIX ".tmp"        // The journal being written, before it's renamed
+#define JOURNAL_BAD_SUFFIX ".bad"        // A journal replay() couldn't use, kept for inspection
+
+struct journal_header {
+	uint32_t magic;
+	uint32_t count;                 // Number of records following the header
+	uint32_t checksum;              // FNV-1a of the records
+	uint32_t reserved;
+};
+
+struct journal_record {
+	uint32_t offset;                // Where 'data' goes in the image
+	uint8_t data[DISK_BYTES_PER_SECTOR];
+};
+
+static uint32_t
+journalChecksum(const struct journal_record *records, uint32_t count)
+{
+	const uint8_t *p = (const uint8_t *) records;
+	uint32_t hash = 2166136261u;
+
+	for (size_t x = 0; x < count * sizeof(struct journal_record); x++) {
+		hash ^= p[x];
+		hash *= 16777619u;
+	}
+
+	return(hash);
+}
+
+/* Write all of 'buf' at 'offset', retrying short writes */
+static bool
+writeFully(int fd, const void *buf, size_t len, off_t offset)
+{
+	const uint8_t *p = (const uint8_t *) buf;
+
+	while (len > 0) {
+		ssize_t n = pwrite(fd, p, len, offset);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return(false);
+		}
+
+		p += n;
+		len -= n;
+		offset += n;
+	}
+
+	return(true);
+}
+
+/* Make the renames and unlinks done in the directory of 'filename' durable */
+static bool
+syncDirectory(std::string filename)
+{
+	size_t slash = filename.rfind('/');
+	std::string dir = (slash == std::string::npos) ? "." : filename.substr(0, slash + 1);
+
+	int fd = open(dir.c_str(), O_RDONLY);
+
+	if (fd < 0)
+		return(false);
+
+	bool ok = (fsync(fd) == 0);
+
+	close(fd);
+
+	return(ok);
+}
+
+/*
+ * Write a complete journal next to 'journalFilename', then rename it
+ * over it. A failure leaves whatever journal was there untouched.
+ */
+static bool
+writeJournal(std::string journalFilename, const struct journal_header *header,
+             const struct journal_record *records, uint32_t count)
+{
+	std::string tmpFilename = journalFilename + JOURNAL_TMP_SUFFIX;
+
+	int fd = open(tmpFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0)
+		return(false);
+
+	bool ok = writeFully(fd, header, sizeof(*header), 0)
+		&& writeFully(fd, records, count * sizeof(*records), sizeof(*header))
+		&& fsync(fd) == 0;
+
+	if (close(fd) != 0)
+		ok = false;
+
+	ok = ok && rename(tmpFilename.c_str(), journalFilename.c_str()) == 0
+		&& syncDirectory(journalFilename);
+
+	if (! ok) {
+		int savedErrno = errno;
+
+		unlink(tmpFilename.c_str());
+		errno = savedErrno;
+	}
+
+	return(ok);
+}
+
+DiskWriter::DiskWriter(std::string filename)
+	: filename(filename),
+	  journalFilename(filename + DISKWRITER_JOURNAL_SUFFIX),
+	  imageFd(-1),
+	  queue(NULL),
+	  queueHead(0),
+	  queueTail(0),
+	  queueCommitted(0),
+	  queueAttempted(0),
+	  pendingData(NULL),
+	  failed(false),
+	  overlay(false),
+	  sectorsPerTrack(DISK_SECTORS_PER_TRACK),
+	  running(false),
+	  stop(false)
+{
+	for (int x = 0; x < DISK_TRACKS_PER_DISK; x++)
+		pendingSectors[x] = 0;
+}
+
+DiskWriter::~DiskWriter(void)
+{
+	if (running) {
+		__atomic_store_n(&stop, true, __ATOMIC_RELEASE);
+		pthread_join(thread, NULL);
+	}
+
+	if (imageFd >= 0)
+		close(imageFd);
+
+	if (failed)
+		LOG(LOG_DISK, LOG_ERROR, "Changes to %s were not saved\n", filename.c_str());
+
+	delete[] queue;
+	delete[] pendingData;
+}
+
+/* Write to the delta described by 'header' instead of an image. Call before start(). */
+void
+DiskWriter::setOverlay(const struct overlay_header *header)
+{
+	overlay = true;
+	memcpy(&overlayHeader, header, sizeof(overlayHeader));
+}
+
+/* Open the image and the journal and start the writer thread */
+bool
+DiskWriter::start(void)
+{
+	imageFd = open(filename.c_str(), O_WRONLY);
+
+	if (imageFd < 0) {
+		LOG(LOG_DISK, LOG_ERROR, "Unable to open %s for writing: %s\n", filename.c_str(), strerror(errno));
+		return(false);
+	}
+
+	// The journal goes next to the image: make sure it can
+	std::string tmpFilename = journalFilename + JOURNAL_TMP_SUFFIX;
+	int fd = open(tmpFilename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0) {
+		LOG(LOG_DISK, LOG_ERROR, "Unable to create %s: %s\n", tmpFilename.c_str(), strerror(errno));
+		return(false);
+	}
+
+	close(fd);
+	unlink(tmpFilename.c_str());
+
+	queue = new struct diskwriter_batch[DISKWRITER_QUEUE_SIZE];
+	pendingData = new uint8_t[DISK_TRACKS_PER_DISK][DISK_SECTORS_PER_TRACK][DISK_BYTES_PER_SECTOR];
+
+	if (pthread_create(&thread, NULL, threadMain, this) != 0) {
+		perror("pthread_create()");
+		return(false);
+	}
+
+	running = true;
+
+	return(true);
+}
+
+/*
+ * Queue a batch for the writer. Only one thread may submit. Returns
+ * false, without waiting, when the queue is full.
+ */
+bool
+DiskWriter::submit(const struct diskwriter_batch *batch)
+{
+	uint32_t head = queueHead;
+
+	if (! running)
+		return(false);
+
+	if (head - __atomic_load_n(&queueTail, __ATOMIC_ACQUIRE) >= DISKWRITER_QUEUE_SIZE)
+		return(false);
+
+	memcpy(&queue[head & DISKWRITER_QUEUE_MASK], batch, sizeof(*batch));
+	__atomic_store_n(&queueHead, head + 1, __ATOMIC_RELEASE);
+
+	return(true);
+}
+
+/*
+ * Wait until the writer tried to save everything submitted so far.
+ * Returns false if it couldn't: the sectors are kept and retried, but
+ * they aren't in the image.
+ */
+bool
+DiskWriter::sync(void)
+{
+	struct timespec ts = { 0, 1000 * 1000 };
+	uint32_t head = queueHead;
+
+	if (! running)
+		return(true);
+
+	while ((int32_t) (__atomic_load_n(&queueAttempted, __ATOMIC_ACQUIRE) - head) < 0)
+		nanosleep(&ts, NULL);
+
+	return((int32_t) (__atomic_load_n(&queueCommitted, __ATOMIC_ACQUIRE) - head) >= 0);
+}
+
+void *
+DiskWriter::threadMain(void *arg)
+{
+	DiskWriter *writer = (DiskWriter *) arg;
+	struct timespec ts = { 0, DISKWRITER_SLEEP_NS };
+
+	// A failed commit is retried, with whatever was queued since
+	while (! __atomic_load_n(&writer->stop, __ATOMIC_ACQUIRE)) {
+		bool found = writer->drainQueue();
+
+		if (found || writer->failed)
+			writer->commit();
+
+		if (! found)
+			nanosleep(&ts, NULL);
+	}
+
+	if (writer->drainQueue() || writer->failed)
+		writer->commit();
+
+	return(NULL);
+}
+
+/* Merge the queued batches into the pending sectors. Returns true if there were any. */
+bool
+DiskWriter::drainQueue(void)
+{
+	uint32_t head = __atomic_load_n(&queueHead, __ATOMIC_ACQUIRE);
+	bool found = false;
+
+	while (queueTail != head) {
+		struct diskwriter_batch *batch = &queue[queueTail & DISKWRITER_QUEUE_MASK];
+
+		// A later write of the same sector replaces the earlier one
+		for (int s = 0; s < DISK_SECTORS_PER_TRACK; s++) {
+			if (batch->sectors & (1 << s))
+				memcpy(pendingData[batch->track][s], batch->data[s], DISK_BYTES_PER_SECTOR);
+		}
+
+		pendingSectors[batch->track] |= batch->sectors;
+
+		__atomic_store_n(&queueTail, queueTail + 1, __ATOMIC_RELEASE);
+		found = true;
+	}
+
+	return(found);
+}
+
+/*
+ * Write the pending sectors through the journal. They stay pending
+ * until they are in the image, so that a failed commit is retried.
+ */
+void
+DiskWriter::commit(void)
+{
+	uint32_t committed = queueTail;
+	uint32_t count = 0;
+
+	for (int t = 0; t < DISK_TRACKS_PER_DISK; t++)
+		count += __builtin_popcount(pendingSectors[t]);
+
+	// One more record for the header of the delta
+	if (overlay)
+		count++;
+
+	struct journal_header header;
+	struct journal_record *records = new struct journal_record[count];
+	uint32_t idx = 0;
+
+	for (int t = 0; t < DISK_TRACKS_PER_DISK; t++) {
+		for (int s = 0; s < DISK_SECTORS_PER_TRACK; s++) {
+			if (! (pendingSectors[t] & (1 << s)))
+				continue;
+
+			unsigned int sector = t * sectorsPerTrack + s;
+
+			records[idx].offset = sector * DISK_BYTES_PER_SECTOR;
+			memcpy(records[idx].data, pendingData[t][s], DISK_BYTES_PER_SECTOR);
+
+			if (overlay) {
+				records[idx].offset += OVERLAY_DATA_OFFSET;
+				DiskOverlay::setSector(&overlayHeader, sector);
+			}
+
+			idx++;
+		}
+	}
+
+	if (overlay) {
+		records[idx].offset = 0;
+		memcpy(records[idx].data, &overlayHeader, sizeof(overlayHeader));
+		idx++;
+	}
+
+	header.magic = JOURNAL_MAGIC;
+	header.count = count;
+	header.checksum = journalChecksum(records, count);
+	header.reserved = 0;
+
+	// 1. The journal holds the new sectors. If this fails, a journal
+	// left by an earlier failed commit is still whole: these records
+	// include its sectors, which are still pending.
+	bool ok = writeJournal(journalFilename, &header, records, count);
+
+	// 2. The image gets them. A crash from now on is repaired by replay().
+	for (uint32_t x = 0; ok && x < count; x++)
+		ok = writeFully(imageFd, records[x].data, DISK_BYTES_PER_SECTOR, records[x].offset);
+
+	ok = ok && fsync(imageFd) == 0;
+
+	// 3. Nothing left to replay
+	ok = ok && unlink(journalFilename.c_str()) == 0;
+
+	if (! ok) {
+		// Only complain once, not at every retry
+		if (! failed)
+			LOG(LOG_DISK, LOG_ERROR, "Unable to save %u sectors to %s: %s\n", count, filename.c_str(), strerror(errno));
+	} else {
+		if (failed)
+			LOG(LOG_DISK, LOG_INFO, "Saved %u sectors to %s after all\n", count, filename.c_str());
+		else
+			LOG(LOG_DISK, LOG_DEBUG, "Saved %u sectors to %s\n", count, filename.c_str());
+
+		for (int t = 0; t < DISK_TRACKS_PER_DISK; t++)
+			pendingSectors[t] = 0;
+
+		__atomic_store_n(&queueCommitted, committed, __ATOMIC_RELEASE);
+	}
+
+	failed = ! ok;
+
+	delete[] records;
+
+	__atomic_store_n(&queueAttempted, committed, __ATOMIC_RELEASE);
+}
+
+/* Whether replay() has something to do for 'filename' */
+bool
+DiskWriter::hasJournal(std::string filename)
+{
+	std::string journalFilename = filename + DISKWRITER_JOURNAL_SUFFIX;
+
+	return(access(journalFilename.c_str(), F_OK) == 0);
+}
+
+/*
+ * Finish the commit that was interrupted when the emulator last wrote to
+ * 'filename'. Journals are renamed into place once complete, so one that
+ * doesn't check out is damaged rather than torn: it is set aside instead
+ * of being applied or deleted.
+ */
+bool
+DiskWriter::replay(std::string filename)
+{
+	std::string journalFilename = filename + DISKWRITER_JOURNAL_SUFFIX;
+	struct journal_header header;
+	bool damaged = false;
+	bool success = true;
+
+	int fd = open(journalFilename.c_str(), O_RDONLY);
+
+	if (fd < 0)
+		return(true);
+
+	ssize_t len = pread(fd, &header, sizeof(header), 0);
+
+	if (len == 0) {
+		// Empty: the last commit completed
+		close(fd);
+		unlink(journalFilename.c_str());
+		return(true);
+	}
+
+	off_t size = lseek(fd, 0, SEEK_END);
+
+	if (len != sizeof(header) || header.magic != JOURNAL_MAGIC
+	    || header.count > DISK_TRACKS_PER_DISK * DISK_SECTORS_PER_TRACK + 1
+	    || size != (off_t) (sizeof(header) + header.count * sizeof(struct journal_record))) {
+		damaged = true;
+	} else {
+		struct journal_record *records = new struct journal_record[header.count];
+		size_t recordsLen = header.count * sizeof(*records);
+
+		if (pread(fd, records, recordsLen, sizeof(header)) != (ssize_t) recordsLen
+		    || journalChecksum(records, header.count) != header.checksum) {
+			damaged = true;
+		} else {
+			int imageFd = open(filename.c_str(), O_WRONLY);
+
+			for (uint32_t x = 0; success && x < header.count; x++)
+				success = imageFd >= 0 && writeFully(imageFd, records[x].data, DISK_BYTES_PER_SECTOR, records[x].offset);
+
+			success = success && fsync(imageFd) == 0;
+
+			if (imageFd >= 0)
+				close(imageFd);
+
+			// Keep the journal if it couldn't be applied: the next open tries again
+			if (success) {
+				LOG(LOG_DISK, LOG_INFO, "Recovered %u sectors of %s from its journal\n", header.count, filename.c_str());
+				unlink(journalFilename.c_str());
+			} else {
+				LOG(LOG_DISK, LOG_ERROR, "Unable to replay journal %s: %s\n", journalFilename.c_str(), strerror(errno));
+			}
+		}
+
+		delete[] records;
+	}
+
+	close(fd);
+
+	if (damaged) {
+		std::string badFilename = journalFilename + JOURNAL_BAD_SUFFIX;
+
+		LOG(LOG_DISK, LOG_WARN, "Journal %s is damaged, kept as %s\n", journalFilename.c_str(), badFilename.c_str());
+		rename(journalFilename.c_str(), badFilename.c_str());
+		success = false;
+	}
+
+	return(success);
+}
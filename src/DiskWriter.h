@@ -0,0 +1,108 @@
+/*
+ * DiskWriter.h - Background write-back of disk images
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * DiskWriter.h - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 14:02:37 2026
+ * Revision : $Id$
+ */
+
+#ifndef _DISKWRITER_H
+#define _DISKWRITER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "Disk.h"
+#include "DiskOverlay.h"
+
+#define DISKWRITER_QUEUE_SIZE 64        // Track batches waiting for the writer. Must be a power of 2.
+#define DISKWRITER_JOURNAL_SUFFIX ".journal"
+
+// A batch of sectors of one track. 'sectors' has bit N set when
+// data[N] holds sector N, in image order.
+struct diskwriter_batch {
+	uint8_t track;
+	uint16_t sectors;
+	uint8_t data[DISK_SECTORS_PER_TRACK][DISK_BYTES_PER_SECTOR];
+};
+
+/*
+ * Writes the sectors of a disk image from a background thread, so the
+ * emulation never waits on the host's storage.
+ *
+ * The emulator thread hands over whole tracks through a single-producer
+ * lock-free queue. The writer collects everything queued since its last
+ * pass, merging the batches of the same track, and commits them at once:
+ * the sectors first go to a journal next to the image, which is synced
+ * and renamed into place, then to the image, which is synced, then the
+ * journal is removed. After a crash, replay() finishes the journal, so
+ * each sector holds either its old or its new contents. A commit that
+ * fails keeps its sectors and is retried; sync() reports it.
+ *
+ * The file written to can also be the delta of an overlay (see
+ * DiskOverlay.h) rather than the image itself.
+ */
+class DiskWriter
+{
+public:
+	DiskWriter(std::string filename);
+	~DiskWriter(void);
+	void setOverlay(const struct overlay_header *header);
+	void setSectorsPerTrack(uint8_t sectors) { sectorsPerTrack = sectors; }
+	bool start(void);
+	bool submit(const struct diskwriter_batch *batch);
+	bool sync(void);
+
+	static bool replay(std::string filename);
+	static bool hasJournal(std::string filename);
+
+private:
+	static void *threadMain(void *arg);
+	bool drainQueue(void);
+	void commit(void);
+
+	std::string filename;
+	std::string journalFilename;
+	int imageFd;
+
+	struct diskwriter_batch *queue;
+	uint32_t queueHead;             // Next batch to fill (emulator thread)
+	uint32_t queueTail;             // Next batch to take (writer thread)
+	uint32_t queueCommitted;        // Batches safely on disk, for sync()
+	uint32_t queueAttempted;        // Batches the writer tried to commit, for sync()
+
+	// Sectors merged from the queue, waiting to be committed
+	uint16_t pendingSectors[DISK_TRACKS_PER_DISK];
+	uint8_t (*pendingData)[DISK_SECTORS_PER_TRACK][DISK_BYTES_PER_SECTOR];
+	bool failed;                    // The last commit failed: retry it
+
+	// When writing to an overlay delta, the sectors go after its header,
+	// and the updated header is committed with them.
+	bool overlay;
+	struct overlay_header overlayHeader;
+
+	uint8_t sectorsPerTrack;        // Of the image, to place the sectors
+
+	pthread_t thread;
+	bool running;
+	bool stop;
+};
+
+#endif
@@ -0,0 +1,890 @@
+/*
+ * Gcr.cc - 6-and-2 encoding and decoding kernels
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Gcr.cc - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 19:47:20 2026
+ * Revision : $Id$
+ */
+
+#include "Gcr.h"
+#include "Disk.h"
+#include "Log.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef GCR_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * A sector is encoded as 342 6-bit values: 0x56 auxiliary values holding
+ * the low 2 bits of three data bytes each, then the high 6 bits of the
+ * 256 data bytes. Each nibble written is XLAT62[] of a value XOR'd with
+ * the previous value, so the encoder has no dependency from one nibble
+ * to the next, while the decoder needs a prefix XOR to get the values
+ * back.
+ */
+#define GCR_AUX_LEN 0x56
+
+// The SIMD kernels work on copies padded so they can run past the end
+#define GCR_PAD_LEN 32
+
+const uint8_t XLAT62[64] = {
+	0x96, 0x97, 0x9A, 0x9B, 0x9D, 0x9E, 0x9F, 0xA6,
+	0xA7, 0xAB, 0xAC, 0xAD, 0xAE, 0xAF, 0xB2, 0xB3,
+	0xB4, 0xB5, 0xB6, 0xB7, 0xB9, 0xBA, 0xBB, 0xBC,
+	0xBD, 0xBE, 0xBF, 0xCB,	0xCD, 0xCE, 0xCF, 0xD3,
+	0xD6, 0xD7, 0xD9, 0xDA, 0xDB, 0xDC, 0xDD, 0xDE,
+	0xDF, 0xE5, 0xE6, 0xE7, 0xE9, 0xEA, 0xEB, 0xEC,
+	0xED, 0xEE, 0xEF, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6,
+	0xF7, 0xF9, 0xFA, 0xFB,	0xFC, 0xFD, 0xFE, 0xFF };
+
+// Value of each nibble, without its bit 7, or 0xFF if it isn't in XLAT62
+static uint8_t UNXLAT62[128];
+
+/*
+ * 5-and-3: the 256 bytes of a sector become 410 5-bit values. The top 5
+ * bits of every byte make 256 of them. The rest is done in groups of 5
+ * bytes: the low 3 bits of the first three bytes go to bits 2-4 of three
+ * values, and the low bits of the other two bytes to bits 0-1 of the
+ * same three. The low bits of the last byte make the 154th value.
+ */
+#define GCR53_CHUNK_LEN 0x33          // Groups of 5 bytes
+#define GCR53_THREES_LEN 0x9A         // Values holding the low 3 bits
+
+const uint8_t XLAT53[32] = {
+	0xAB, 0xAD, 0xAE, 0xAF, 0xB5, 0xB6, 0xB7, 0xBA,
+	0xBB, 0xBD, 0xBE, 0xBF, 0xD6, 0xD7, 0xDA, 0xDB,
+	0xDD, 0xDE, 0xDF, 0xEA, 0xEB, 0xED, 0xEE, 0xEF,
+	0xF5, 0xF6, 0xF7, 0xFA, 0xFB, 0xFD, 0xFE, 0xFF };
+
+// Value of each nibble, or 0xFF if it isn't in XLAT53
+static const uint8_t UNXLAT53[256] = {
+#define __ 0xFF
+	__, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,     // $00
+	__, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,     // $10
+	__, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,     // $20
+	__, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,     // $30
+	__, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,     // $40
+	__, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,     // $50
+	__, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,     // $60
+	__, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,     // $70
+	__, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,     // $80
+	__, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,     // $90
+	__, __, __, __, __, __, __, __, __, __, __, 0x00, __, 0x01, 0x02, 0x03,     // $A0
+	__, __, __, __, __, 0x04, 0x05, 0x06, __, __, 0x07, 0x08, __, 0x09, 0x0A, 0x0B, // $B0
+	__, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,     // $C0
+	__, __, __, __, __, __, 0x0C, 0x0D, __, __, 0x0E, 0x0F, __, 0x10, 0x11, 0x12, // $D0
+	__, __, __, __, __, __, __, __, __, __, 0x13, 0x14, __, 0x15, 0x16, 0x17, // $E0
+	__, __, __, __, __, 0x18, 0x19, 0x1A, __, __, 0x1B, 0x1C, __, 0x1D, 0x1E, 0x1F, // $F0
+#undef __
+};
+
+// The low 2 bits of a byte are stored swapped
+static const uint8_t LOW2[16] = { 0x00, 0x02, 0x01, 0x03 };
+
+enum gcr_kernels Gcr::kernel = GCR_NB_KERNELS;
+uint8_t (*Gcr::encodeKernel)(const uint8_t *in, uint8_t *out) = Gcr::encodeFirst;
+bool (*Gcr::decodeKernel)(const uint8_t *in, uint8_t *out) = Gcr::decodeFirst;
+
+static uint8_t
+encodeScalar(const uint8_t *in, uint8_t *out)
+{
+	// The low bits. in[0x100] and in[0x101] don't exist: the last two
+	// values only hold two bytes.
+	for (int x = 0; x < GCR_AUX_LEN; x++) {
+		uint8_t b3 = x < 0x54 ? LOW2[in[GCR_AUX_LEN * 2 + x] & 0x03] : 0;
+		uint8_t b2 = LOW2[in[GCR_AUX_LEN + x] & 0x03];
+		uint8_t b1 = LOW2[in[x] & 0x03];
+
+		out[x] = b3 << 4 | b2 << 2 | b1;
+	}
+
+	// The high bits
+	for (int x = 0; x < DISK_BYTES_PER_SECTOR; x++)
+		out[GCR_AUX_LEN + x] = in[x] >> 2;
+
+	uint8_t last = 0;
+
+	for (int x = 0; x < DISK_USERDATA_LEN; x++) {
+		uint8_t value = out[x];
+
+		out[x] = XLAT62[value ^ last];
+		last = value;
+	}
+
+	// The checksum brings the chain back to zero when decoding
+	return(last);
+}
+
+static bool
+decodeScalar(const uint8_t *in, uint8_t *out)
+{
+	uint8_t buf[DISK_USERDATA_LEN];
+	uint8_t last = 0;
+
+	for (int x = 0; x < DISK_USERDATA_LEN; x++) {
+		uint8_t value = (in[x] & 0x80) ? UNXLAT62[in[x] & 0x7F] : 0xFF;
+
+		if (value == 0xFF)
+			return(false);
+
+		last ^= value;
+		buf[x] = last;
+	}
+
+	uint8_t checksum = (in[DISK_USERDATA_LEN] & 0x80) ? UNXLAT62[in[DISK_USERDATA_LEN] & 0x7F] : 0xFF;
+
+	if (checksum != last)
+		return(false);
+
+	for (int x = 0; x < DISK_BYTES_PER_SECTOR; x++) {
+		uint8_t low;
+
+		if (x < GCR_AUX_LEN)
+			low = buf[x];
+		else if (x < GCR_AUX_LEN * 2)
+			low = buf[x - GCR_AUX_LEN] >> 2;
+		else
+			low = buf[x - GCR_AUX_LEN * 2] >> 4;
+
+		out[x] = buf[GCR_AUX_LEN + x] << 2 | LOW2[low & 0x03];
+	}
+
+	return(true);
+}
+
+/* Encode 256 bytes into 410 nibbles 5-and-3. Returns the checksum, before translation. */
+uint8_t
+Gcr::encode5And3(const uint8_t *in, uint8_t *out)
+{
+	uint8_t threes[GCR53_THREES_LEN];
+	uint8_t top[DISK_BYTES_PER_SECTOR];
+
+	// The groups of 5 bytes are stored from the last to the first
+	for (int chunk = GCR53_CHUNK_LEN - 1, x = 0; chunk >= 0; chunk--, x += 5) {
+		const uint8_t *b = &in[x];
+
+		for (int y = 0; y < 5; y++)
+			top[chunk + GCR53_CHUNK_LEN * y] = b[y] >> 3;
+
+		threes[chunk] = (b[0] & 0x07) << 2 | (b[3] & 0x04) >> 1 | (b[4] & 0x04) >> 2;
+		threes[chunk + GCR53_CHUNK_LEN] = (b[1] & 0x07) << 2 | (b[3] & 0x02) | (b[4] & 0x02) >> 1;
+		threes[chunk + GCR53_CHUNK_LEN * 2] = (b[2] & 0x07) << 2 | (b[3] & 0x01) << 1 | (b[4] & 0x01);
+	}
+
+	top[DISK_BYTES_PER_SECTOR - 1] = in[DISK_BYTES_PER_SECTOR - 1] >> 3;
+	threes[GCR53_THREES_LEN - 1] = in[DISK_BYTES_PER_SECTOR - 1] & 0x07;
+
+	// The low bits go first, backwards
+	uint8_t last = 0;
+
+	for (int x = GCR53_THREES_LEN - 1; x >= 0; x--) {
+		*out++ = XLAT53[threes[x] ^ last];
+		last = threes[x];
+	}
+
+	for (int x = 0; x < DISK_BYTES_PER_SECTOR; x++) {
+		*out++ = XLAT53[top[x] ^ last];
+		last = top[x];
+	}
+
+	return(last);
+}
+
+/* Decode 411 nibbles (with the checksum) encoded 5-and-3. Returns false if they are damaged. */
+bool
+Gcr::decode5And3(const uint8_t *in, uint8_t *out)
+{
+	uint8_t threes[GCR53_THREES_LEN];
+	uint8_t top[DISK_BYTES_PER_SECTOR];
+	uint8_t last = 0;
+
+	for (int x = GCR53_THREES_LEN - 1; x >= 0; x--) {
+		uint8_t value = UNXLAT53[*in++];
+
+		if (value == 0xFF)
+			return(false);
+
+		last ^= value;
+		threes[x] = last;
+	}
+
+	for (int x = 0; x < DISK_BYTES_PER_SECTOR; x++) {
+		uint8_t value = UNXLAT53[*in++];
+
+		if (value == 0xFF)
+			return(false);
+
+		last ^= value;
+		top[x] = last << 3;
+	}
+
+	if (UNXLAT53[*in] != last)
+		return(false);
+
+	for (int chunk = GCR53_CHUNK_LEN - 1; chunk >= 0; chunk--) {
+		uint8_t t1 = threes[chunk];
+		uint8_t t2 = threes[chunk + GCR53_CHUNK_LEN];
+		uint8_t t3 = threes[chunk + GCR53_CHUNK_LEN * 2];
+
+		*out++ = top[chunk] | (t1 >> 2);
+		*out++ = top[chunk + GCR53_CHUNK_LEN] | (t2 >> 2);
+		*out++ = top[chunk + GCR53_CHUNK_LEN * 2] | (t3 >> 2);
+		*out++ = top[chunk + GCR53_CHUNK_LEN * 3] | ((t1 & 0x02) << 1 | (t2 & 0x02) | (t3 & 0x02) >> 1);
+		*out++ = top[chunk + GCR53_CHUNK_LEN * 4] | ((t1 & 0x01) << 2 | (t2 & 0x01) << 1 | (t3 & 0x01));
+	}
+
+	*out = top[DISK_BYTES_PER_SECTOR - 1] | threes[GCR53_THREES_LEN - 1];
+
+	return(true);
+}
+
+#ifdef GCR_X86
+/* XLAT62[v] for 16 values < 64: one PSHUFB per row of 16 entries */
+__attribute__((target("ssse3")))
+static inline __m128i
+translateSSSE3(__m128i v)
+{
+	__m128i lo = _mm_and_si128(v, _mm_set1_epi8(0x0F));
+	__m128i result = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) &XLAT62[0]), lo);
+
+	for (int row = 1; row < 4; row++) {
+		__m128i inRow = _mm_cmpgt_epi8(v, _mm_set1_epi8(row * 16 - 1));
+		__m128i t = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) &XLAT62[row * 16]), lo);
+
+		result = _mm_or_si128(_mm_andnot_si128(inRow, result), _mm_and_si128(inRow, t));
+	}
+
+	return(result);
+}
+
+/* UNXLAT62[] of 16 nibbles, 0xFF for the invalid ones */
+__attribute__((target("ssse3")))
+static inline __m128i
+untranslateSSSE3(__m128i n)
+{
+	__m128i lo = _mm_and_si128(n, _mm_set1_epi8(0x0F));
+	__m128i row = _mm_and_si128(n, _mm_set1_epi8(0x70));
+	__m128i result = _mm_setzero_si128();
+
+	for (int r = 0; r < 8; r++) {
+		__m128i inRow = _mm_cmpeq_epi8(row, _mm_set1_epi8(r * 16));
+		__m128i t = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) &UNXLAT62[r * 16]), lo);
+
+		result = _mm_or_si128(result, _mm_and_si128(inRow, t));
+	}
+
+	// Bit 7 is always set in a nibble
+	return(_mm_or_si128(result, _mm_cmpgt_epi8(n, _mm_set1_epi8(-1))));
+}
+
+__attribute__((target("ssse3")))
+static uint8_t
+encodeSSSE3(const uint8_t *in, uint8_t *out)
+{
+	uint8_t src[DISK_BYTES_PER_SECTOR + GCR_PAD_LEN];
+	uint8_t values[1 + DISK_USERDATA_LEN + GCR_PAD_LEN];   // values[0] precedes the first value
+	uint8_t nibbles[DISK_USERDATA_LEN + GCR_PAD_LEN];
+	const __m128i low2 = _mm_loadu_si128((const __m128i *) LOW2);
+	const __m128i mask2 = _mm_set1_epi8(0x03);
+
+	memcpy(src, in, DISK_BYTES_PER_SECTOR);
+	memset(&src[DISK_BYTES_PER_SECTOR], 0x00, GCR_PAD_LEN);
+	memset(values, 0x00, sizeof(values));
+
+	// The padding's zeroes stand for the missing in[0x100] and in[0x101]
+	for (int x = 0; x < GCR_AUX_LEN; x += 16) {
+		__m128i b1 = _mm_shuffle_epi8(low2, _mm_and_si128(_mm_loadu_si128((const __m128i *) &src[x]), mask2));
+		__m128i b2 = _mm_shuffle_epi8(low2, _mm_and_si128(_mm_loadu_si128((const __m128i *) &src[GCR_AUX_LEN + x]), mask2));
+		__m128i b3 = _mm_shuffle_epi8(low2, _mm_and_si128(_mm_loadu_si128((const __m128i *) &src[GCR_AUX_LEN * 2 + x]), mask2));
+
+		// The values are small enough not to cross into the next byte
+		__m128i v = _mm_or_si128(b1, _mm_or_si128(_mm_slli_epi16(b2, 2), _mm_slli_epi16(b3, 4)));
+
+		_mm_storeu_si128((__m128i *) &values[1 + x], v);
+	}
+
+	for (int x = 0; x < DISK_BYTES_PER_SECTOR; x += 16) {
+		__m128i v = _mm_srli_epi16(_mm_loadu_si128((const __m128i *) &src[x]), 2);
+
+		_mm_storeu_si128((__m128i *) &values[1 + GCR_AUX_LEN + x], _mm_and_si128(v, _mm_set1_epi8(0x3F)));
+	}
+
+	memset(&values[1 + DISK_USERDATA_LEN], 0x00, GCR_PAD_LEN);
+
+	for (int x = 0; x < DISK_USERDATA_LEN; x += 16) {
+		__m128i v = _mm_xor_si128(_mm_loadu_si128((const __m128i *) &values[1 + x]),
+		                          _mm_loadu_si128((const __m128i *) &values[x]));
+
+		_mm_storeu_si128((__m128i *) &nibbles[x], translateSSSE3(v));
+	}
+
+	memcpy(out, nibbles, DISK_USERDATA_LEN);
+
+	return(values[DISK_USERDATA_LEN]);
+}
+
+__attribute__((target("ssse3")))
+static bool
+decodeSSSE3(const uint8_t *in, uint8_t *out)
+{
+	uint8_t nibbles[DISK_USERDATA_LEN + 1 + GCR_PAD_LEN];
+	uint8_t values[DISK_USERDATA_LEN + 1 + GCR_PAD_LEN];
+	uint8_t data[DISK_BYTES_PER_SECTOR + GCR_PAD_LEN];
+	const __m128i low2 = _mm_loadu_si128((const __m128i *) LOW2);
+	const __m128i mask2 = _mm_set1_epi8(0x03);
+	__m128i bad = _mm_setzero_si128();
+	__m128i carry = _mm_setzero_si128();
+
+	// The padding decodes to zeroes, which leave the prefix XOR alone
+	memcpy(nibbles, in, DISK_USERDATA_LEN + 1);
+	memset(&nibbles[DISK_USERDATA_LEN + 1], XLAT62[0], GCR_PAD_LEN);
+
+	for (int x = 0; x < DISK_USERDATA_LEN + 1; x += 16) {
+		__m128i v = untranslateSSSE3(_mm_loadu_si128((const __m128i *) &nibbles[x]));
+
+		bad = _mm_or_si128(bad, _mm_cmpeq_epi8(v, _mm_set1_epi8(0xFF)));
+
+		// Prefix XOR within the vector, then with everything before it
+		v = _mm_xor_si128(v, _mm_slli_si128(v, 1));
+		v = _mm_xor_si128(v, _mm_slli_si128(v, 2));
+		v = _mm_xor_si128(v, _mm_slli_si128(v, 4));
+		v = _mm_xor_si128(v, _mm_slli_si128(v, 8));
+		v = _mm_xor_si128(v, carry);
+		carry = _mm_shuffle_epi8(v, _mm_set1_epi8(15));
+
+		_mm_storeu_si128((__m128i *) &values[x], v);
+	}
+
+	// With the checksum included, the chain comes back to zero
+	if (_mm_movemask_epi8(bad) || values[DISK_USERDATA_LEN] != 0)
+		return(false);
+
+	// The low bits of the three thirds of the sector are at bits 0-1,
+	// 2-3 and 4-5 of the auxiliary values. Each third overwrites what
+	// the previous one wrote past its end.
+	for (int third = 0; third < 3; third++) {
+		int base = third * GCR_AUX_LEN;
+
+		for (int x = 0; x < GCR_AUX_LEN; x += 16) {
+			__m128i aux = _mm_srli_epi16(_mm_loadu_si128((const __m128i *) &values[x]), third * 2);
+			__m128i low = _mm_shuffle_epi8(low2, _mm_and_si128(aux, mask2));
+			__m128i high = _mm_slli_epi16(_mm_loadu_si128((const __m128i *) &values[GCR_AUX_LEN + base + x]), 2);
+
+			_mm_storeu_si128((__m128i *) &data[base + x], _mm_or_si128(high, low));
+		}
+	}
+
+	memcpy(out, data, DISK_BYTES_PER_SECTOR);
+
+	return(true);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+loadRowAVX2(const uint8_t *row)
+{
+	return(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *) row)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+translateAVX2(__m256i v)
+{
+	__m256i lo = _mm256_and_si256(v, _mm256_set1_epi8(0x0F));
+	__m256i result = _mm256_shuffle_epi8(loadRowAVX2(&XLAT62[0]), lo);
+
+	for (int row = 1; row < 4; row++) {
+		__m256i inRow = _mm256_cmpgt_epi8(v, _mm256_set1_epi8(row * 16 - 1));
+		__m256i t = _mm256_shuffle_epi8(loadRowAVX2(&XLAT62[row * 16]), lo);
+
+		result = _mm256_blendv_epi8(result, t, inRow);
+	}
+
+	return(result);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+untranslateAVX2(__m256i n)
+{
+	__m256i lo = _mm256_and_si256(n, _mm256_set1_epi8(0x0F));
+	__m256i row = _mm256_and_si256(n, _mm256_set1_epi8(0x70));
+	__m256i result = _mm256_setzero_si256();
+
+	for (int r = 0; r < 8; r++) {
+		__m256i inRow = _mm256_cmpeq_epi8(row, _mm256_set1_epi8(r * 16));
+		__m256i t = _mm256_shuffle_epi8(loadRowAVX2(&UNXLAT62[r * 16]), lo);
+
+		result = _mm256_or_si256(result, _mm256_and_si256(inRow, t));
+	}
+
+	return(_mm256_or_si256(result, _mm256_cmpgt_epi8(n, _mm256_set1_epi8(-1))));
+}
+
+__attribute__((target("avx2")))
+static uint8_t
+encodeAVX2(const uint8_t *in, uint8_t *out)
+{
+	uint8_t src[DISK_BYTES_PER_SECTOR + GCR_PAD_LEN];
+	uint8_t values[1 + DISK_USERDATA_LEN + GCR_PAD_LEN];
+	uint8_t nibbles[DISK_USERDATA_LEN + GCR_PAD_LEN];
+	const __m256i low2 = loadRowAVX2(LOW2);
+	const __m256i mask2 = _mm256_set1_epi8(0x03);
+
+	memcpy(src, in, DISK_BYTES_PER_SECTOR);
+	memset(&src[DISK_BYTES_PER_SECTOR], 0x00, GCR_PAD_LEN);
+	memset(values, 0x00, sizeof(values));
+
+	for (int x = 0; x < GCR_AUX_LEN; x += 32) {
+		__m256i b1 = _mm256_shuffle_epi8(low2, _mm256_and_si256(_mm256_loadu_si256((const __m256i *) &src[x]), mask2));
+		__m256i b2 = _mm256_shuffle_epi8(low2, _mm256_and_si256(_mm256_loadu_si256((const __m256i *) &src[GCR_AUX_LEN + x]), mask2));
+		__m256i b3 = _mm256_shuffle_epi8(low2, _mm256_and_si256(_mm256_loadu_si256((const __m256i *) &src[GCR_AUX_LEN * 2 + x]), mask2));
+		__m256i v = _mm256_or_si256(b1, _mm256_or_si256(_mm256_slli_epi16(b2, 2), _mm256_slli_epi16(b3, 4)));
+
+		_mm256_storeu_si256((__m256i *) &values[1 + x], v);
+	}
+
+	for (int x = 0; x < DISK_BYTES_PER_SECTOR; x += 32) {
+		__m256i v = _mm256_srli_epi16(_mm256_loadu_si256((const __m256i *) &src[x]), 2);
+
+		_mm256_storeu_si256((__m256i *) &values[1 + GCR_AUX_LEN + x], _mm256_and_si256(v, _mm256_set1_epi8(0x3F)));
+	}
+
+	memset(&values[1 + DISK_USERDATA_LEN], 0x00, GCR_PAD_LEN);
+
+	for (int x = 0; x < DISK_USERDATA_LEN; x += 32) {
+		__m256i v = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) &values[1 + x]),
+		                             _mm256_loadu_si256((const __m256i *) &values[x]));
+
+		_mm256_storeu_si256((__m256i *) &nibbles[x], translateAVX2(v));
+	}
+
+	memcpy(out, nibbles, DISK_USERDATA_LEN);
+
+	return(values[DISK_USERDATA_LEN]);
+}
+
+__attribute__((target("avx2")))
+static bool
+decodeAVX2(const uint8_t *in, uint8_t *out)
+{
+	uint8_t nibbles[DISK_USERDATA_LEN + 1 + GCR_PAD_LEN];
+	uint8_t values[DISK_USERDATA_LEN + 1 + GCR_PAD_LEN];
+	uint8_t data[DISK_BYTES_PER_SECTOR + GCR_PAD_LEN];
+	const __m256i low2 = loadRowAVX2(LOW2);
+	const __m256i mask2 = _mm256_set1_epi8(0x03);
+	const __m256i last = _mm256_set1_epi8(15);
+	__m256i bad = _mm256_setzero_si256();
+	__m256i carry = _mm256_setzero_si256();
+
+	memcpy(nibbles, in, DISK_USERDATA_LEN + 1);
+	memset(&nibbles[DISK_USERDATA_LEN + 1], XLAT62[0], GCR_PAD_LEN);
+
+	for (int x = 0; x < DISK_USERDATA_LEN + 1; x += 32) {
+		__m256i v = untranslateAVX2(_mm256_loadu_si256((const __m256i *) &nibbles[x]));
+
+		bad = _mm256_or_si256(bad, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0xFF)));
+
+		// The byte shifts stay within each 128-bit lane, so the low
+		// lane's total is then carried into the high lane.
+		v = _mm256_xor_si256(v, _mm256_slli_si256(v, 1));
+		v = _mm256_xor_si256(v, _mm256_slli_si256(v, 2));
+		v = _mm256_xor_si256(v, _mm256_slli_si256(v, 4));
+		v = _mm256_xor_si256(v, _mm256_slli_si256(v, 8));
+
+		__m256i laneTotals = _mm256_shuffle_epi8(v, last);
+
+		v = _mm256_xor_si256(v, _mm256_permute2x128_si256(laneTotals, laneTotals, 0x08));
+		v = _mm256_xor_si256(v, carry);
+
+		laneTotals = _mm256_shuffle_epi8(v, last);
+		carry = _mm256_permute2x128_si256(laneTotals, laneTotals, 0x11);
+
+		_mm256_storeu_si256((__m256i *) &values[x], v);
+	}
+
+	if (_mm256_movemask_epi8(bad) || values[DISK_USERDATA_LEN] != 0)
+		return(false);
+
+	for (int third = 0; third < 3; third++) {
+		int base = third * GCR_AUX_LEN;
+
+		for (int x = 0; x < GCR_AUX_LEN; x += 32) {
+			__m256i aux = _mm256_srli_epi16(_mm256_loadu_si256((const __m256i *) &values[x]), third * 2);
+			__m256i low = _mm256_shuffle_epi8(low2, _mm256_and_si256(aux, mask2));
+			__m256i high = _mm256_slli_epi16(_mm256_loadu_si256((const __m256i *) &values[GCR_AUX_LEN + base + x]), 2);
+
+			_mm256_storeu_si256((__m256i *) &data[base + x], _mm256_or_si256(high, low));
+		}
+	}
+
+	memcpy(out, data, DISK_BYTES_PER_SECTOR);
+
+	return(true);
+}
+#endif
+
+struct gcr_kernel {
+	const char *name;
+	uint8_t (*encode)(const uint8_t *in, uint8_t *out);
+	bool (*decode)(const uint8_t *in, uint8_t *out);
+};
+
+static const struct gcr_kernel KERNELS[GCR_NB_KERNELS] = {
+	{ "scalar", encodeScalar, decodeScalar },
+#ifdef GCR_X86
+	{ "ssse3",  encodeSSSE3,  decodeSSSE3 },
+	{ "avx2",   encodeAVX2,   decodeAVX2 },
+#else
+	{ "ssse3",  NULL,         NULL },
+	{ "avx2",   NULL,         NULL },
+#endif
+};
+
+/* Build the decoding table and pick the best kernel for this CPU */
+void
+Gcr::setup(void)
+{
+	memset(UNXLAT62, 0xFF, sizeof(UNXLAT62));
+
+	for (int x = 0; x < 64; x++)
+		UNXLAT62[XLAT62[x] & 0x7F] = x;
+
+	kernel = GCR_KERNEL_SCALAR;
+
+	for (int k = GCR_NB_KERNELS - 1; k > GCR_KERNEL_SCALAR; k--) {
+		if (isSupported((enum gcr_kernels) k)) {
+			kernel = (enum gcr_kernels) k;
+			break;
+		}
+	}
+
+	// Once the kernels are published, callers skip init(): the tables
+	// must be visible to them by then.
+	__atomic_store_n(&encodeKernel, KERNELS[kernel].encode, __ATOMIC_RELEASE);
+	__atomic_store_n(&decodeKernel, KERNELS[kernel].decode, __ATOMIC_RELEASE);
+
+	LOG(LOG_DISK, LOG_DEBUG, "Using the %s 6-and-2 kernels\n", KERNELS[kernel].name);
+}
+
+/* Disk sets and dskindex code sectors from several threads: only set up once */
+void
+Gcr::init(void)
+{
+	static pthread_once_t initOnce = PTHREAD_ONCE_INIT;
+
+	pthread_once(&initOnce, setup);
+}
+
+uint8_t
+Gcr::encodeFirst(const uint8_t *in, uint8_t *out)
+{
+	init();
+
+	return(encodeKernel(in, out));
+}
+
+bool
+Gcr::decodeFirst(const uint8_t *in, uint8_t *out)
+{
+	init();
+
+	return(decodeKernel(in, out));
+}
+
+/* Encode 256 bytes into 342 nibbles. Returns the checksum, before translation. */
+uint8_t
+Gcr::encode6And2(const uint8_t *in, uint8_t *out)
+{
+	return(__atomic_load_n(&encodeKernel, __ATOMIC_ACQUIRE)(in, out));
+}
+
+/* Decode 343 nibbles (with the checksum) into 256 bytes. Returns false if they are damaged. */
+bool
+Gcr::decode6And2(const uint8_t *in, uint8_t *out)
+{
+	return(__atomic_load_n(&decodeKernel, __ATOMIC_ACQUIRE)(in, out));
+}
+
+bool
+Gcr::isSupported(enum gcr_kernels kernel)
+{
+	switch(kernel) {
+		case GCR_KERNEL_SCALAR:
+			return(true);
+
+#ifdef GCR_X86
+		case GCR_KERNEL_SSSE3:
+			return(__builtin_cpu_supports("ssse3"));
+
+		case GCR_KERNEL_AVX2:
+			return(__builtin_cpu_supports("avx2"));
+#endif
+
+		default:
+			return(false);
+	}
+}
+
+/* Use 'kernel' from now on. Returns false if the CPU doesn't support it. */
+bool
+Gcr::setKernel(enum gcr_kernels kernel)
+{
+	init();
+
+	if (kernel >= GCR_NB_KERNELS || ! isSupported(kernel))
+		return(false);
+
+	Gcr::kernel = kernel;
+	__atomic_store_n(&encodeKernel, KERNELS[kernel].encode, __ATOMIC_RELEASE);
+	__atomic_store_n(&decodeKernel, KERNELS[kernel].decode, __ATOMIC_RELEASE);
+
+	return(true);
+}
+
+enum gcr_kernels
+Gcr::getKernel(void)
+{
+	init();
+
+	return(kernel);
+}
+
+const char *
+Gcr::kernelName(enum gcr_kernels kernel)
+{
+	if (kernel >= GCR_NB_KERNELS)
+		return("unknown");
+
+	return(KERNELS[kernel].name);
+}
+
+/*
+ * Compare one sector through a kernel with the scalar version: the
+ * nibbles and checksum it encodes to, and what it decodes to once
+ * 'damage' replaces the nibble at 'pos' (none if pos is -1).
+ */
+static bool
+compareKernel(const struct gcr_kernel *k, const uint8_t *data, int pos, uint8_t damage)
+{
+	uint8_t expected[DISK_USERDATA_LEN + 1];
+	uint8_t nibbles[DISK_USERDATA_LEN + 1];
+	uint8_t expectedData[DISK_BYTES_PER_SECTOR];
+	uint8_t decoded[DISK_BYTES_PER_SECTOR];
+
+	expected[DISK_USERDATA_LEN] = XLAT62[encodeScalar(data, expected)];
+	nibbles[DISK_USERDATA_LEN] = XLAT62[k->encode(data, nibbles)];
+
+	if (memcmp(expected, nibbles, sizeof(nibbles)) != 0)
+		return(false);
+
+	if (pos >= 0)
+		nibbles[pos] = damage;
+
+	bool expectedOk = decodeScalar(nibbles, expectedData);
+	bool ok = k->decode(nibbles, decoded);
+
+	if (ok != expectedOk)
+		return(false);
+
+	if (pos < 0 && (! ok || memcmp(decoded, data, DISK_BYTES_PER_SECTOR) != 0))
+		return(false);
+
+	return(! ok || memcmp(decoded, expectedData, DISK_BYTES_PER_SECTOR) == 0);
+}
+
+/*
+ * Check every kernel the CPU supports against the scalar one: every value
+ * of every byte of a sector, random sectors, and every value of every
+ * nibble of an encoded sector. Then check 5-and-3 on its own.
+ */
+bool
+Gcr::selfTest(void)
+{
+	uint8_t data[DISK_BYTES_PER_SECTOR];
+	uint8_t random[DISK_BYTES_PER_SECTOR];
+	bool success = true;
+
+	init();
+
+	for (int x = 0; x < DISK_BYTES_PER_SECTOR; x++)
+		random[x] = rand();
+
+	for (int k = GCR_KERNEL_SCALAR; k < GCR_NB_KERNELS; k++) {
+		const struct gcr_kernel *kern = &KERNELS[k];
+		unsigned int failures = 0;
+		unsigned int count = 0;
+
+		if (! isSupported((enum gcr_kernels) k)) {
+			printf("%-8s not supported by this CPU\n", kern->name);
+			continue;
+		}
+
+		// Every byte value at every position, over zeroes and over random data
+		for (int base = 0; base < 2; base++) {
+			for (int pos = 0; pos < DISK_BYTES_PER_SECTOR; pos++) {
+				for (int value = 0; value < 256; value++) {
+					if (base)
+						memcpy(data, random, sizeof(data));
+					else
+						memset(data, 0x00, sizeof(data));
+
+					data[pos] = value;
+
+					if (! compareKernel(kern, data, -1, 0))
+						failures++;
+
+					count++;
+				}
+			}
+		}
+
+		for (int n = 0; n < 100000; n++) {
+			for (int x = 0; x < DISK_BYTES_PER_SECTOR; x++)
+				data[x] = rand();
+
+			if (! compareKernel(kern, data, -1, 0))
+				failures++;
+
+			count++;
+		}
+
+		// Every nibble value at every position, checksum included
+		for (int pos = 0; pos < DISK_USERDATA_LEN + 1; pos++) {
+			for (int value = 0; value < 256; value++) {
+				if (! compareKernel(kern, random, pos, value))
+					failures++;
+
+				count++;
+			}
+		}
+
+		printf("%-8s %s: %u sectors, %u failures\n", kern->name, failures ? "FAILED" : "OK", count, failures);
+
+		if (failures)
+			success = false;
+	}
+
+	// 5-and-3 has no other version to compare with: check that every
+	// value of every byte comes back, and that damaging any nibble is
+	// noticed.
+	uint8_t nibbles[DISK_USERDATA_53_LEN + 1];
+	uint8_t decoded[DISK_BYTES_PER_SECTOR];
+	unsigned int failures = 0;
+	unsigned int count = 0;
+
+	for (int pos = 0; pos < DISK_BYTES_PER_SECTOR; pos++) {
+		for (int value = 0; value < 256; value++) {
+			memcpy(data, random, sizeof(data));
+			data[pos] = value;
+
+			nibbles[DISK_USERDATA_53_LEN] = XLAT53[encode5And3(data, nibbles)];
+
+			if (! decode5And3(nibbles, decoded) || memcmp(data, decoded, sizeof(data)) != 0)
+				failures++;
+
+			count++;
+		}
+	}
+
+	for (int pos = 0; pos < DISK_USERDATA_53_LEN + 1; pos++) {
+		for (int value = 0; value < 256; value++) {
+			nibbles[DISK_USERDATA_53_LEN] = XLAT53[encode5And3(random, nibbles)];
+
+			if (nibbles[pos] == value)
+				continue;
+
+			nibbles[pos] = value;
+
+			if (decode5And3(nibbles, decoded))
+				failures++;
+
+			count++;
+		}
+	}
+
+	printf("%-8s %s: %u sectors, %u failures\n", "5-and-3", failures ? "FAILED" : "OK", count, failures);
+
+	if (failures)
+		success = false;
+
+	return(success);
+}
+
+static double
+elapsed(struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return((now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9);
+}
+
+/* Time 'nbSectors' encodes and decodes with every kernel the CPU supports */
+void
+Gcr::benchmark(unsigned int nbSectors)
+{
+	uint8_t data[16][DISK_BYTES_PER_SECTOR];
+	uint8_t nibbles[16][DISK_USERDATA_LEN + 1];
+	uint8_t decoded[DISK_BYTES_PER_SECTOR];
+	volatile unsigned int sink = 0;
+	struct timespec start;
+
+	init();
+
+	for (int s = 0; s < 16; s++) {
+		for (int x = 0; x < DISK_BYTES_PER_SECTOR; x++)
+			data[s][x] = rand();
+
+		nibbles[s][DISK_USERDATA_LEN] = XLAT62[encodeScalar(data[s], nibbles[s])];
+	}
+
+	printf("%-8s %12s %12s\n", "kernel", "encode MB/s", "decode MB/s");
+
+	for (int k = GCR_KERNEL_SCALAR; k < GCR_NB_KERNELS; k++) {
+		const struct gcr_kernel *kern = &KERNELS[k];
+		uint8_t out[DISK_USERDATA_LEN];
+
+		if (! isSupported((enum gcr_kernels) k))
+			continue;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		for (unsigned int n = 0; n < nbSectors; n++)
+			sink += kern->encode(data[n % 16], out);
+
+		double encodeTime = elapsed(&start);
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		for (unsigned int n = 0; n < nbSectors; n++)
+			sink += kern->decode(nibbles[n % 16], decoded);
+
+		double decodeTime = elapsed(&start);
+		double mb = (double) nbSectors * DISK_BYTES_PER_SECTOR / (1024 * 1024);
+
+		printf("%-8s %12.1f %12.1f%s\n", kern->name, mb / encodeTime, mb / decodeTime, k == kernel ? "  (in use)" : "");
+	}
+}
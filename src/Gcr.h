@@ -0,0 +1,84 @@
+/*
+ * Gcr.h - 6-and-2 encoding and decoding kernels
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Gcr.h - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 19:47:20 2026
+ * Revision : $Id$
+ */
+
+#ifndef _GCR_H
+#define _GCR_H
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define GCR_X86
+#endif
+
+// Translation tables for 6-and-2 and 5-and-3 encoding
+extern const uint8_t XLAT62[64];
+extern const uint8_t XLAT53[32];
+
+enum gcr_kernels {
+	GCR_KERNEL_SCALAR = 0,
+	GCR_KERNEL_SSSE3,       // 16 bytes at a time, with PSHUFB for the table lookups
+	GCR_KERNEL_AVX2,        // 32 bytes at a time
+	GCR_NB_KERNELS
+};
+
+/*
+ * The 6-and-2 encoding of the data field of a sector, in several
+ * versions: plain C, and SIMD kernels picked at run time when the CPU
+ * has them. They all give the same results.
+ *
+ * encode6And2() turns 256 bytes into 342 nibbles and returns the 6-bit
+ * checksum, which goes after them as XLAT62[checksum]. decode6And2()
+ * takes the 343 nibbles and returns false if one of them isn't a valid
+ * 6-and-2 nibble or the checksum doesn't match.
+ *
+ * The 5-and-3 encoding of 13-sector (DOS 3.2) disks works the same way,
+ * with 410 nibbles and XLAT53. It only has the plain C version.
+ */
+class Gcr
+{
+public:
+	static uint8_t encode6And2(const uint8_t *in, uint8_t *out);
+	static bool decode6And2(const uint8_t *in, uint8_t *out);
+	static uint8_t encode5And3(const uint8_t *in, uint8_t *out);
+	static bool decode5And3(const uint8_t *in, uint8_t *out);
+
+	static bool isSupported(enum gcr_kernels kernel);
+	static bool setKernel(enum gcr_kernels kernel);
+	static enum gcr_kernels getKernel(void);
+	static const char *kernelName(enum gcr_kernels kernel);
+
+	static bool selfTest(void);
+	static void benchmark(unsigned int nbSectors);
+
+private:
+	static void init(void);
+	static void setup(void);
+	static uint8_t encodeFirst(const uint8_t *in, uint8_t *out);
+	static bool decodeFirst(const uint8_t *in, uint8_t *out);
+
+	static enum gcr_kernels kernel;
+	static uint8_t (*encodeKernel)(const uint8_t *in, uint8_t *out);
+	static bool (*decodeKernel)(const uint8_t *in, uint8_t *out);
+};
+
+#endif
@@ -0,0 +1,208 @@
+/*
+ * HeatMap.cc - Per-page memory access counters for the Apple ][e emulator
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * HeatMap.cc - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 10:02:17 2026
+ * Revision : $Id$
+ */
+
+#include "HeatMap.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+// Size of one page in the PPM image, in pixels
+#define HEAT_CELL_WIDTH  4
+#define HEAT_CELL_HEIGHT 8
+
+const char *HEAT_BANK_NAMES[HEAT_NB_BANKS] = {
+	"main",
+	"aux",
+	"main-lc1",
+	"main-lc2",
+	"aux-lc1",
+	"aux-lc2",
+	"rom",
+	"io"
+};
+
+const char *HEAT_ACCESS_NAMES[HEAT_NB_ACCESS] = {
+	"read",
+	"write",
+	"exec"
+};
+
+HeatMap::HeatMap(void)
+{
+	reset();
+}
+
+void
+HeatMap::reset(void)
+{
+	memset(counters, 0, sizeof(counters));
+}
+
+const char *
+HeatMap::bankName(enum heat_banks bank)
+{
+	return(HEAT_BANK_NAMES[bank]);
+}
+
+struct heat_entry {
+	uint64_t total;
+	int bank;
+	int page;
+
+	bool operator<(const heat_entry &other) const { return(total > other.total); }
+};
+
+/* Print the 'nbPages' busiest pages, all access types combined */
+void
+HeatMap::dumpTop(unsigned int nbPages)
+{
+	std::vector<heat_entry> entries;
+
+	for (int bank = 0; bank < HEAT_NB_BANKS; bank++) {
+		for (int page = 0; page < HEAT_NB_PAGES; page++) {
+			heat_entry e;
+			uint64_t *c = counters[bank][page];
+
+			e.total = c[HEAT_READ] + c[HEAT_WRITE] + c[HEAT_EXEC];
+			e.bank = bank;
+			e.page = page;
+
+			if (e.total > 0)
+				entries.push_back(e);
+		}
+	}
+
+	std::sort(entries.begin(), entries.end());
+
+	printf("Bank  Page         Reads        Writes      Executes\n");
+
+	for (unsigned int x = 0; x < nbPages && x < entries.size(); x++) {
+		uint64_t *c = counters[entries[x].bank][entries[x].page];
+
+		printf("%-4s  $%02X00  %12llu  %12llu  %12llu\n",
+		       HEAT_BANK_NAMES[entries[x].bank], entries[x].page,
+		       (unsigned long long) c[HEAT_READ],
+		       (unsigned long long) c[HEAT_WRITE],
+		       (unsigned long long) c[HEAT_EXEC]);
+	}
+}
+
+bool
+HeatMap::exportCSV(std::string filename)
+{
+	FILE *f = fopen(filename.c_str(), "w");
+	if (! f) {
+		perror("fopen()");
+		return(false);
+	}
+
+	fprintf(f, "bank,page,reads,writes,executes\n");
+
+	for (int bank = 0; bank < HEAT_NB_BANKS; bank++) {
+		for (int page = 0; page < HEAT_NB_PAGES; page++) {
+			uint64_t *c = counters[bank][page];
+
+			fprintf(f, "%s,$%02X00,%llu,%llu,%llu\n", HEAT_BANK_NAMES[bank], page,
+			        (unsigned long long) c[HEAT_READ],
+			        (unsigned long long) c[HEAT_WRITE],
+			        (unsigned long long) c[HEAT_EXEC]);
+		}
+	}
+
+	fclose(f);
+
+	return(true);
+}
+
+/*
+ * Write a binary PPM image: one column per page, one row per
+ * (bank, access type) pair. Counts are on a log scale going from
+ * black to red to yellow to white.
+ */
+bool
+HeatMap::exportPPM(std::string filename)
+{
+	int width = HEAT_NB_PAGES * HEAT_CELL_WIDTH;
+	int height = HEAT_NB_BANKS * HEAT_NB_ACCESS * HEAT_CELL_HEIGHT;
+	uint64_t max = 0;
+
+	for (int bank = 0; bank < HEAT_NB_BANKS; bank++)
+		for (int page = 0; page < HEAT_NB_PAGES; page++)
+			for (int access = 0; access < HEAT_NB_ACCESS; access++)
+				max = std::max(max, counters[bank][page][access]);
+
+	FILE *f = fopen(filename.c_str(), "wb");
+	if (! f) {
+		perror("fopen()");
+		return(false);
+	}
+
+	fprintf(f, "P6\n# ");
+
+	for (int bank = 0; bank < HEAT_NB_BANKS; bank++)
+		for (int access = 0; access < HEAT_NB_ACCESS; access++)
+			fprintf(f, "%s/%s ", HEAT_BANK_NAMES[bank], HEAT_ACCESS_NAMES[access]);
+
+	fprintf(f, "\n%d %d\n255\n", width, height);
+
+	double scale = (max > 0) ? log((double) max + 1) : 1;
+	uint8_t *row = new uint8_t[width * 3];
+
+	for (int y = 0; y < height; y++) {
+		int line = y / HEAT_CELL_HEIGHT;
+		int bank = line / HEAT_NB_ACCESS;
+		int access = line % HEAT_NB_ACCESS;
+
+		for (int page = 0; page < HEAT_NB_PAGES; page++) {
+			double heat = log((double) counters[bank][page][access] + 1) / scale;
+			int level = (int) (heat * 765);   // 3 * 255
+			uint8_t r = std::min(level, 255);
+			uint8_t g = std::min(std::max(level - 255, 0), 255);
+			uint8_t b = std::max(level - 510, 0);
+
+			for (int x = 0; x < HEAT_CELL_WIDTH; x++) {
+				uint8_t *pixel = &row[(page * HEAT_CELL_WIDTH + x) * 3];
+
+				// Leave a dark line between rows to make them easier to tell apart
+				if (y % HEAT_CELL_HEIGHT == HEAT_CELL_HEIGHT - 1) {
+					pixel[0] = pixel[1] = pixel[2] = 0x20;
+				} else {
+					pixel[0] = r;
+					pixel[1] = g;
+					pixel[2] = b;
+				}
+			}
+		}
+
+		fwrite(row, 1, width * 3, f);
+	}
+
+	delete[] row;
+	fclose(f);
+
+	return(true);
+}
@@ -0,0 +1,76 @@
+/*
+ * HeatMap.h - Per-page memory access counters
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * HeatMap.h - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 10:02:17 2026
+ * Revision : $Id$
+ */
+
+#ifndef _HEATMAP_H
+#define _HEATMAP_H
+
+#include <stdint.h>
+
+#include <string>
+
+#define HEAT_NB_PAGES 256
+
+// The language card's $E000-$FFFF isn't bank-switched: it is counted
+// in HEAT_MAIN or HEAT_AUX. Only $D000-$DFFF has two banks.
+enum heat_banks {
+	HEAT_MAIN = 0,
+	HEAT_AUX,
+	HEAT_MAIN_LC_BANK1,
+	HEAT_MAIN_LC_BANK2,
+	HEAT_AUX_LC_BANK1,
+	HEAT_AUX_LC_BANK2,
+	HEAT_ROM,
+	HEAT_IO,
+	HEAT_NB_BANKS
+};
+
+enum heat_access {
+	HEAT_READ = 0,
+	HEAT_WRITE,
+	HEAT_EXEC,
+	HEAT_NB_ACCESS
+};
+
+/*
+ * Counts reads, writes and opcode fetches for every 256-byte page of
+ * every bank. Only compiled in the memory bus when MEMORY_HEATMAP is
+ * defined (see the Makefile).
+ */
+class HeatMap
+{
+public:
+	HeatMap(void);
+	void reset(void);
+	void count(enum heat_banks bank, uint8_t page, enum heat_access access) { counters[bank][page][access]++; }
+	uint64_t get(enum heat_banks bank, uint8_t page, enum heat_access access) { return(counters[bank][page][access]); }
+	void dumpTop(unsigned int nbPages);
+	bool exportCSV(std::string filename);
+	bool exportPPM(std::string filename);
+
+	static const char *bankName(enum heat_banks bank);
+
+private:
+	uint64_t counters[HEAT_NB_BANKS][HEAT_NB_PAGES][HEAT_NB_ACCESS];
+};
+
+#endif
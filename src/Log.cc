@@ -0,0 +1,342 @@
+/*
+ * Log.cc - Levelled, lock-free logging for the Apple ][e emulator
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Log.cc - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 11:20:55 2026
+ * Revision : $Id$
+ */
+
+#include "Log.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+
+// How long the writer sleeps when the ring is empty
+#define LOG_WRITER_SLEEP_NS (10 * 1000 * 1000)
+
+const char *LOG_CATEGORY_NAMES[LOG_NB_CATEGORIES] = {
+	"cpu",
+	"memory",
+	"disk",
+	"video",
+	"misc"
+};
+
+const char *LOG_LEVEL_NAMES[LOG_NB_LEVELS] = {
+	"error",
+	"warn",
+	"info",
+	"debug"
+};
+
+enum log_levels Log::levels[LOG_NB_CATEGORIES] = {
+	LOG_INFO,
+	LOG_INFO,
+	LOG_INFO,
+	LOG_INFO,
+	LOG_INFO
+};
+
+struct log_slot {
+	uint32_t sequence;      // == position + 1 when the slot holds a message for 'position'
+	uint8_t category;
+	uint8_t level;
+	char text[LOG_MESSAGE_LEN];
+};
+
+struct log_rate {
+	time_t second;          // Second during which 'count' messages were accepted
+	uint32_t count;
+	uint32_t suppressed;
+};
+
+static struct log_slot ring[LOG_RING_SIZE];
+static uint32_t ringHead = 0;      // Next position to fill (producers)
+static uint32_t ringTail = 0;      // Next position to print (writer thread only)
+static uint32_t ringPrinted = 0;   // Messages printed so far, for flush()
+static uint32_t ringDropped = 0;   // Messages lost because the ring was full
+
+static struct log_rate rates[LOG_NB_CATEGORIES];
+static uint32_t rateLimit = LOG_DEFAULT_RATE;
+
+static FILE *output = NULL;
+static pthread_once_t startOnce = PTHREAD_ONCE_INIT;
+static pthread_t writerThread;
+static bool writerRunning = false;
+static bool writerStop = false;
+
+static bool ringPop(struct log_slot *out);
+
+/* Print everything waiting in the ring. Only the writer (or flush at exit) calls this. */
+static void
+drainRing(void)
+{
+	struct log_slot msg;
+	FILE *f = output ? output : stdout;
+	bool wrote = false;
+
+	while (ringPop(&msg)) {
+		if (msg.level <= LOG_WARN)
+			fprintf(f, "[%s] %s: %s", LOG_CATEGORY_NAMES[msg.category], LOG_LEVEL_NAMES[msg.level], msg.text);
+		else
+			fputs(msg.text, f);
+
+		__atomic_store_n(&ringPrinted, ringTail, __ATOMIC_RELEASE);
+		wrote = true;
+	}
+
+	uint32_t dropped = __atomic_exchange_n(&ringDropped, 0, __ATOMIC_RELAXED);
+	if (dropped > 0) {
+		fprintf(f, "[log] %u messages dropped (ring full)\n", dropped);
+		wrote = true;
+	}
+
+	if (wrote)
+		fflush(f);
+}
+
+static void *
+writerMain(void *arg)
+{
+	struct timespec ts = { 0, LOG_WRITER_SLEEP_NS };
+
+	while (! __atomic_load_n(&writerStop, __ATOMIC_ACQUIRE)) {
+		drainRing();
+		nanosleep(&ts, NULL);
+	}
+
+	drainRing();
+
+	return(NULL);
+}
+
+static void
+startWriter(void)
+{
+	for (uint32_t x = 0; x < LOG_RING_SIZE; x++)
+		ring[x].sequence = x;
+
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	if (pthread_create(&writerThread, NULL, writerMain, NULL) == 0) {
+		writerRunning = true;
+		atexit(Log::shutdown);
+	} else {
+		perror("pthread_create()");
+	}
+}
+
+/*
+ * Reserve a slot with a compare-and-swap on the head, fill it, then
+ * publish it by bumping its sequence number. Producers never wait on
+ * each other or on the writer.
+ */
+static struct log_slot *
+ringReserve(uint32_t *position)
+{
+	uint32_t pos = __atomic_load_n(&ringHead, __ATOMIC_RELAXED);
+
+	for (;;) {
+		struct log_slot *slot = &ring[pos & LOG_RING_MASK];
+		uint32_t seq = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+		int32_t diff = (int32_t) (seq - pos);
+
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&ringHead, &pos, pos + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				*position = pos;
+				return(slot);
+			}
+		} else if (diff < 0) {
+			// The writer hasn't caught up: the ring is full
+			return(NULL);
+		} else {
+			pos = __atomic_load_n(&ringHead, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+static bool
+ringPop(struct log_slot *out)
+{
+	struct log_slot *slot = &ring[ringTail & LOG_RING_MASK];
+	uint32_t seq = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+
+	if (seq != ringTail + 1)
+		return(false);
+
+	out->category = slot->category;
+	out->level = slot->level;
+	memcpy(out->text, slot->text, sizeof(out->text));
+
+	// Hand the slot back to the producers for the next lap
+	__atomic_store_n(&slot->sequence, ringTail + LOG_RING_SIZE, __ATOMIC_RELEASE);
+	ringTail++;
+
+	return(true);
+}
+
+/*
+ * Returns false if 'category' already logged its share for this
+ * second. Errors are never rate limited. The counters are not atomic:
+ * with several threads logging the limit is approximate, which is fine.
+ */
+static bool
+rateCheck(enum log_categories category, enum log_levels level, uint32_t *suppressed)
+{
+	struct log_rate *rate = &rates[category];
+	time_t now = time(NULL);
+
+	*suppressed = 0;
+
+	if (rate->second != now) {
+		rate->second = now;
+		rate->count = 0;
+		*suppressed = rate->suppressed;
+		rate->suppressed = 0;
+	}
+
+	if (level != LOG_ERROR && rateLimit > 0 && rate->count >= rateLimit) {
+		rate->suppressed++;
+		return(false);
+	}
+
+	rate->count++;
+
+	return(true);
+}
+
+void
+Log::write(enum log_categories category, enum log_levels level, const char *fmt, ...)
+{
+	uint32_t suppressed;
+	uint32_t position;
+	va_list ap;
+
+	pthread_once(&startOnce, startWriter);
+
+	if (! rateCheck(category, level, &suppressed))
+		return;
+
+	if (suppressed > 0)
+		Log::write(category, LOG_WARN, "%u %s messages suppressed\n", suppressed, LOG_CATEGORY_NAMES[category]);
+
+	struct log_slot *slot = ringReserve(&position);
+
+	if (! slot) {
+		__atomic_add_fetch(&ringDropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	slot->category = category;
+	slot->level = level;
+
+	va_start(ap, fmt);
+	vsnprintf(slot->text, sizeof(slot->text), fmt, ap);
+	va_end(ap);
+
+	__atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+void
+Log::setLevel(enum log_categories category, enum log_levels level)
+{
+	levels[category] = level;
+}
+
+/* 0 disables rate limiting */
+void
+Log::setRateLimit(unsigned int messagesPerSecond)
+{
+	rateLimit = messagesPerSecond;
+}
+
+void
+Log::setOutput(FILE *f)
+{
+	output = f;
+}
+
+/* Wait until the writer thread printed everything logged so far */
+void
+Log::flush(void)
+{
+	struct timespec ts = { 0, 1000 * 1000 };
+
+	if (! writerRunning)
+		return;
+
+	uint32_t head = __atomic_load_n(&ringHead, __ATOMIC_ACQUIRE);
+
+	while ((int32_t) (__atomic_load_n(&ringPrinted, __ATOMIC_ACQUIRE) - head) < 0)
+		nanosleep(&ts, NULL);
+}
+
+void
+Log::shutdown(void)
+{
+	if (! writerRunning)
+		return;
+
+	__atomic_store_n(&writerStop, true, __ATOMIC_RELEASE);
+	pthread_join(writerThread, NULL);
+	writerRunning = false;
+}
+
+bool
+Log::parseCategory(const char *name, enum log_categories *category)
+{
+	for (int x = 0; x < LOG_NB_CATEGORIES; x++) {
+		if (strcasecmp(name, LOG_CATEGORY_NAMES[x]) == 0) {
+			*category = (enum log_categories) x;
+			return(true);
+		}
+	}
+
+	return(false);
+}
+
+bool
+Log::parseLevel(const char *name, enum log_levels *level)
+{
+	for (int x = 0; x < LOG_NB_LEVELS; x++) {
+		if (strcasecmp(name, LOG_LEVEL_NAMES[x]) == 0) {
+			*level = (enum log_levels) x;
+			return(true);
+		}
+	}
+
+	return(false);
+}
+
+const char *
+Log::categoryName(enum log_categories category)
+{
+	return(LOG_CATEGORY_NAMES[category]);
+}
+
+const char *
+Log::levelName(enum log_levels level)
+{
+	return(LOG_LEVEL_NAMES[level]);
+}
@@ -0,0 +1,96 @@
+/*
+ * Log.h - Levelled logging with a lock-free message ring
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * Log.h - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 11:20:55 2026
+ * Revision : $Id$
+ */
+
+#ifndef _LOG_H
+#define _LOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+enum log_categories {
+	LOG_CPU = 0,
+	LOG_MEMORY,
+	LOG_DISK,
+	LOG_VIDEO,
+	LOG_MISC,
+	LOG_NB_CATEGORIES
+};
+
+enum log_levels {
+	LOG_ERROR = 0,
+	LOG_WARN,
+	LOG_INFO,
+	LOG_DEBUG,
+	LOG_NB_LEVELS
+};
+
+// Bitmask of categories compiled in (1 << category). Calls for the
+// other categories, and for levels above LOG_COMPILED_LEVEL, are
+// constant-false and disappear at compile time.
+#ifndef LOG_COMPILED_CATEGORIES
+#define LOG_COMPILED_CATEGORIES 0xFFFFFFFF
+#endif
+
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL LOG_DEBUG
+#endif
+
+#define LOG_RING_SIZE 4096      // Messages waiting for the writer thread. Must be a power of 2.
+#define LOG_MESSAGE_LEN 200
+#define LOG_DEFAULT_RATE 50     // Messages per second per category before suppressing
+
+#define LOG(category, level, ...) \
+	do { \
+		if (((LOG_COMPILED_CATEGORIES >> (category)) & 1) && (level) <= LOG_COMPILED_LEVEL && \
+		    Log::isEnabled(category, level)) \
+			Log::write(category, level, __VA_ARGS__); \
+	} while(0)
+
+/*
+ * Messages are formatted by the caller into a bounded multi-producer
+ * ring and printed by a background thread, so logging never waits on
+ * the terminal. When the ring is full, or a category goes over its rate
+ * limit, messages are dropped and the count is reported later.
+ */
+class Log
+{
+public:
+	static bool isEnabled(enum log_categories category, enum log_levels level) { return(level <= levels[category]); }
+	static void write(enum log_categories category, enum log_levels level, const char *fmt, ...)
+		__attribute__((format(printf, 3, 4)));
+	static void setLevel(enum log_categories category, enum log_levels level);
+	static void setRateLimit(unsigned int messagesPerSecond);
+	static void setOutput(FILE *f);
+	static void flush(void);
+	static void shutdown(void);
+
+	static bool parseCategory(const char *name, enum log_categories *category);
+	static bool parseLevel(const char *name, enum log_levels *level);
+	static const char *categoryName(enum log_categories category);
+	static const char *levelName(enum log_levels level);
+
+private:
+	static enum log_levels levels[LOG_NB_CATEGORIES];
+};
+
+#endif
@@ -24,6 +24,7 @@
 #include "Machine.h"
 
 #include <assert.h>
+#include <ctype.h>
 #include <string.h>
 #include <time.h>
 
@@ -33,7 +34,10 @@
 #include <sstream>
 
 #include "instr_table.h"
+#include "Gcr.h"
+#include "Log.h"
 #include "MemoryDisk.h"
+#include "MemoryRamWorks.h"
 
 using namespace std;
 
@@ -128,12 +132,25 @@ uint8_t to_bcd(uint8_t val)
 	return(result);
 }
 
+// Slot of each Disk II controller
+static const int DISK_CONTROLLER_SLOTS[DISK_NB_CONTROLLERS] = { 6, 5 };
+
 Machine::Machine()
 	: cycles(0),
+	  totalCycles(0),
+	  romFile(NULL),
+	  diskSet(NULL),
+	  rwtsTrap(NULL),
+	  hardDisk(NULL),
 	  pcBreakpointEnabled(false),
 	  pcBreakpointOffset(0x0000),
 	  traceInstructions(false),
-	  fastForwardDiskOps(true)
+	  fastForwardDiskOps(true),
+	  warping(false),
+	  warpTailCycles(WARP_DEFAULT_TAIL_MS * 1023),
+	  lastDiskCycle(0),
+	  paceCycle(0),
+	  nextPaceCycle(0)
 {
 
 }
@@ -154,16 +171,30 @@ Machine::init()
 	MemoryRegion *mainRAM = memory->getRegion(REGION_MAIN_RAM);
 	MemoryRegion *auxRAM = memory->getRegion(REGION_AUX_RAM);
 	
-	diskController = (MemoryDisk *) memory->getRegion(REGION_SLOT_IO);
+	rwtsTrap = new RwtsTrap(memory);
+
+	// Each drive has its own tracks and motor, and rotates with the
+	// CPU clock
+	for (int x = 0; x < DISK_NB_DRIVES; x++) {
+		disk[x] = new Disk();
+		disk[x]->init();
+		disk[x]->setClock(&totalCycles);
+	}
 
-	disk[0] = new Disk();
-	disk[0]->init();
+	for (int c = 0; c < DISK_NB_CONTROLLERS; c++) {
+		diskController[c] = new MemoryDisk();
+		diskController[c]->setDisk(0, disk[c * 2]);
+		diskController[c]->setDisk(1, disk[c * 2 + 1]);
+		diskControllerInstalled[c] = false;
+
+		rwtsTrap->setDrive(DISK_CONTROLLER_SLOTS[c], 0, disk[c * 2]);
+		rwtsTrap->setDrive(DISK_CONTROLLER_SLOTS[c], 1, disk[c * 2 + 1]);
+	}
 
-	disk[1] = new Disk();
-	disk[1]->init();
+	// The slot 5 controller is only installed once it has a disk
+	installDiskController(0);
 
-	diskController->setDisk(0, disk[0]);
-	diskController->setDisk(1, disk[1]);
+	diskSet = new DiskSet(disk[0]);
 
 	MemorySoftSwitch *switches = (MemorySoftSwitch *) memory->getRegion(REGION_SOFT_SWITCHES);
 
@@ -195,33 +226,266 @@ Machine::init()
 bool
 Machine::loadApple2eROM(string &filename)
 {
-	ifstream file(filename.c_str(), ios::in | ios::binary);
-	uint8_t *data = new uint8_t[APPLE2E_ROM_SIZE];
-        bool success = false;
+	MappedFile *file = MappedFile::open(filename);
 
-	if (file.is_open()) {
-		file.read((char *) data, APPLE2E_ROM_SIZE);
-		file.close();
-		memory->setRegionData(REGION_SLOT_ROMS, (0xC1FF - 0xC100) + 1, &data[0x0600]); // Disk controller
-		memory->setRegionData(REGION_INTERNAL_ROM, (0xCFFF - 0xC100 + 1), &data[0x4100]);
-		memory->setRegionData(REGION_MAIN_ROM, (0xFFFF - 0xD000 + 1), &data[0x5000]);
-
-		success = true;
-	} else {
+	if (! file) {
 		cerr << "Unable to open " << filename << endl;
+		return(false);
+	}
+
+	if (file->getSize() < APPLE2E_ROM_SIZE) {
+		cerr << filename << " is too small: expected " << APPLE2E_ROM_SIZE << " bytes but got " << file->getSize() << endl;
+		MappedFile::release(file);
+		return(false);
+	}
+
+	// The ROM regions are read-only, so they can point straight into
+	// the shared mapping instead of holding their own copy.
+	uint8_t *data = (uint8_t *) file->getData();
+
+	for (int c = 0; c < DISK_NB_CONTROLLERS; c++)
+		diskController[c]->setROM(&data[0x0600]);
+
+	memory->getRegion(REGION_INTERNAL_ROM)->mapData(&data[0x4100]);
+	memory->getRegion(REGION_MAIN_ROM)->mapData(&data[0x5000]);
+
+	MappedFile::release(romFile);
+	romFile = file;
+
+	return(true);
+}
+
+/* Put the controller of 'drive' in its slot, if it isn't there yet */
+void
+Machine::installDiskController(int drive)
+{
+	int c = drive / 2;
+
+	if (! diskControllerInstalled[c]) {
+		memory->installCard(DISK_CONTROLLER_SLOTS[c], diskController[c]);
+		diskControllerInstalled[c] = true;
 	}
+}
 
-	delete[] data;
+/* Returns the number of 'drive' (1 or 2) of the controller in 'slot', or -1 */
+int
+Machine::getDriveNumber(int slot, int drive)
+{
+	if (drive < 1 || drive > 2)
+		return(-1);
 
-	return(success);
+	for (int c = 0; c < DISK_NB_CONTROLLERS; c++) {
+		if (DISK_CONTROLLER_SLOTS[c] == slot)
+			return(c * 2 + drive - 1);
+	}
+
+	return(-1);
+}
+
+/* "S6D1" for drive 0, and so on */
+std::string
+Machine::getDriveName(int drive)
+{
+	char name[8];
+
+	snprintf(name, sizeof(name), "S%dD%d", DISK_CONTROLLER_SLOTS[drive / 2], drive % 2 + 1);
+
+	return(std::string(name));
 }
 
 bool
 Machine::loadDisk(int drive, std::string &filename)
 {
+	installDiskController(drive);
+
 	return(disk[drive]->openFile(filename));
 }
 
+bool
+Machine::loadOverlay(int drive, std::string &baseFilename, std::string &deltaFilename)
+{
+	installDiskController(drive);
+
+	return(disk[drive]->openOverlay(baseFilename, deltaFilename));
+}
+
+/*
+ * Put a .hdv or .2mg image in the SmartPort card. The card is only
+ * installed in slot 7 once there is an image, so that it doesn't take
+ * the boot away from the Disk II otherwise.
+ */
+bool
+Machine::loadHardDisk(std::string &filename)
+{
+	if (! hardDisk) {
+		SmartPort *card = new SmartPort();
+
+		if (! card->openFile(filename)) {
+			delete card;
+			return(false);
+		}
+
+		hardDisk = card;
+		memory->installCard(7, hardDisk);
+
+		return(true);
+	}
+
+	return(hardDisk->openFile(filename));
+}
+
+/* Do DOS 3.3's RWTS calls directly on the images rather than through the nibbles */
+void
+Machine::setRwtsAcceleration(bool enabled)
+{
+	rwtsTrap->setEnabled(enabled);
+}
+
+/*
+ * Print the counters of both drives, to tell seeking, rotation waits and
+ * encoding apart when a disk is slow. With 'activeOnly', the drives that
+ * did nothing are skipped.
+ */
+void
+Machine::printDiskStats(bool activeOnly)
+{
+	for (int x = 0; x < DISK_NB_DRIVES; x++) {
+		struct disk_stats stats;
+
+		disk[x]->getStats(&stats);
+
+		if (activeOnly && stats.motorOnCycles == 0 && stats.nibblesRead == 0 && stats.seeks == 0)
+			continue;
+
+		uint64_t reads = stats.nibblesRead + stats.latchWaits;
+
+		printf("%s: motor on %.2f s, %llu seeks (%llu half-tracks, %llu phase changes)\n", getDriveName(x).c_str(),
+			stats.motorOnCycles * CYCLE_TIME, (unsigned long long) stats.seeks,
+			(unsigned long long) stats.halfTracksStepped, (unsigned long long) stats.phaseChanges);
+		printf("      %llu nibbles read, %llu latch waits (%.1f%% of the reads)\n",
+			(unsigned long long) stats.nibblesRead, (unsigned long long) stats.latchWaits,
+			reads ? 100.0 * stats.latchWaits / reads : 0.0);
+		printf("      %llu sectors built, %llu decoded, %llu bytes written\n",
+			(unsigned long long) stats.sectorsBuilt, (unsigned long long) stats.sectorsDecoded,
+			(unsigned long long) stats.bytesWritten);
+	}
+}
+
+/* Install a RamWorks card; the screen keeps showing aux bank 0 */
+bool
+Machine::enableRamWorks(unsigned int nbBanks)
+{
+	if (! memory->enableRamWorks(nbBanks))
+		return(false);
+
+	MemoryRamWorks *ramWorks = (MemoryRamWorks *) memory->getRegion(REGION_RAMWORKS);
+
+	screen->setAuxVideo(ramWorks->getBankData(0));
+
+	return(true);
+}
+
+/* Warp through disk accesses, and for 'tailMs' of emulated time after them */
+void
+Machine::setWarp(bool enabled, unsigned int tailMs)
+{
+	fastForwardDiskOps = enabled;
+	warpTailCycles = (uint64_t) tailMs * 1023;
+}
+
+/*
+ * Whether the guest is using a disk: a motor turns, or spins down, or
+ * the CPU is in the Disk II boot ROM or DOS 3.3's RWTS, which wait for
+ * the disk before turning the motor on.
+ */
+bool
+Machine::isDiskBusy(void)
+{
+	bool loaded = false;
+
+	for (int x = 0; x < DISK_NB_DRIVES; x++) {
+		if (disk[x]->isMotorEnabled())
+			return(true);
+
+		loaded = loaded || disk[x]->isLoaded();
+	}
+
+	if (! loaded)
+		return(false);
+
+	uint16_t pc = getPC();
+
+	for (int c = 0; c < DISK_NB_CONTROLLERS; c++) {
+		if (diskControllerInstalled[c] && (pc >> 8) == (0xC0 | DISK_CONTROLLER_SLOTS[c]))
+			return(true);
+	}
+
+	return(pc >= RWTS_START && pc <= RWTS_END && rwtsTrap->isRwts());
+}
+
+static double
+secondsBetween(const struct timespec *from, const struct timespec *to)
+{
+	return((to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9);
+}
+
+/*
+ * Keep the CPU at 1.023 MHz against the wall clock, or let it run
+ * unthrottled while warping. During a warp, and after a long stall (the
+ * debugger, a slow host), the reference point is moved to the present:
+ * real time then resumes smoothly, without sleeping or bursting to catch
+ * up.
+ */
+void
+Machine::pace(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	diskSet->poll();
+
+	bool busy = isDiskBusy();
+
+	if (busy)
+		lastDiskCycle = totalCycles;
+
+	bool warp = fastForwardDiskOps && (busy || (lastDiskCycle > 0 && totalCycles - lastDiskCycle < warpTailCycles));
+
+	if (warp != warping)
+		LOG(LOG_DISK, LOG_DEBUG, "Disk warp %s\n", warp ? "ON" : "OFF");
+
+	warping = warp;
+
+	double ahead = (totalCycles - paceCycle) * CYCLE_TIME - secondsBetween(&paceTime, &now);
+
+	if (warping || ahead < -PACE_MAX_LAG) {
+		paceTime = now;
+		paceCycle = totalCycles;
+	} else if (ahead > 0) {
+		struct timespec ts = { 0, (long) (ahead * 1e9) };
+
+		nanosleep(&ts, NULL);
+	}
+}
+
+/* Save the sectors written to the disks and close the images, before exiting */
+void
+Machine::closeDisks(void)
+{
+	diskSet->close();
+
+	for (int x = 0; x < DISK_NB_DRIVES; x++) {
+		std::string filename = disk[x]->getFilename();
+
+		if (! disk[x]->closeFile())
+			fprintf(stderr, "ERROR: Changes to %s (%s) could not be saved\n", filename.c_str(), getDriveName(x).c_str());
+	}
+
+	if (hardDisk)
+		hardDisk->closeFile();
+}
+
 void
 Machine::setPC(uint16_t pc)
 {
@@ -579,7 +843,11 @@ Machine::executeNextInstruction(void)
 	instruction_t *instr;
 	uint8_t operands[2];
 
-	opcode = memory->read(registers.pc++);
+	// The RWTS call is done at once, and the CPU is back at the caller
+	if (registers.pc == RWTS_ENTRY && rwtsTrap->call())
+		return;
+
+	opcode = memory->fetch(registers.pc++);
 
 	instr = &instr_table[opcode];
 
@@ -2305,6 +2573,7 @@ Machine::executeNextInstruction(void)
 	}
 
 	this->cycles += instr->cycles;
+	this->totalCycles += instr->cycles;
 }
 
 uint16_t
@@ -3486,10 +3755,15 @@ Machine::setPCBreakpoint(uint16_t offset)
 void
 Machine::run(void)
 {
-	struct timespec ts = { 0, 977 * 100 };
 	SDL_Event event;
 	bool quit = false;
 
+	// Real time starts now, whatever happened in the debugger
+	clock_gettime(CLOCK_MONOTONIC, &paceTime);
+	lastRedraw = paceTime;
+	paceCycle = totalCycles;
+	nextPaceCycle = totalCycles;
+
 	while(! quit) {
 		if (pcBreakpointEnabled && getPC() == pcBreakpointOffset) {
 			printf("Breakpoint on PC($%04X)\n", pcBreakpointOffset);
@@ -3504,16 +3778,27 @@ Machine::run(void)
 
 		executeNextInstruction();
 
-		// 1.023MHz / 60 Hz == 17050 cycles between refreshes
-		if (cycles > 17050 * 10) {
-			screen->redraw();
+		if (cycles > REDRAW_CYCLES) {
+			struct timespec now;
+
+			clock_gettime(CLOCK_MONOTONIC, &now);
+
+			// While warping, the cycles go by much faster: the
+			// screen is still only redrawn as often as in real time
+			if (! warping || secondsBetween(&lastRedraw, &now) >= REDRAW_CYCLES * CYCLE_TIME) {
+				screen->redraw();
+				lastRedraw = now;
+			}
+
 			cycles = 0;
 		}
-					
-		// Sleeping about ~100us every 100 cycles is easier on
-		// the CPU than sleeping 977ns every cycle. Same goes
-		// for the event polling
-		if (cycles % 100 == 0) {
+
+		// Sleeping about ~1ms every millisecond of emulated time is
+		// easier on the CPU than sleeping 977ns every cycle. Same
+		// goes for the event polling
+		if (totalCycles >= nextPaceCycle) {
+			nextPaceCycle = totalCycles + PACE_CYCLES;
+
 			int nbEvents = SDL_PollEvent(&event);
 
 			if (nbEvents > 0) {
@@ -3523,6 +3808,12 @@ Machine::run(void)
 					/* Keyboard event */
 					case SDL_KEYDOWN:
 					{
+						// F5 puts the next disk of the set in the drive
+						if (event.key.keysym.sym == SDLK_F5) {
+							diskSet->insertNext();
+							break;
+						}
+
 						if (event.key.keysym.sym > 0) {
 							printf("Key event! %c (0x%02X)\n", event.key.keysym.sym, event.key.keysym.sym);
 							uint8_t k = toupper(event.key.keysym.sym & 0xFF);
@@ -3546,12 +3837,7 @@ Machine::run(void)
 				exit(1);
 			}
 					       
-			// Fast-forward when the disk motor is ON
-			if (fastForwardDiskOps && (disk[0]->isMotorEnabled() || disk[1]->isMotorEnabled())) {
-				// Motor is ON, fast-forward through the disk timing routines.
-			} else {
-				nanosleep(&ts, NULL);
-			}
+			pace();
 		}
 	}
 }
@@ -3565,12 +3851,19 @@ struct command_struct {
 enum command_values {
 	CMD_HELP,
 	CMD_BREAKPOINT,
+	CMD_HARDDISK,
 	CMD_DISASM,
+	CMD_DISKSET,
+	CMD_DISKSTATS,
 	CMD_DUMP,
+	CMD_GCR,
+	CMD_HEAT,
 	CMD_INCLUDE,
 	CMD_JUMP,
 	CMD_KEY,
 	CMD_LOAD,
+	CMD_LOG,
+	CMD_OVERLAY,
 	CMD_QUIT,
 	CMD_REDRAW,
 	CMD_RET,
@@ -3578,7 +3871,9 @@ enum command_values {
 	CMD_SHOW_REGS,
 	CMD_SHOW_STACK,
 	CMD_STEP,
+	CMD_SWAP,
 	CMD_TRACE,
+	CMD_WARP,
 	CMD_WRITE,
 	CMD_RWTS,
 	CMD_UNKNOWN
@@ -3591,14 +3886,21 @@ struct command_struct COMMAND_TABLE[] =
 	{ "break",  CMD_BREAKPOINT },
 	{ "d",      CMD_DISASM },
 	{ "disasm", CMD_DISASM },
+	{ "diskset", CMD_DISKSET },
+	{ "diskstats", CMD_DISKSTATS },
 	{ "dump",   CMD_DUMP },
+	{ "gcr",    CMD_GCR },
 	{ "h",      CMD_HELP },
+	{ "hd",     CMD_HARDDISK },
+	{ "heat",   CMD_HEAT },
 	{ "help",   CMD_HELP },
 	{ "include", CMD_INCLUDE },
 	{ "j",      CMD_JUMP },
 	{ "jump",   CMD_JUMP },
 	{ "key",    CMD_KEY  },
 	{ "load",   CMD_LOAD },
+	{ "log",    CMD_LOG },
+	{ "overlay", CMD_OVERLAY },
 	{ "p",      CMD_DUMP },
 	{ "q",      CMD_QUIT },
 	{ "quit",   CMD_QUIT },
@@ -3609,7 +3911,9 @@ struct command_struct COMMAND_TABLE[] =
 	{ "rwts",   CMD_RWTS },
 	{ "sr",     CMD_SHOW_REGS },
 	{ "ss",     CMD_SHOW_STACK },
+	{ "swap",   CMD_SWAP },
 	{ "trace",  CMD_TRACE },
+	{ "warp",   CMD_WARP },
 	{ "x",      CMD_STEP },
 	{ "w",      CMD_WRITE },
 };
@@ -3627,6 +3931,7 @@ Machine::interactive(void)
 	{		
 		cout << endl;
 
+		diskSet->poll();
 		dumpInstruction(getPC());
 
 		cout << "> ";
@@ -3663,10 +3968,17 @@ Machine::interactive(void)
 				printf("b $addr        Breakpoint on $addr\n");
 				printf("d [$addr]      Disassemble at PC, or $addr if it's given\n");
 				printf("disasm [$addr] Disassemble at PC, or $addr if it's given\n");
+				printf("diskset [cmd]  Disk set of slot 6 drive 1: $file1 $file2 ... prepares them in the background; close\n");
+				printf("diskstats [reset] Show the counters of the disk drives, or zero them\n");
 				printf("dump $addr     Print hex data at $addr\n");
 				printf("h              This help\n");
+				printf("heat [cmd]     Memory heat map: on, off, reset, top [n], csv $file, ppm $file\n");
 				printf("include $file  Read $file as if it had been typed on screen\n");
-				printf("load $file     Put $file in disk 0\n");
+				printf("load [s d] $file Put $file in drive d of slot s (5 or 6), or slot 6 drive 1\n");
+				printf("gcr [cmd]      6-and-2 kernels: show them; test; bench [sectors]; use scalar, ssse3 or avx2\n");
+				printf("hd $file       Put the .hdv or .2mg $file in the slot 7 hard disk\n");
+				printf("log [cat lvl]  Set log level (error, warn, info, debug) of a category; 'log rate n' limits msgs/sec\n");
+				printf("overlay [cmd]  Disk 0 overlay: $base $delta opens $base writing to $delta; merge; discard\n");
 				printf("j $addr        Jump to $addr\n");
 				printf("jump $addr     Jump to $addr\n");
 				printf("key $xx        Emulate key $xx being typed-in\n");
@@ -3676,10 +3988,12 @@ Machine::interactive(void)
 				printf("redraw         Redraw the screen\n");
 				printf("ret            Run until return from JSR\n");
 				printf("run            Run\n");
-				printf("rwts           Dump RWTS parameters at ($48)\n");
+				printf("rwts [on|off]  Dump RWTS parameters at ($48), or turn the RWTS accelerator on or off\n");
 				printf("sr             Show Registers\n");
+				printf("swap [n]       Put disk n, or the next one, of the disk set in the drive (also F5)\n");
 				printf("ss             Show Stack\n");
 				printf("trace          Trace instructions when running\n");
+				printf("warp [cmd]     Disk warp: on, off, or tail $ms to keep warping after the disks stop\n");
 				printf("x              Step over\n");
 				printf("w $addr $byte  Write $byte at $addr (ie, POKE)\n");
 				printf("<enter>        Execute next instruction\n");
@@ -3726,6 +4040,48 @@ Machine::interactive(void)
 				break;
 			}
 
+			case CMD_HEAT:
+			{
+#ifdef MEMORY_HEATMAP
+				std::istringstream istr(arg);
+				std::string subcmd;
+				std::string param;
+
+				istr >> subcmd >> param;
+
+				if (subcmd == "on") {
+					memory->enableHeatMap(true);
+					printf("Heat map is now ON\n");
+				} else if (subcmd == "off") {
+					memory->enableHeatMap(false);
+					printf("Heat map is now OFF\n");
+				} else if (! memory->getHeatMap()) {
+					cout << "Error: The heat map is off. Use 'heat on' first." << endl;
+				} else if (subcmd == "reset") {
+					memory->getHeatMap()->reset();
+				} else if (subcmd == "csv" && param.size() > 0) {
+					if (memory->getHeatMap()->exportCSV(param))
+						cout << "Wrote " << param << endl;
+				} else if (subcmd == "ppm" && param.size() > 0) {
+					if (memory->getHeatMap()->exportPPM(param))
+						cout << "Wrote " << param << endl;
+				} else if (subcmd == "" || subcmd == "top") {
+					unsigned int nbPages = 16;
+
+					if (param.size() > 0)
+						nbPages = strtoul(param.c_str(), NULL, 0);
+
+					memory->getHeatMap()->dumpTop(nbPages);
+				} else {
+					cout << "Error: Invalid argument '" << arg << "'" << endl;
+					cout << "Usage: heat [on | off | reset | top [n] | csv <file> | ppm <file>]" << endl;
+				}
+#else
+				cout << "Heat map support is not compiled in (build with -DMEMORY_HEATMAP)" << endl;
+#endif
+				break;
+			}
+
 			case CMD_INCLUDE:
 			{
 				std::istringstream istr(arg);
@@ -3787,13 +4143,209 @@ Machine::interactive(void)
 			{
 	      			std::istringstream istr(arg);
 				std::string filename;
+				int slot = 6;
+				int drive = 1;
+				int number = -1;
 
-				if (arg.size() > 0) {
-					istr >> filename;
-					disk[0]->openFile(filename);
+				istr >> filename;
+
+				// Either 'load file.dsk' or 'load slot drive file.dsk'
+				if (filename.size() > 0 && isdigit(filename[0])) {
+					slot = strtoul(filename.c_str(), NULL, 0);
+					filename = "";
+					istr >> drive >> filename;
+				}
+
+				if (filename.size() > 0)
+					number = getDriveNumber(slot, drive);
+
+				if (number >= 0) {
+					loadDisk(number, filename);
+				} else {
+					cout << "Error: Invalid argument '" << arg << "'" << endl;
+					cout << "Example usage: load file.dsk, or load 5 2 file.dsk" << endl;
+				}
+				break;
+			}
+
+			case CMD_WARP:
+			{
+				std::istringstream istr(arg);
+				std::string subcmd;
+				unsigned int tailMs = warpTailCycles / 1023;
+
+				istr >> subcmd;
+
+				if (subcmd == "on" || subcmd == "off") {
+					setWarp(subcmd == "on", tailMs);
+				} else if (subcmd == "tail" && istr >> tailMs) {
+					setWarp(fastForwardDiskOps, tailMs);
+				} else if (subcmd != "") {
+					cout << "Error: Invalid argument '" << arg << "'" << endl;
+					cout << "Usage: warp [on | off | tail ms]" << endl;
+					break;
+				}
+
+				printf("Disk warp is %s, with a %u ms tail\n", fastForwardDiskOps ? "ON" : "OFF", (unsigned int) (warpTailCycles / 1023));
+				break;
+			}
+
+			case CMD_DISKSET:
+			{
+				std::istringstream istr(arg);
+				std::vector<std::string> filenames;
+				std::string filename;
+
+				while (istr >> filename)
+					filenames.push_back(filename);
+
+				if (filenames.size() == 1 && filenames[0] == "close")
+					diskSet->close();
+				else if (filenames.size() > 0)
+					diskSet->load(filenames);
+				else
+					diskSet->print();
+				break;
+			}
+
+			case CMD_SWAP:
+			{
+				std::istringstream istr(arg);
+				unsigned int index;
+
+				diskSet->poll();
+
+				if (arg.find_first_not_of(' ') == arg.npos) {
+					diskSet->insertNext();
+				} else if (istr >> index && index >= 1 && index <= diskSet->getSize()) {
+					diskSet->insert(index - 1);
+				} else {
+					cout << "Error: Invalid argument '" << arg << "'" << endl;
+					cout << "Usage: swap [1-" << diskSet->getSize() << "]" << endl;
+				}
+				break;
+			}
+
+			case CMD_DISKSTATS:
+			{
+				std::istringstream istr(arg);
+				std::string subcmd;
+
+				istr >> subcmd;
+
+				if (subcmd == "reset") {
+					for (int x = 0; x < DISK_NB_DRIVES; x++)
+						disk[x]->resetStats();
+				} else if (subcmd == "") {
+					printDiskStats(false);
 				} else {
 					cout << "Error: Invalid argument '" << arg << "'" << endl;
-					cout << "Example usage: load file.dsk" << endl;
+					cout << "Usage: diskstats [reset]" << endl;
+				}
+				break;
+			}
+
+			case CMD_GCR:
+			{
+				std::istringstream istr(arg);
+				std::string subcmd;
+				unsigned int nbSectors = 1000000;
+
+				istr >> subcmd >> nbSectors;
+
+				if (subcmd == "") {
+					for (int x = 0; x < GCR_NB_KERNELS; x++) {
+						enum gcr_kernels k = (enum gcr_kernels) x;
+
+						printf("%-8s %s%s\n", Gcr::kernelName(k), Gcr::isSupported(k) ? "supported" : "not supported",
+							Gcr::getKernel() == k ? ", in use" : "");
+					}
+				} else if (subcmd == "test") {
+					Gcr::selfTest();
+				} else if (subcmd == "bench") {
+					Gcr::benchmark(nbSectors);
+				} else {
+					int x;
+
+					for (x = 0; x < GCR_NB_KERNELS; x++) {
+						if (subcmd == Gcr::kernelName((enum gcr_kernels) x))
+							break;
+					}
+
+					if (x == GCR_NB_KERNELS || ! Gcr::setKernel((enum gcr_kernels) x)) {
+						cout << "Error: Invalid argument '" << arg << "'" << endl;
+						cout << "Usage: gcr [test | bench [sectors] | scalar | ssse3 | avx2]" << endl;
+					}
+				}
+				break;
+			}
+
+			case CMD_HARDDISK:
+			{
+				std::istringstream istr(arg);
+				std::string filename;
+
+				istr >> filename;
+
+				if (filename.size() > 0) {
+					if (! loadHardDisk(filename))
+						cout << "Error: Unable to use " << filename << " as a hard disk" << endl;
+				} else {
+					cout << "Error: Invalid argument '" << arg << "'" << endl;
+					cout << "Example usage: hd file.hdv" << endl;
+				}
+				break;
+			}
+
+			case CMD_OVERLAY:
+			{
+				std::istringstream istr(arg);
+				std::string subcmd;
+				std::string param;
+
+				istr >> subcmd >> param;
+
+				if (subcmd == "merge" && param.size() == 0) {
+					disk[0]->mergeOverlay();
+				} else if (subcmd == "discard" && param.size() == 0) {
+					disk[0]->discardOverlay();
+				} else if (subcmd.size() > 0 && param.size() > 0) {
+					disk[0]->openOverlay(subcmd, param);
+				} else {
+					cout << "Error: Invalid argument '" << arg << "'" << endl;
+					cout << "Usage: overlay [<base.dsk> <delta> | merge | discard]" << endl;
+				}
+				break;
+			}
+
+			case CMD_LOG:
+			{
+				std::istringstream istr(arg);
+				std::string name;
+				std::string value;
+				enum log_categories category;
+				enum log_levels level;
+
+				istr >> name >> value;
+
+				if (name == "") {
+					for (int x = 0; x < LOG_NB_CATEGORIES; x++) {
+						category = (enum log_categories) x;
+
+						for (int y = LOG_NB_LEVELS - 1; y >= 0; y--) {
+							if (Log::isEnabled(category, (enum log_levels) y)) {
+								printf("%-8s %s\n", Log::categoryName(category), Log::levelName((enum log_levels) y));
+								break;
+							}
+						}
+					}
+				} else if (name == "rate" && value.size() > 0) {
+					Log::setRateLimit(strtoul(value.c_str(), NULL, 0));
+				} else if (Log::parseCategory(name.c_str(), &category) && Log::parseLevel(value.c_str(), &level)) {
+					Log::setLevel(category, level);
+				} else {
+					cout << "Error: Invalid argument '" << arg << "'" << endl;
+					cout << "Example usage: log disk debug" << endl;
 				}
 				break;
 			}
@@ -3864,6 +4416,17 @@ Machine::interactive(void)
 
 			case CMD_RWTS:
 			{
+				std::istringstream istr(arg);
+				std::string mode;
+
+				istr >> mode;
+
+				if (mode == "on" || mode == "off") {
+					setRwtsAcceleration(mode == "on");
+					printf("RWTS accelerator is now %s\n", mode == "on" ? "ON" : "OFF");
+					break;
+				}
+
 				printf("RWTS Parameters:\n");
 				uint8_t low = memory->read(0x48);
 				uint8_t high = memory->read(0x49);
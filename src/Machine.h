@@ -21,8 +21,12 @@
  * Revision : $Id$
  */
 
+#include "MappedFile.h"
 #include "MemoryBus.h"
+#include "DiskSet.h"
 #include "MemoryDisk.h"
+#include "RwtsTrap.h"
+#include "SmartPort.h"
 
 #include <string>
 
@@ -36,6 +40,19 @@
 #define MONITOR_START 0xFF69
 #define CYCLE_TIME .00000097751710654936f     // Seconds per cycle
 
+// Two Disk II controllers, in slots 6 and 5, with two drives each. Drives
+// are numbered 0-3: slot 6 drive 1, slot 6 drive 2, slot 5 drive 1, ...
+#define DISK_NB_CONTROLLERS 2
+#define DISK_NB_DRIVES (DISK_NB_CONTROLLERS * 2)
+
+// 1.023MHz / 60 Hz == 17050 cycles between refreshes; the screen is redrawn every 10
+#define REDRAW_CYCLES (17050 * 10)
+// How often to poll the events and check the pace against the wall clock
+#define PACE_CYCLES 1023
+// Further behind than this, give up catching up and resync with the wall clock
+#define PACE_MAX_LAG 0.05
+#define WARP_DEFAULT_TAIL_MS 250
+
 class Machine
 {
 public:
@@ -43,6 +60,15 @@ public:
 	bool init(void);
 	bool loadApple2eROM(std::string &filename);
 	bool loadDisk(int drive, std::string &filename);
+	bool loadOverlay(int drive, std::string &baseFilename, std::string &deltaFilename);
+	bool loadHardDisk(std::string &filename);
+	void closeDisks(void);
+	int getDriveNumber(int slot, int drive);
+	std::string getDriveName(int drive);
+	void printDiskStats(bool activeOnly);
+	void setRwtsAcceleration(bool enabled);
+	void setWarp(bool enabled, unsigned int tailMs);
+	bool enableRamWorks(unsigned int nbBanks);
 	unsigned int dumpInstruction(uint16_t offset);
 	void dumpFlags(spc_flags_t *flags, char *buf);
 	void dumpMemory(uint16_t offset, uint16_t len);
@@ -150,13 +176,35 @@ protected:
 
 	registers_t registers;
 	unsigned long int cycles;
+	uint64_t totalCycles;		// Cycles since power-on, never reset
 	Screen *screen;
-	MemoryDisk *diskController;
-	Disk *disk[2];
+	MappedFile *romFile;
+	void installDiskController(int drive);
+	bool isDiskBusy(void);
+	void pace(void);
+
+	MemoryDisk *diskController[DISK_NB_CONTROLLERS];
+	bool diskControllerInstalled[DISK_NB_CONTROLLERS];
+	Disk *disk[DISK_NB_DRIVES];
+	DiskSet *diskSet;		// Swapped in and out of slot 6 drive 1
+	RwtsTrap *rwtsTrap;
+	SmartPort *hardDisk;		// In slot 7, once an image is loaded
 	bool pcBreakpointEnabled;
 	uint16_t pcBreakpointOffset;
 
 	bool traceInstructions;
+
+	// Run as fast as possible while a disk is busy, and for a tail
+	// after it stops, then go back to real time.
 	bool fastForwardDiskOps;
+	bool warping;
+	uint64_t warpTailCycles;
+	uint64_t lastDiskCycle;         // Last time a disk was seen busy
+
+	// Wall clock time matching cycle 'paceCycle'
+	struct timespec paceTime;
+	uint64_t paceCycle;
+	uint64_t nextPaceCycle;
+	struct timespec lastRedraw;
 };
 
@@ -0,0 +1,161 @@
+/*
+ * MappedFile.cc - Read-only file mappings for the Apple ][e emulator
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * MappedFile.cc - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 13:41:09 2026
+ * Revision : $Id$
+ */
+
+#include "MappedFile.h"
+
+#include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <map>
+
+// Every mapping currently open, by file name
+static std::map<std::string, MappedFile *> mappedFiles;
+static pthread_mutex_t mappedFilesLock = PTHREAD_MUTEX_INITIALIZER;
+
+MappedFile::MappedFile(std::string filename, const uint8_t *data, size_t size, bool writable)
+	: filename(filename),
+	  data(data),
+	  size(size),
+	  writable(writable),
+	  refCount(1)
+{
+}
+
+MappedFile::~MappedFile(void)
+{
+	munmap((void *) data, size);
+}
+
+/* Only private mappings can be written to */
+uint8_t *
+MappedFile::getWritableData(void)
+{
+	assert(writable);
+
+	return((uint8_t *) data);
+}
+
+/* mmap() all of 'filename'. Returns NULL on error. */
+MappedFile *
+MappedFile::map(std::string filename, bool writable)
+{
+	MappedFile *file = NULL;
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	struct stat st;
+
+	if (fd < 0) {
+		perror(filename.c_str());
+	} else if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		fprintf(stderr, "%s: Empty or unreadable file\n", filename.c_str());
+	} else {
+		void *addr;
+
+		if (writable)
+			addr = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		else
+			addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+		if (addr == MAP_FAILED)
+			perror("mmap()");
+		else
+			file = new MappedFile(filename, (const uint8_t *) addr, st.st_size, writable);
+	}
+
+	if (fd >= 0)
+		close(fd);
+
+	return(file);
+}
+
+/* Map 'filename', or return the existing mapping. Returns NULL on error. */
+MappedFile *
+MappedFile::open(std::string filename)
+{
+	MappedFile *file = NULL;
+
+	pthread_mutex_lock(&mappedFilesLock);
+
+	std::map<std::string, MappedFile *>::iterator it = mappedFiles.find(filename);
+
+	if (it != mappedFiles.end()) {
+		file = it->second;
+		file->refCount++;
+	} else {
+		file = map(filename, false);
+
+		if (file)
+			mappedFiles[filename] = file;
+	}
+
+	pthread_mutex_unlock(&mappedFilesLock);
+
+	return(file);
+}
+
+/* Map a private, copy-on-write, copy of 'filename'. Returns NULL on error. */
+MappedFile *
+MappedFile::openPrivate(std::string filename)
+{
+	return(map(filename, true));
+}
+
+/* Map 'size' bytes of zeroes, named after 'filename'. Returns NULL on error. */
+MappedFile *
+MappedFile::allocate(std::string filename, size_t size)
+{
+	void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (addr == MAP_FAILED) {
+		perror("mmap()");
+		return(NULL);
+	}
+
+	return(new MappedFile(filename, (const uint8_t *) addr, size, true));
+}
+
+/* Drop a reference. The file is unmapped when nobody uses it anymore. */
+void
+MappedFile::release(MappedFile *file)
+{
+	if (! file)
+		return;
+
+	if (file->writable) {
+		delete file;
+		return;
+	}
+
+	pthread_mutex_lock(&mappedFilesLock);
+
+	if (--file->refCount == 0) {
+		mappedFiles.erase(file->filename);
+		delete file;
+	}
+
+	pthread_mutex_unlock(&mappedFilesLock);
+}
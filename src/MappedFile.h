@@ -0,0 +1,83 @@
+/*
+ * MappedFile.h - Read-only file mappings shared across the process
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * MappedFile.h - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 13:41:09 2026
+ * Revision : $Id$
+ */
+
+#ifndef _MAPPEDFILE_H
+#define _MAPPEDFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+/*
+ * A file mapped read-only with mmap(). Opening the same file twice
+ * returns the same mapping, so every Machine in the process (and every
+ * forked child, through the page cache) shares one copy of the pages.
+ *
+ * openPrivate() maps a file copy-on-write instead: the pages are shared
+ * with the page cache until they are written to, and writes never reach
+ * the file. Private mappings are never shared between callers.
+ *
+ * allocate() makes a private mapping that isn't backed by a file, for
+ * images that are decompressed in memory.
+ */
+class MappedFile
+{
+public:
+	static MappedFile *open(std::string filename);
+	static MappedFile *openPrivate(std::string filename);
+	static MappedFile *allocate(std::string filename, size_t size);
+	static void release(MappedFile *file);
+
+	const uint8_t *getData(void) { return(data); }
+	uint8_t *getWritableData(void);
+	size_t getSize(void) { return(size); }
+	std::string getFilename(void) { return(filename); }
+
+private:
+	MappedFile(std::string filename, const uint8_t *data, size_t size, bool writable);
+	~MappedFile(void);
+
+	static MappedFile *map(std::string filename, bool writable);
+
+	std::string filename;
+	const uint8_t *data;
+	size_t size;
+	bool writable;			// Private copy-on-write mapping
+	unsigned int refCount;
+};
+
+// Little-endian fields, as found in .woz and .zip headers and ProDOS blocks
+static inline uint16_t
+get16(const uint8_t *p)
+{
+	return(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t
+get32(const uint8_t *p)
+{
+	return(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24));
+}
+
+#endif
@@ -31,13 +31,14 @@
 #include <vector>
 
 #include "Registers.h"
+#include "Log.h"
 #include "MemorySoftSwitch.h"
-#include "MemoryDisk.h"
+#include "MemoryRamWorks.h"
 
 using namespace std;
 
 #define SOFT_SWITCH_START 0xC000
-#define SOFT_SWITCH_END   0xC01F
+#define SOFT_SWITCH_END   0xC08F   // Includes the language card switches (slot 0)
 
 uint8_t get_page(uint16_t addr)
 {
@@ -48,7 +49,13 @@ uint8_t get_page(uint16_t addr)
 
 MemoryBus::MemoryBus(unsigned int size, registers_t *registers)
 	: memorySize(size),
-	  registers(registers)
+	  registers(registers),
+	  expansionSlot(0),
+	  intC8ROM(false)
+#ifdef MEMORY_HEATMAP
+	  , heatMap(NULL),
+	  opcodeFetch(false)
+#endif
 {
 }
 
@@ -61,9 +68,50 @@ MemoryBus::init(void)
 	regions[REGION_MAIN_BANK2] = new MemoryRegion(0xD000, 0xDFFF, REGION_RW);
 	regions[REGION_MAIN_RAM] = new MemoryRegion(0x0000, memorySize - 1, REGION_RW);
 	regions[REGION_MAIN_ROM] = new MemoryRegion(0xD000, 0xFFFF, REGION_RO);
-	regions[REGION_SOFT_SWITCHES] = new MemorySoftSwitch(0xC000, 0xC07F, REGION_RW);
-	regions[REGION_SLOT_IO] = new MemoryDisk(0xC090, 0xC09F, REGION_RW);
-	regions[REGION_SLOT_ROMS] = new MemoryRegion(0xC100, 0xCFFF, REGION_RO);
+	regions[REGION_SOFT_SWITCHES] = new MemorySoftSwitch(SOFT_SWITCH_START, SOFT_SWITCH_END, REGION_RW);
+	regions[REGION_RAMWORKS] = NULL;
+
+	for (int x = 0; x < NB_SLOTS; x++)
+		slotCards[x] = NULL;
+}
+
+/* Plug 'card' in 'slot' (1-7). Its I/O space and ROMs become visible right away. */
+void
+MemoryBus::installCard(int slot, SlotCard *card)
+{
+	assert(slot > 0 && slot < NB_SLOTS);
+
+	slotCards[slot] = card;
+
+	if (expansionSlot == slot)
+		expansionSlot = 0;
+
+	if (card)
+		card->install(this, slot);
+}
+
+SlotCard *
+MemoryBus::getCard(int slot)
+{
+	assert(slot >= 0 && slot < NB_SLOTS);
+
+	return(slotCards[slot]);
+}
+
+/*
+ * Replace the standard 64K of aux memory with 'nbBanks' 64K banks,
+ * selected by writing to the bank register at $C073.
+ */
+bool
+MemoryBus::enableRamWorks(unsigned int nbBanks)
+{
+	if (nbBanks == 0 || nbBanks > RAMWORKS_MAX_BANKS || regions[REGION_RAMWORKS] != NULL)
+		return(false);
+
+	regions[REGION_RAMWORKS] = new MemoryRamWorks(RAMWORKS_BANK_REGISTER, RAMWORKS_BANK_REGISTER, REGION_RW,
+	                                              nbBanks, regions[REGION_AUX_RAM], regions[REGION_AUX_BANK2]);
+
+	return(true);
 }
 
 unsigned int
@@ -112,6 +160,59 @@ MemoryBus::write(uint16_t offset, uint8_t byte)
 	this->access(offset, ACCESS_WRITE, byte);
 }
 
+/* Read an opcode. Same as read(), but counted as an execute in the heat map */
+uint8_t
+MemoryBus::fetch(uint16_t offset)
+{
+#ifdef MEMORY_HEATMAP
+	opcodeFetch = true;
+	uint8_t result = this->access(offset, ACCESS_READ, 0x00);
+	opcodeFetch = false;
+
+	return(result);
+#else
+	return(this->access(offset, ACCESS_READ, 0x00));
+#endif
+}
+
+#ifdef MEMORY_HEATMAP
+void
+MemoryBus::enableHeatMap(bool enable)
+{
+	if (enable && ! heatMap) {
+		heatMap = new HeatMap();
+	} else if (! enable && heatMap) {
+		delete heatMap;
+		heatMap = NULL;
+	}
+}
+
+/* Which bank of the heat map an access to 'region' should be counted in */
+enum heat_banks
+MemoryBus::getHeatBank(MemoryRegion *region, uint8_t page)
+{
+	enum heat_banks bank;
+
+	// $D000-$DFFF of the main and aux regions is bank 1 of the language card
+	if (region == regions[REGION_MAIN_RAM])
+		bank = (page >= 0xD0 && page <= 0xDF) ? HEAT_MAIN_LC_BANK1 : HEAT_MAIN;
+	else if (region == regions[REGION_AUX_RAM])
+		bank = (page >= 0xD0 && page <= 0xDF) ? HEAT_AUX_LC_BANK1 : HEAT_AUX;
+	else if (region == regions[REGION_MAIN_BANK2])
+		bank = HEAT_MAIN_LC_BANK2;
+	else if (region == regions[REGION_AUX_BANK2])
+		bank = HEAT_AUX_LC_BANK2;
+	else if (region == regions[REGION_MAIN_ROM] || region == regions[REGION_INTERNAL_ROM])
+		bank = HEAT_ROM;
+	else if (region == NULL && page != 0xC0)
+		bank = HEAT_ROM;    // Peripheral card ROM
+	else
+		bank = HEAT_IO;
+
+	return(bank);
+}
+#endif
+
 /*
  * write == false : perform a read (return a value, ignore 'byte')
  * write == true : perform a write (return 0, write byte at offset)
@@ -142,7 +243,55 @@ MemoryBus::access(uint16_t offset, bool write, uint8_t byte)
 		case 0x06:
 		case 0x07:
 		{
-			if ((write && switches->isRAMWRT()) || (!write && switches->isRAMRD()) || (switches->is80Store() && switches->isPage2()))
+			// With 80STORE, PAGE2 picks the text page and RAMRD/RAMWRT
+			// don't apply here
+			if (switches->is80Store())
+				region = switches->isPage2() ? regions[REGION_AUX_RAM] : regions[REGION_MAIN_RAM];
+			else if ((write && switches->isRAMWRT()) || (!write && switches->isRAMRD()))
+				region = regions[REGION_AUX_RAM];
+			else
+				region = regions[REGION_MAIN_RAM];
+			break;
+		}
+
+		// Hi-res page 1
+		case 0x20:
+		case 0x21:
+		case 0x22:
+		case 0x23:
+		case 0x24:
+		case 0x25:
+		case 0x26:
+		case 0x27:
+		case 0x28:
+		case 0x29:
+		case 0x2A:
+		case 0x2B:
+		case 0x2C:
+		case 0x2D:
+		case 0x2E:
+		case 0x2F:
+		case 0x30:
+		case 0x31:
+		case 0x32:
+		case 0x33:
+		case 0x34:
+		case 0x35:
+		case 0x36:
+		case 0x37:
+		case 0x38:
+		case 0x39:
+		case 0x3A:
+		case 0x3B:
+		case 0x3C:
+		case 0x3D:
+		case 0x3E:
+		case 0x3F:
+		{
+			// Same as the text page, when HIRES is on too
+			if (switches->is80Store() && switches->isHires())
+				region = switches->isPage2() ? regions[REGION_AUX_RAM] : regions[REGION_MAIN_RAM];
+			else if ((write && switches->isRAMWRT()) || (!write && switches->isRAMRD()))
 				region = regions[REGION_AUX_RAM];
 			else
 				region = regions[REGION_MAIN_RAM];
@@ -151,8 +300,10 @@ MemoryBus::access(uint16_t offset, bool write, uint8_t byte)
 
 		case 0xC0:
 		{
-			if (offset >= 0xC090 && offset <= 0xC09F)
-				region = regions[REGION_SLOT_IO]; // Disk controller
+			if (offset >= SLOT_IO_BASE + 0x10)
+				return(slotAccess(offset, write, byte));
+			else if (offset == RAMWORKS_BANK_REGISTER && regions[REGION_RAMWORKS])
+				region = regions[REGION_RAMWORKS];
 			else
 				region = regions[REGION_SOFT_SWITCHES];
 			break;
@@ -166,6 +317,19 @@ MemoryBus::access(uint16_t offset, bool write, uint8_t byte)
 		case 0xC5:
 		case 0xC6:
 		case 0xC7:
+		{
+			// The 80-column firmware is the internal $C3 ROM unless SLOTC3ROM is on
+			if (! switches->isSlotCXROM() || (page == 0xC3 && ! switches->isSlotC3ROM())) {
+				if (page == 0xC3)
+					intC8ROM = true;
+
+				region = regions[REGION_INTERNAL_ROM];
+			} else {
+				return(slotAccess(offset, write, byte));
+			}
+			break;
+		}
+
 		case 0xC8:
 		case 0xC9:
 		case 0xCA:
@@ -175,10 +339,15 @@ MemoryBus::access(uint16_t offset, bool write, uint8_t byte)
 		case 0xCE:
 		case 0xCF:
 		{
-			if (switches->isSlotCXROM())
-				region = regions[REGION_SLOT_ROMS];
-			else
+			if (! switches->isSlotCXROM() || intC8ROM)
 				region = regions[REGION_INTERNAL_ROM];
+			else
+				return(slotAccess(offset, write, byte));
+
+			if (offset == SLOT_EXPANSION_ROM_OFF) {
+				intC8ROM = false;
+				expansionSlot = 0;
+			}
 			break;
 		}
 
@@ -200,14 +369,18 @@ MemoryBus::access(uint16_t offset, bool write, uint8_t byte)
 		case 0xDE:
 		case 0xDF:
 		{
-			// 4 possibilities: ROM, Main bank 1, Main bank 2, Aux bank 1, Aux bank 2
-			if ( (write && switches->isRAMWRT()) || (!write && switches->isRAMRD()) )
-				region = switches->useBank2() ? regions[REGION_AUX_BANK2] : regions[REGION_AUX_RAM];
-			else if ( (write && switches->isBankWrite()) || (!write && switches->isBankRead()) )
-				region = switches->useBank2() ? regions[REGION_MAIN_BANK2] : regions[REGION_MAIN_RAM];
-			else
+			// 5 possibilities: ROM, Main bank 1, Main bank 2, Aux bank 1, Aux bank 2
+			// The language card follows ALTZP, not RAMRD/RAMWRT.
+			if ( (write && switches->isBankWrite()) || (!write && switches->isBankRead()) ) {
+				if (switches->isALTZP())
+					region = switches->useBank2() ? regions[REGION_AUX_BANK2] : regions[REGION_AUX_RAM];
+				else
+					region = switches->useBank2() ? regions[REGION_MAIN_BANK2] : regions[REGION_MAIN_RAM];
+			} else if (! write) {
 				region = regions[REGION_MAIN_ROM];
+			}
 
+			// Writes while the language card is write-protected are discarded
 			break;
 		}
 
@@ -244,18 +417,18 @@ MemoryBus::access(uint16_t offset, bool write, uint8_t byte)
 		case 0xFE:
 		case 0xFF:
 		{
-			// XXX: This works for read, but what about write?
-			if ( switches->isBankRead() )
-				region = regions[REGION_MAIN_RAM];
-			else
+			if ( (write && switches->isBankWrite()) || (!write && switches->isBankRead()) )
+				region = switches->isALTZP() ? regions[REGION_AUX_RAM] : regions[REGION_MAIN_RAM];
+			else if (! write)
 				region = regions[REGION_MAIN_ROM];
-				     
+
 			break;
 		}
 		
+		// $0200-$03FF, $0800-$1FFF, $4000-$BFFF
 		default:
 		{
-			if (switches->isRAMRD())
+			if ((write && switches->isRAMWRT()) || (!write && switches->isRAMRD()))
 				region = regions[REGION_AUX_RAM];
 			else
 				region = regions[REGION_MAIN_RAM];
@@ -263,13 +436,19 @@ MemoryBus::access(uint16_t offset, bool write, uint8_t byte)
 		}
 	}
 
+#ifdef MEMORY_HEATMAP
+	if (heatMap) {
+		enum heat_access type = write ? HEAT_WRITE : (opcodeFetch ? HEAT_EXEC : HEAT_READ);
+		heatMap->count(getHeatBank(region, page), page, type);
+	}
+#endif
+
 	if (region) {
 		if (write) {
 			result = 0;
 
-			// XXX: It would be very useful here to have access to the registers.
 			if (region->isReadOnly())
-				printf("Warning: Code at $%04X is trying to write to readonly region $%04X\n", registers->pc, offset);
+				LOG(LOG_MEMORY, LOG_WARN, "Code at $%04X is trying to write to readonly region $%04X\n", registers->pc, offset);
 
 			region->write(offset, byte);
 		} else
@@ -279,3 +458,55 @@ MemoryBus::access(uint16_t offset, bool write, uint8_t byte)
 	return(result);	
 }
 
+/*
+ * Peripheral card space: $C090-$C0FF, $C100-$C7FF and $C800-$CFFF.
+ * The card is found from the address alone, so the cost doesn't grow
+ * with the number of cards. Empty slots read as $00.
+ */
+uint8_t
+MemoryBus::slotAccess(uint16_t offset, bool write, uint8_t byte)
+{
+	uint8_t page = get_page(offset);
+	uint8_t result = 0x00;
+	SlotCard *card = NULL;
+
+#ifdef MEMORY_HEATMAP
+	if (heatMap)
+		heatMap->count(getHeatBank(NULL, page), page, write ? HEAT_WRITE : (opcodeFetch ? HEAT_EXEC : HEAT_READ));
+#endif
+
+	if (page == 0xC0) {
+		// $C090-$C0FF
+		card = slotCards[(offset - SLOT_IO_BASE) >> 4];
+
+		if (card) {
+			if (write)
+				card->ioWrite(offset & 0x0F, byte);
+			else
+				result = card->ioRead(offset & 0x0F);
+		}
+	} else if (page < 0xC8) {
+		// $Cn00-$CnFF: also gives $C800-$CFFF to this slot
+		card = slotCards[page & 0x07];
+		expansionSlot = page & 0x07;
+
+		if (card && ! write)
+			result = card->romRead(offset & 0xFF);
+	} else {
+		// $C800-$CFFF
+		card = slotCards[expansionSlot];
+
+		if (card) {
+			if (write)
+				card->expansionWrite(offset - SLOT_EXPANSION_ROM_START, byte);
+			else
+				result = card->expansionRead(offset - SLOT_EXPANSION_ROM_START);
+		}
+
+		if (offset == SLOT_EXPANSION_ROM_OFF)
+			expansionSlot = 0;
+	}
+
+	return(result);
+}
+
@@ -3,8 +3,13 @@
 
 #include "MemoryRegion.h"
 #include "Registers.h"
+#include "SlotCard.h"
 
-#define NB_REGIONS 9
+#ifdef MEMORY_HEATMAP
+#include "HeatMap.h"
+#endif
+
+#define NB_REGIONS 8
 enum memory_regions {
 	REGION_MAIN_RAM = 0,
 	REGION_MAIN_BANK2,
@@ -13,21 +18,27 @@ enum memory_regions {
 	REGION_AUX_RAM,
 	REGION_AUX_BANK2,
 	REGION_SOFT_SWITCHES,
-	REGION_SLOT_ROMS,
-	REGION_SLOT_IO,
+	REGION_RAMWORKS,
 };
 
 /*
  * The memory bus is a linked list of all regions in the system: RAM, ROMs, screen memory, etc.
+ * Peripheral cards are not regions: they sit in slotCards[] and are
+ * reached directly through the slot number encoded in the address.
  */
 class MemoryBus
 {
 public:
 	MemoryBus(unsigned int size, registers_t *registers);
 	void init(void);
+	bool enableRamWorks(unsigned int nbBanks);
+	void installCard(int slot, SlotCard *card);
+	SlotCard *getCard(int slot);
+	registers_t *getRegisters(void) { return(registers); }
 	void addRegion(MemoryRegion *region);
 	void setRegionData(enum memory_regions regionNumber, uint16_t size, uint8_t *data);
 	uint8_t read(uint16_t offset);
+	uint8_t fetch(uint16_t offset);
 	void write(uint16_t offset, uint8_t byte);
 	unsigned int getSize(void);
 	uint8_t readSoftSwitch(uint16_t offset);
@@ -35,8 +46,27 @@ public:
 	MemoryRegion* getRegion(enum memory_regions regionNumber);
 	uint8_t access(uint16_t offset, bool write, uint8_t byte);
 
+#ifdef MEMORY_HEATMAP
+	void enableHeatMap(bool enable);
+	HeatMap *getHeatMap(void) { return(heatMap); }
+#endif
+
 protected:
+	uint8_t slotAccess(uint16_t offset, bool write, uint8_t byte);
+
+#ifdef MEMORY_HEATMAP
+	enum heat_banks getHeatBank(MemoryRegion *region, uint8_t page);
+#endif
+
 	unsigned int memorySize;
 	MemoryRegion *regions[NB_REGIONS];
 	registers_t *registers;
+	SlotCard *slotCards[NB_SLOTS];
+	int expansionSlot;   // Slot whose ROM is at $C800-$CFFF, 0 if none
+	bool intC8ROM;       // Internal ROM at $C800-$CFFF, after an access to the internal $C3 ROM
+
+#ifdef MEMORY_HEATMAP
+	HeatMap *heatMap;    // NULL when not counting
+	bool opcodeFetch;
+#endif
 };
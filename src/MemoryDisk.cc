@@ -22,15 +22,16 @@
  */
 
 #include "MemoryDisk.h"
+#include "Log.h"
 
 #include <cstdio>
 
 #include <assert.h>
 
-MemoryDisk::MemoryDisk(uint16_t regionStart, uint16_t regionEnd, bool readonly)
-	: MemoryRegion(regionStart, regionEnd, readonly),
-	  currentDisk(NULL)
-	 
+MemoryDisk::MemoryDisk(void)
+	: currentDisk(NULL),
+	  q6(0),
+	  q7(0)
 {
 	disk[0] = NULL;
 	disk[1] = NULL;
@@ -44,19 +45,18 @@ Slot 3.. C0B0-C0BF
 ..
 Slot 7.. C0F0-C0FF
 
+'reg' is the offset within the slot's I/O space (0..15)
 */
 void 
-MemoryDisk::write(uint16_t offset, uint8_t byte)
+MemoryDisk::ioWrite(uint8_t reg, uint8_t byte)
 {
-	uint16_t realOffset = translateOffset(offset);
-
 	// Don't try anything if there's no disk loaded
 	if (! currentDisk)
 		return;
 
-	printf("MemoryDisk::write($%04X, 0x%02X)\n", offset, byte);
+	LOG(LOG_DISK, LOG_DEBUG, "MemoryDisk::write($%04X, 0x%02X)\n", SLOT_IO_BASE + slot * 16 + reg, byte);
 
-	switch(realOffset) {
+	switch(reg) {
 		case 0x0000:
 			currentDisk->phaseOff(0);
 			break;
@@ -98,11 +98,11 @@ MemoryDisk::write(uint16_t offset, uint8_t byte)
 			break;
 
 		case 0x000A:
-			currentDisk = disk[0];
+			selectDrive(0);
 			break;
 
 		case 0x000B:
-			currentDisk = disk[1];
+			selectDrive(1);
 			break;
 
 		case 0x000C: 
@@ -110,28 +110,31 @@ MemoryDisk::write(uint16_t offset, uint8_t byte)
 			break;
 
 		case 0x000D:
-			// XXX: Writing to disk goes here, I guess.
 			q6 = 1;
 			break;
 
 		case 0x000E:
-			q7 = 0;
+			setWriteMode(false);
 			break;
 
 		case 0x000F:
-			q7 = 1;
+			setWriteMode(true);
 			break;
 
 		default:
 			// Ignore?
 			break;
 	}	
+
+	// In write mode, writing to an odd address with Q6 on loads the
+	// latch, which the controller then shifts out to the disk.
+	if (q6 && q7 && (reg & 0x01))
+		currentDisk->writeByte(byte);
 }
 
 uint8_t 
-MemoryDisk::read(uint16_t offset)
+MemoryDisk::ioRead(uint8_t reg)
 {
-	uint16_t realOffset = translateOffset(offset);
 	uint8_t val = 0x00;
 
 	// XXX: There's a specific value to return here but I don't
@@ -139,9 +142,7 @@ MemoryDisk::read(uint16_t offset)
 	if (! currentDisk)
 		return(0);
 
-	// printf("MemoryDisk::read($%04X)\n", offset);
-
-	switch(realOffset) {
+	switch(reg) {
 		case 0x0000:
 			currentDisk->phaseOff(0);
 			break;
@@ -183,11 +184,11 @@ MemoryDisk::read(uint16_t offset)
 			break;
 
 		case 0x000A:
-			currentDisk = disk[0];
+			selectDrive(0);
 			break;
 
 		case 0x000B:
-			currentDisk = disk[1];
+			selectDrive(1);
 			break;
 
 		case 0x000C: 
@@ -201,11 +202,11 @@ MemoryDisk::read(uint16_t offset)
 			break;
 
 		case 0x000E:
-			q7 = 0;
+			setWriteMode(false);
 			break;
 
 		case 0x000F:
-			q7 = 1;
+			setWriteMode(true);
 			break;
 
 		default:
@@ -213,9 +214,51 @@ MemoryDisk::read(uint16_t offset)
 			break;
 	}	
 
+	// Q6 on, Q7 off: sense write protect. Bit 7 of the latch is set when
+	// the disk is protected.
+	if (q6 && ! q7 && ! (reg & 0x01))
+		val = currentDisk->isWriteProtected() ? 0x80 : 0x00;
+
 	return(val);
 }
 
+/* Q7 selects between reading (off) and writing (on) */
+void
+MemoryDisk::setWriteMode(bool on)
+{
+	if (on && ! q7)
+		currentDisk->beginWrite();
+	else if (! on && q7)
+		currentDisk->endWrite();
+
+	q7 = on ? 1 : 0;
+}
+
+/*
+ * Only one drive's motor can be on: when the other drive is selected
+ * while it turns, it stops at once and the selected drive starts.
+ */
+void
+MemoryDisk::selectDrive(int driveNumber)
+{
+	Disk *selected = disk[driveNumber];
+
+	if (! selected || selected == currentDisk)
+		return;
+
+	if (currentDisk->isMotorEnabled()) {
+		bool spinningDown = currentDisk->isSpinningDown();
+
+		currentDisk->stopMotor();
+		selected->motorOn();
+
+		if (spinningDown)
+			selected->motorOff();
+	}
+
+	currentDisk = selected;
+}
+
 void
 MemoryDisk::setDisk(int driveNumber, Disk *disk)
 {
@@ -1,5 +1,5 @@
 /*
- * MemoryDisk.h - Interface between memory and disk controller (handles $Cx00-$CxFF)
+ * MemoryDisk.h - Interface between memory and disk controller (handles $C0n0-$C0nF)
  * Copyright (C) 2012 Benjamin Charron <bcharron@pobox.com>
  *
  * This program is free software; you can redistribute it and/or modify
@@ -25,18 +25,21 @@
 #define _MEMORYDISK_H
 
 #include "Disk.h"
-#include "MemoryRegion.h"
+#include "SlotCard.h"
 
-class MemoryDisk : public MemoryRegion
+/* The Disk II controller card, normally in slot 6 */
+class MemoryDisk : public SlotCard
 {
 public:
-	MemoryDisk(uint16_t regionStart, uint16_t regionEnd, bool readonly);
-	~MemoryDisk(void);
-	void write(uint16_t offset, uint8_t byte);
-	uint8_t read(uint16_t offset);
+	MemoryDisk(void);
+	void ioWrite(uint8_t reg, uint8_t byte);
+	uint8_t ioRead(uint8_t reg);
 	void setDisk(int driveNumber, Disk *disk);
 
 private:
+	void setWriteMode(bool on);
+	void selectDrive(int driveNumber);
+
 	Disk *disk[2];
 	Disk *currentDisk;
 	uint8_t q6;
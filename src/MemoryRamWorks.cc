@@ -0,0 +1,103 @@
+/*
+ * MemoryRamWorks.cc - RamWorks-style extended 80-column card for the Apple ][e emulator
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * MemoryRamWorks.cc - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 09:12:40 2026
+ * Revision : $Id$
+ */
+
+#include "MemoryRamWorks.h"
+
+#include <assert.h>
+#include <string.h>
+
+MemoryRamWorks::MemoryRamWorks(uint16_t regionStart, uint16_t regionEnd, bool readonly,
+                               unsigned int nbBanks, MemoryRegion *auxRAM, MemoryRegion *auxBank2)
+	: MemoryRegion(regionStart, regionEnd, readonly),
+	  nbBanks(nbBanks),
+	  currentBank(0),
+	  lastValue(0x00),
+	  auxRAM(auxRAM),
+	  auxBank2(auxBank2)
+{
+	assert(nbBanks > 0 && nbBanks <= RAMWORKS_MAX_BANKS);
+	assert(auxRAM->getSize() == RAMWORKS_BANK_SIZE && auxBank2->getSize() == RAMWORKS_BANK2_SIZE);
+
+	for (int x = 0; x < RAMWORKS_MAX_BANKS; x++) {
+		bankData[x] = NULL;
+		bank2Data[x] = NULL;
+	}
+
+	// Bank 0 is the regular 64K of aux memory. It now belongs to the
+	// card so that the aux regions can be pointed elsewhere.
+	bankData[0] = new uint8_t[RAMWORKS_BANK_SIZE];
+	bank2Data[0] = new uint8_t[RAMWORKS_BANK2_SIZE];
+	memcpy(bankData[0], auxRAM->getData(), RAMWORKS_BANK_SIZE);
+	memcpy(bank2Data[0], auxBank2->getData(), RAMWORKS_BANK2_SIZE);
+
+	auxRAM->mapData(bankData[0]);
+	auxBank2->mapData(bank2Data[0]);
+}
+
+MemoryRamWorks::~MemoryRamWorks(void)
+{
+	for (int x = 0; x < RAMWORKS_MAX_BANKS; x++) {
+		delete[] bankData[x];
+		delete[] bank2Data[x];
+	}
+}
+
+/*
+ * Point the aux regions at another bank. Banks that are not installed
+ * alias onto installed ones, like the unconnected address lines of the
+ * real card; RAM disk drivers rely on this to size the card.
+ */
+void
+MemoryRamWorks::selectBank(uint8_t bankNumber)
+{
+	unsigned int bank = bankNumber % nbBanks;
+
+	if (bank == currentBank)
+		return;
+
+	if (bankData[bank] == NULL) {
+		bankData[bank] = new uint8_t[RAMWORKS_BANK_SIZE];
+		bank2Data[bank] = new uint8_t[RAMWORKS_BANK2_SIZE];
+		memset(bankData[bank], 0, RAMWORKS_BANK_SIZE);
+		memset(bank2Data[bank], 0, RAMWORKS_BANK2_SIZE);
+	}
+
+	auxRAM->mapData(bankData[bank]);
+	auxBank2->mapData(bank2Data[bank]);
+
+	currentBank = bank;
+}
+
+void
+MemoryRamWorks::write(uint16_t offset, uint8_t byte)
+{
+	lastValue = byte;
+	selectBank(byte & 0x7F);
+}
+
+/* The bank register is write-only; reads return whatever was last written */
+uint8_t
+MemoryRamWorks::read(uint16_t offset)
+{
+	return(lastValue);
+}
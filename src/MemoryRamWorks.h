@@ -0,0 +1,61 @@
+/*
+ * MemoryRamWorks.h - RamWorks-style extended 80-column card (many 64K aux banks)
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * MemoryRamWorks.h - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 09:12:40 2026
+ * Revision : $Id$
+ */
+
+#ifndef _MEMORYRAMWORKS_H
+#define _MEMORYRAMWORKS_H
+
+#include "MemoryRegion.h"
+
+#define RAMWORKS_BANK_REGISTER 0xC073
+#define RAMWORKS_MAX_BANKS 128      // 128 * 64K == 8MB
+#define RAMWORKS_BANK_SIZE  0x10000 // $0000-$FFFF, including LC bank 1 at $D000
+#define RAMWORKS_BANK2_SIZE 0x1000  // LC bank 2 at $D000-$DFFF
+
+/*
+ * The bank register lives at $C073. Selecting a bank only changes the
+ * buffers the aux regions point to; no memory is ever copied.
+ */
+class MemoryRamWorks : public MemoryRegion
+{
+public:
+	MemoryRamWorks(uint16_t regionStart, uint16_t regionEnd, bool readonly,
+	               unsigned int nbBanks, MemoryRegion *auxRAM, MemoryRegion *auxBank2);
+	~MemoryRamWorks(void);
+	void write(uint16_t offset, uint8_t byte);
+	uint8_t read(uint16_t offset);
+	void selectBank(uint8_t bankNumber);
+	unsigned int getCurrentBank(void) { return(currentBank); }
+	unsigned int getNbBanks(void) { return(nbBanks); }
+	uint8_t *getBankData(unsigned int bank) { return(bankData[bank % nbBanks]); }  // NULL until first selected
+
+private:
+	unsigned int nbBanks;
+	unsigned int currentBank;
+	uint8_t lastValue;
+	MemoryRegion *auxRAM;
+	MemoryRegion *auxBank2;
+	uint8_t *bankData[RAMWORKS_MAX_BANKS];   // Allocated on first use
+	uint8_t *bank2Data[RAMWORKS_MAX_BANKS];
+};
+
+#endif
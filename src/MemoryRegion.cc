@@ -30,6 +30,7 @@ MemoryRegion::MemoryRegion(uint16_t regionStart, uint16_t regionEnd, bool readon
 	: regionStart(regionStart),
 	  regionEnd(regionEnd),
 	  size((unsigned long) regionEnd - regionStart + 1),
+	  ownsData(true),
 	  readonly(readonly)
 {
 	this->data = new uint8_t[this->size];
@@ -38,15 +39,40 @@ MemoryRegion::MemoryRegion(uint16_t regionStart, uint16_t regionEnd, bool readon
 
 MemoryRegion::~MemoryRegion(void)
 {
-	delete[] this->data;
+	if (ownsData)
+		delete[] this->data;
 }
 
 void
 MemoryRegion::setData(uint8_t data[])
 {
+	assert(ownsData);
+
 	memcpy(this->data, data, this->size);
 }
 
+/*
+ * Make this region use an external buffer of at least getSize() bytes
+ * instead of its own. Nothing is copied: this is what makes bank
+ * switching cheap. The caller keeps ownership of the buffer.
+ */
+void
+MemoryRegion::mapData(uint8_t *data)
+{
+	if (ownsData) {
+		delete[] this->data;
+		ownsData = false;
+	}
+
+	this->data = data;
+}
+
+uint8_t *
+MemoryRegion::getData(void)
+{
+	return(this->data);
+}
+
 uint16_t MemoryRegion::getStart(void)
 {
 	return(this->regionStart);
@@ -34,6 +34,8 @@ public:
 	MemoryRegion(uint16_t regionStart, uint16_t regionEnd, bool readonly);
 	~MemoryRegion(void);
 	void setData(uint8_t *data);
+	void mapData(uint8_t *data);
+	uint8_t *getData(void);
 	uint16_t getStart(void);
 	uint16_t getEnd(void);
 	virtual uint8_t read(uint16_t offset);
@@ -48,6 +50,7 @@ protected:
 	uint16_t regionEnd;
 	unsigned long size;
 	uint8_t *data;
+	bool ownsData;      // False when 'data' points to a buffer owned by someone else
 	bool readonly;
 };
 
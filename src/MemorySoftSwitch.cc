@@ -43,8 +43,9 @@ MemorySoftSwitch::MemorySoftSwitch(uint16_t regionStart, uint16_t regionEnd, boo
 	  ramwrt(false),
 	  bankRead(false),
 	  bankWrite(false),
-	  bBank2(false),
-	  slotCXROM(false),
+	  bBank2(true),
+	  preWrite(false),
+	  slotCXROM(true),
 	  slotC3ROM(false),
 	  keyboardData(0x00),
 	  keyboardStrobe(false)
@@ -63,6 +64,32 @@ MemorySoftSwitch::setKeyboardData(uint8_t val)
 	keyboardData = val;
 }
 
+/*
+ * Language card switches, $C080-$C08F ("slot 0"):
+ *  bit 3    0: bank 2, 1: bank 1
+ *  bits 0-1 0: read RAM, no write    1: read ROM, write RAM
+ *           2: read ROM, no write    3: read RAM, write RAM
+ * Writing to RAM requires two consecutive reads of an odd switch.
+ */
+void
+MemorySoftSwitch::languageCardAccess(uint16_t offset, bool write)
+{
+	uint8_t mode = offset & 0x03;
+
+	bBank2 = ! (offset & 0x08);
+	bankRead = (mode == 0 || mode == 3);
+
+	if (offset & 0x01) {
+		if (preWrite && ! write)
+			bankWrite = true;
+
+		preWrite = ! write;
+	} else {
+		bankWrite = false;
+		preWrite = false;
+	}
+}
+
 void
 MemorySoftSwitch::write(uint16_t offset, uint8_t byte)
 {
@@ -89,6 +116,30 @@ MemorySoftSwitch::write(uint16_t offset, uint8_t byte)
 			break;
 		}
 
+		case 0xC002:
+		{
+			ramrd = false;
+			break;
+		}
+
+		case 0xC003:
+		{
+			ramrd = true;
+			break;
+		}
+
+		case 0xC004:
+		{
+			ramwrt = false;
+			break;
+		}
+
+		case 0xC005:
+		{
+			ramwrt = true;
+			break;
+		}
+
 		case 0xC006:
 		{
 			slotCXROM = true;
@@ -101,6 +152,18 @@ MemorySoftSwitch::write(uint16_t offset, uint8_t byte)
 			break;
 		}
 
+		case 0xC008:
+		{
+			altzp = false;
+			break;
+		}
+
+		case 0xC009:
+		{
+			altzp = true;
+			break;
+		}
+
 		case 0xC00A:
 		{
 			slotC3ROM = false;
@@ -195,6 +258,11 @@ MemorySoftSwitch::write(uint16_t offset, uint8_t byte)
 
 		default:
 		{
+			if (offset >= 0xC080) {
+				languageCardAccess(offset, true);
+				break;
+			}
+
 			uint16_t realOffset = translateOffset(offset);
 			data[realOffset] = byte;
 
@@ -234,9 +302,40 @@ MemorySoftSwitch::read(uint16_t offset)
 			break;
 		}
 
+		case 0xC011:
+		{
+			val = (bBank2 ? 0x80 : 0x00);
+			break;
+		}
+
+		case 0xC012:
+		{
+			val = (bankRead ? 0x80 : 0x00);
+			break;
+		}
+
+		case 0xC013:
+		{
+			val = (ramrd ? 0x80 : 0x00);
+			break;
+		}
+
+		case 0xC014:
+		{
+			val = (ramwrt ? 0x80 : 0x00);
+			break;
+		}
+
 		case 0xC015:
 		{
-			val = (slotCXROM ? 0x80 : 0x00);
+			// RDCXROM is set when the internal ROM is selected
+			val = (slotCXROM ? 0x00 : 0x80);
+			break;
+		}
+
+		case 0xC016:
+		{
+			val = (altzp ? 0x80 : 0x00);
 			break;
 		}
 
@@ -246,6 +345,12 @@ MemorySoftSwitch::read(uint16_t offset)
 			break;
 		}
 
+		case 0xC018:
+		{
+			val = (text80Store ? 0x80 : 0x00);
+			break;
+		}
+
 		case 0xC019:
 		{
 			// XXX: This is probably a factor of cycles.
@@ -353,6 +458,11 @@ MemorySoftSwitch::read(uint16_t offset)
 			
 		default:
 		{
+			if (offset >= 0xC080) {
+				languageCardAccess(offset, false);
+				break;
+			}
+
 			uint16_t realOffset = translateOffset(offset);
 			val = data[realOffset];
 			break;
@@ -57,6 +57,7 @@ private:
 	void changeMixed(bool val) { mixed = val; }
 	void changeAltCharset(bool val) { altCharset = val; }
 	void changeText80Col(bool val) { text80Col = val; }
+	void languageCardAccess(uint16_t offset, bool write);
 
 	bool altCharset;
 	bool text;
@@ -72,7 +73,8 @@ private:
 	bool bankRead;   // True if reading from 0xD000 BANK rather than ROM
 	bool bankWrite;  // True if writing to 0xD000 BANK, otherwise discard the write
 	bool bBank2;     // 0: Read from bank 1.  1: Read from bank 2.
-	bool slotCXROM;  // 0: Read from internal ROM  1: Read from expansion ROM
+	bool preWrite;   // An odd $C08x switch was just read once; a second read enables writes
+	bool slotCXROM;  // 0: Read from internal ROM  1: Read from expansion ROM (INTCXROM off)
 	bool slotC3ROM;  // 0: Read from 80-col firmware  1: Read from expansion ROM
 	uint8_t keyboardData; //
 	bool keyboardStrobe;
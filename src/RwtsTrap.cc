@@ -0,0 +1,214 @@
+/*
+ * RwtsTrap.cc - DOS 3.3 RWTS accelerator
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * RwtsTrap.cc - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 18:31:05 2026
+ * Revision : $Id$
+ */
+
+#include "RwtsTrap.h"
+#include "Log.h"
+#include "MemoryBus.h"
+
+#include <string.h>
+
+// RWTS starts by saving the IOB pointer: STY $48, STA $49
+static const uint8_t RWTS_SIGNATURE[] = { 0x84, 0x48, 0x85, 0x49 };
+
+// RWTS's interleave: physical sector of each DOS 3.3 sector
+static const uint8_t RWTS_PHYSICAL_SECTOR[DISK_SECTORS_PER_TRACK] = {
+	0x00, 0x0D, 0x0B, 0x09, 0x07, 0x05, 0x03, 0x01,
+	0x0E, 0x0C, 0x0A, 0x08, 0x06, 0x04, 0x02, 0x0F
+};
+
+// Zero page locations RWTS leaves behind
+#define ZP_CHECKSUM_FOUND 0x2C        // Of the last address field read
+#define ZP_SECTOR_FOUND 0x2D
+#define ZP_TRACK_FOUND 0x2E
+#define ZP_VOLUME_FOUND 0x2F
+#define ZP_IOB_POINTER 0x48           // 2 bytes
+
+// Slot-indexed screen holes holding the current track of each drive,
+// in half-tracks
+#define RWTS_DRIVE1_TRACK 0x0478
+#define RWTS_DRIVE2_TRACK 0x04F8
+
+RwtsTrap::RwtsTrap(MemoryBus *bus)
+	: bus(bus),
+	  registers(bus->getRegisters()),
+	  enabled(false)
+{
+	for (int s = 0; s < NB_SLOTS; s++) {
+		for (int x = 0; x < RWTS_NB_DRIVES; x++)
+			drives[s][x] = NULL;
+	}
+}
+
+/* 'drive' (0 or 1) of the Disk II controller in 'slot' */
+void
+RwtsTrap::setDrive(int slot, int drive, Disk *disk)
+{
+	drives[slot][drive] = disk;
+}
+
+/* Whether the code at RWTS_ENTRY is DOS 3.3's RWTS */
+bool
+RwtsTrap::isRwts(void)
+{
+	for (unsigned int x = 0; x < sizeof(RWTS_SIGNATURE); x++) {
+		if (bus->read(RWTS_ENTRY + x) != RWTS_SIGNATURE[x])
+			return(false);
+	}
+
+	return(true);
+}
+
+/*
+ * Called when the CPU is about to execute RWTS_ENTRY. Returns true if the
+ * call was done here, with the CPU back at the caller.
+ */
+bool
+RwtsTrap::call(void)
+{
+	uint16_t iobAddress = (registers->a << 8) | registers->y;
+	uint8_t iob[IOB_LEN];
+
+	if (! enabled || ! isRwts())
+		return(false);
+
+	for (int x = 0; x < IOB_LEN; x++)
+		iob[x] = bus->read(iobAddress + x);
+
+	uint8_t command = iob[IOB_COMMAND];
+
+	if (iob[IOB_TABLE_TYPE] != 0x01 || (iob[IOB_SLOT] & 0x0F) != 0 || iob[IOB_SLOT] / 16 >= NB_SLOTS
+	    || iob[IOB_DRIVE] < 1 || iob[IOB_DRIVE] > RWTS_NB_DRIVES
+	    || iob[IOB_TRACK] >= DISK_TRACKS_PER_DISK || iob[IOB_SECTOR] >= DISK_SECTORS_PER_TRACK
+	    || (command != RWTS_CMD_SEEK && command != RWTS_CMD_READ && command != RWTS_CMD_WRITE && command != RWTS_CMD_FORMAT))
+		return(false);
+
+	Disk *disk = drives[iob[IOB_SLOT] / 16][iob[IOB_DRIVE] - 1];
+
+	if (! disk || ! disk->hasSectors())
+		return(false);
+
+	LOG(LOG_DISK, LOG_DEBUG, "RWTS command %d, drive %d, track %d, sector %d, buffer $%02X%02X\n",
+		command, iob[IOB_DRIVE], iob[IOB_TRACK], iob[IOB_SECTOR], iob[IOB_BUFFER + 1], iob[IOB_BUFFER]);
+
+	finish(iobAddress, iob, disk, doCommand(disk, iob));
+
+	return(true);
+}
+
+/* Do the IOB's command on 'disk'. Returns the RWTS return code. */
+uint8_t
+RwtsTrap::doCommand(Disk *disk, const uint8_t *iob)
+{
+	uint16_t buffer = iob[IOB_BUFFER] | (iob[IOB_BUFFER + 1] << 8);
+	uint8_t data[DISK_BYTES_PER_SECTOR];
+
+	// Volume 0 matches any disk
+	if (iob[IOB_VOLUME] != 0 && iob[IOB_VOLUME] != disk->getVolume() && iob[IOB_COMMAND] != RWTS_CMD_FORMAT)
+		return(RWTS_ERR_VOLUME_MISMATCH);
+
+	switch(iob[IOB_COMMAND]) {
+		case RWTS_CMD_SEEK:
+			disk->seek(iob[IOB_TRACK]);
+			break;
+
+		case RWTS_CMD_READ:
+			disk->seek(iob[IOB_TRACK]);
+			disk->readDosSector(iob[IOB_TRACK], iob[IOB_SECTOR], data);
+
+			for (int x = 0; x < DISK_BYTES_PER_SECTOR; x++)
+				bus->write(buffer + x, data[x]);
+			break;
+
+		case RWTS_CMD_WRITE:
+			if (disk->isWriteProtected())
+				return(RWTS_ERR_WRITE_PROTECTED);
+
+			for (int x = 0; x < DISK_BYTES_PER_SECTOR; x++)
+				data[x] = bus->read(buffer + x);
+
+			disk->seek(iob[IOB_TRACK]);
+			disk->writeDosSector(iob[IOB_TRACK], iob[IOB_SECTOR], data);
+			break;
+
+		case RWTS_CMD_FORMAT:
+			// Every sector is zeroed. The image keeps its own volume
+			// number rather than the one in the IOB.
+			if (disk->isWriteProtected())
+				return(RWTS_ERR_WRITE_PROTECTED);
+
+			memset(data, 0x00, sizeof(data));
+
+			for (int t = 0; t < DISK_TRACKS_PER_DISK; t++) {
+				disk->seek(t);
+
+				for (int s = 0; s < DISK_SECTORS_PER_TRACK; s++)
+					disk->writeDosSector(t, s, data);
+			}
+			break;
+	}
+
+	return(RWTS_ERR_NONE);
+}
+
+/* Leave the IOB, the zero page and the registers as RWTS would, and return to the caller */
+void
+RwtsTrap::finish(uint16_t iobAddress, const uint8_t *iob, Disk *disk, uint8_t code)
+{
+	uint8_t slot = iob[IOB_SLOT] / 16;
+	uint8_t drive = iob[IOB_DRIVE];
+	uint8_t track = iob[IOB_TRACK];
+	uint8_t volume = disk->getVolume();
+
+	if (iob[IOB_COMMAND] == RWTS_CMD_FORMAT && code == RWTS_ERR_NONE)
+		track = DISK_TRACKS_PER_DISK - 1;
+
+	bus->write(iobAddress + IOB_RETURN_CODE, code);
+	bus->write(iobAddress + IOB_VOLUME_FOUND, volume);
+	bus->write(iobAddress + IOB_PREVIOUS_SLOT, iob[IOB_SLOT]);
+	bus->write(iobAddress + IOB_PREVIOUS_DRIVE, drive);
+
+	bus->write(ZP_IOB_POINTER, iobAddress & 0xFF);
+	bus->write(ZP_IOB_POINTER + 1, iobAddress >> 8);
+
+	if (iob[IOB_COMMAND] == RWTS_CMD_READ || iob[IOB_COMMAND] == RWTS_CMD_WRITE) {
+		uint8_t physical = RWTS_PHYSICAL_SECTOR[iob[IOB_SECTOR]];
+
+		bus->write(ZP_CHECKSUM_FOUND, volume ^ track ^ physical);
+		bus->write(ZP_SECTOR_FOUND, physical);
+		bus->write(ZP_TRACK_FOUND, track);
+		bus->write(ZP_VOLUME_FOUND, volume);
+	}
+
+	if (code != RWTS_ERR_VOLUME_MISMATCH)
+		bus->write((drive == 1 ? RWTS_DRIVE1_TRACK : RWTS_DRIVE2_TRACK) + slot, track * 2);
+
+	registers->a = code;
+	registers->psw.f.c = (code != RWTS_ERR_NONE);
+
+	// RTS
+	uint8_t low = bus->read(0x100 + (uint8_t) (registers->sp + 1));
+	uint8_t high = bus->read(0x100 + (uint8_t) (registers->sp + 2));
+
+	registers->sp += 2;
+	registers->pc = ((high << 8) | low) + 1;
+}
@@ -0,0 +1,94 @@
+/*
+ * RwtsTrap.h - DOS 3.3 RWTS accelerator
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * RwtsTrap.h - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 18:31:05 2026
+ * Revision : $Id$
+ */
+
+#ifndef _RWTSTRAP_H
+#define _RWTSTRAP_H
+
+#include <stdint.h>
+
+#include "Disk.h"
+#include "Registers.h"
+#include "SlotCard.h"
+
+class MemoryBus;
+
+#define RWTS_ENTRY 0xBD00             // Where DOS 3.3 keeps its RWTS
+#define RWTS_START 0xB800             // RWTS and its tables, with the nibble buffers
+#define RWTS_END 0xBFFF
+#define RWTS_NB_DRIVES 2
+
+// Input/Output control Block, pointed to by A (high) and Y (low)
+#define IOB_TABLE_TYPE 0x00
+#define IOB_SLOT 0x01                 // Slot * 16
+#define IOB_DRIVE 0x02                // 1 or 2
+#define IOB_VOLUME 0x03               // Expected volume, 0 for any
+#define IOB_TRACK 0x04
+#define IOB_SECTOR 0x05
+#define IOB_BUFFER 0x08               // 2 bytes
+#define IOB_COMMAND 0x0C
+#define IOB_RETURN_CODE 0x0D
+#define IOB_VOLUME_FOUND 0x0E
+#define IOB_PREVIOUS_SLOT 0x0F
+#define IOB_PREVIOUS_DRIVE 0x10
+#define IOB_LEN 0x11
+
+#define RWTS_CMD_SEEK 0x00
+#define RWTS_CMD_READ 0x01
+#define RWTS_CMD_WRITE 0x02
+#define RWTS_CMD_FORMAT 0x04
+
+#define RWTS_ERR_NONE 0x00
+#define RWTS_ERR_WRITE_PROTECTED 0x10
+#define RWTS_ERR_VOLUME_MISMATCH 0x20
+
+/*
+ * Runs DOS 3.3's RWTS calls in the host. When the CPU reaches RWTS_ENTRY
+ * and the code there is RWTS, the IOB is checked and the request is
+ * done directly on the sectors of the image, without stepping through
+ * the nibbles. The registers, the IOB and the zero page are left as RWTS
+ * would leave them, and the CPU returns to the caller.
+ *
+ * Anything unusual (a slot without a Disk II, a .nib or .woz image, a
+ * bad IOB) is left to the real RWTS, which reports its own errors.
+ */
+class RwtsTrap
+{
+public:
+	RwtsTrap(MemoryBus *bus);
+	void setDrive(int slot, int drive, Disk *disk);
+	void setEnabled(bool enabled) { this->enabled = enabled; }
+	bool isEnabled(void) { return(enabled); }
+	bool call(void);
+	bool isRwts(void);
+
+private:
+	uint8_t doCommand(Disk *disk, const uint8_t *iob);
+	void finish(uint16_t iobAddress, const uint8_t *iob, Disk *disk, uint8_t code);
+
+	MemoryBus *bus;
+	registers_t *registers;
+	Disk *drives[NB_SLOTS][RWTS_NB_DRIVES];
+	bool enabled;
+};
+
+#endif
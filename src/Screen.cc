@@ -46,14 +46,27 @@ Screen::Screen(unsigned int width, unsigned int height, MemoryRegion *mainRegion
 	  windowHeight(480),
 	  mainRegion(mainRegion),
 	  auxRegion(auxRegion),
+	  auxVideo(auxRegion->getData()),
 	  switches(switches),
 	  sdl_window(NULL),
 	  sdl_renderer(NULL),
 	  sdl_texture(NULL),
-	  sdl_surface(NULL)
+	  sdl_surface(NULL),
+	  fontFile(NULL),
+	  fontBuffer(NULL)
 {
 }
 
+/*
+ *  Video always comes from aux bank 0, whichever bank the CPU has
+ *  selected on a RamWorks card.
+ */
+void
+Screen::setAuxVideo(const uint8_t *data)
+{
+	auxVideo = data;
+}
+
 /*
  *  Change the pixel size, effectively 'zooming' it
  */
@@ -172,8 +185,6 @@ amask = 0xff000000;
 		return(false);
 	}
 
-	fontBuffer = new uint8_t[SCREEN_FONT_SIZE];
-
 	std::string videoROM = std::string("Apple IIe Video ROM US.bin");
 	if (! loadFont(videoROM)) {
 		fprintf(stderr, "Couldn't open video ROM %s\n", videoROM.c_str());
@@ -247,7 +258,7 @@ Screen::redrawText()
 				if (x % 2 == 0)
 					c = mainRegion->read(offset);
 				else
-				        c = auxRegion->read(offset);
+					c = auxVideo[offset];
 
 				drawCharacter(x * CHARACTER_WIDTH, y * CHARACTER_HEIGHT, c);
 			}
@@ -515,19 +526,19 @@ Screen::drawBlock(int x, int y, int size_x, int size_y, unsigned char color)
 bool
 Screen::loadFont(std::string filename)
 {
-	FILE *f = fopen(filename.c_str(), "r");
-	if (! f) {
-		perror("fopen()");
+	MappedFile *file = MappedFile::open(filename);
+	if (! file)
 		return(false);
-	}
 
-	size_t len = fread(fontBuffer, 1, SCREEN_FONT_SIZE, f);
-	if (len != SCREEN_FONT_SIZE) {
-		fprintf(stderr, "Error reading font file %s: Expected %d bytes but read %lu\n", filename.c_str(), SCREEN_FONT_SIZE, len);
+	if (file->getSize() < SCREEN_FONT_SIZE) {
+		fprintf(stderr, "Error reading font file %s: Expected %d bytes but got %lu\n", filename.c_str(), SCREEN_FONT_SIZE, (unsigned long) file->getSize());
+		MappedFile::release(file);
 		return(false);
 	}
 
-	fclose(f);
+	MappedFile::release(fontFile);
+	fontFile = file;
+	fontBuffer = file->getData();
 
 	return(true);
 }
@@ -28,6 +28,7 @@
 
 #include <string>
 
+#include "MappedFile.h"
 #include "MemoryRegion.h"
 #include "MemorySoftSwitch.h"
 
@@ -67,6 +68,7 @@ public:
 	bool loadFont(std::string filename);
 	bool setZoom(unsigned int zoomFactor);
 	unsigned int getZoom(void);
+	void setAuxVideo(const uint8_t *data);
 
 private:
 	void redrawText();
@@ -86,12 +88,14 @@ private:
 
 	MemoryRegion *mainRegion;
 	MemoryRegion *auxRegion;
+	const uint8_t *auxVideo;       // Aux bank 0, even when another bank is selected
 	MemorySoftSwitch *switches;
 	SDL_Window *sdl_window;
 	SDL_Renderer *sdl_renderer;
 	SDL_Texture *sdl_texture;
 	SDL_Surface *sdl_surface;
-	uint8_t *fontBuffer;
+	MappedFile *fontFile;
+	const uint8_t *fontBuffer;     // Points into fontFile's shared mapping
 	Uint32 colors[16];
 };
 
@@ -0,0 +1,81 @@
+/*
+ * SlotCard.cc - Base class for peripheral cards of the Apple ][e emulator
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * SlotCard.cc - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 14:30:12 2026
+ * Revision : $Id$
+ */
+
+#include "SlotCard.h"
+
+#include <stddef.h>
+
+SlotCard::SlotCard(void)
+	: bus(NULL),
+	  slot(0),
+	  rom(NULL),
+	  expansionRom(NULL)
+{
+}
+
+SlotCard::~SlotCard(void)
+{
+}
+
+/* Called by MemoryBus::installCard() */
+void
+SlotCard::install(MemoryBus *bus, int slot)
+{
+	this->bus = bus;
+	this->slot = slot;
+}
+
+uint8_t
+SlotCard::romRead(uint8_t offset)
+{
+	if (rom)
+		return(rom[offset]);
+
+	return(0x00);
+}
+
+uint8_t
+SlotCard::expansionRead(uint16_t offset)
+{
+	if (expansionRom)
+		return(expansionRom[offset]);
+
+	return(0x00);
+}
+
+void
+SlotCard::expansionWrite(uint16_t offset, uint8_t byte)
+{
+}
+
+void
+SlotCard::setROM(const uint8_t *rom)
+{
+	this->rom = rom;
+}
+
+void
+SlotCard::setExpansionROM(const uint8_t *expansionRom)
+{
+	this->expansionRom = expansionRom;
+}
@@ -0,0 +1,68 @@
+/*
+ * SlotCard.h - Interface for peripheral cards plugged in slots 1-7
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * SlotCard.h - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 14:30:12 2026
+ * Revision : $Id$
+ */
+
+#ifndef _SLOTCARD_H
+#define _SLOTCARD_H
+
+#include <stdint.h>
+
+#define NB_SLOTS 8                    // Slot 0 is the language card, built into the //e
+#define SLOT_IO_BASE 0xC080           // Slot n's I/O space is $C080 + n * 16
+#define SLOT_ROM_SIZE 0x100           // Slot n's ROM is $Cn00-$CnFF
+#define SLOT_EXPANSION_ROM_START 0xC800
+#define SLOT_EXPANSION_ROM_SIZE 0x800 // $C800-$CFFF, shared by all slots
+#define SLOT_EXPANSION_ROM_OFF 0xCFFF // Accessing this releases the expansion ROM space
+
+class MemoryBus;
+
+/*
+ * A peripheral card. The memory bus dispatches to it directly through
+ * its slot number:
+ *  - $C0n0-$C0nF (n = 8 + slot) go to ioRead()/ioWrite() with reg = 0..15
+ *  - $Cn00-$CnFF go to romRead(), and make this card own $C800-$CFFF
+ *  - $C800-$CFFF go to expansionRead()/expansionWrite() of the owner;
+ *    $CFFF then releases $C800-$CFFF
+ */
+class SlotCard
+{
+public:
+	SlotCard(void);
+	virtual ~SlotCard(void);
+	virtual void install(MemoryBus *bus, int slot);
+	virtual uint8_t ioRead(uint8_t reg) = 0;
+	virtual void ioWrite(uint8_t reg, uint8_t byte) = 0;
+	virtual uint8_t romRead(uint8_t offset);
+	virtual uint8_t expansionRead(uint16_t offset);
+	virtual void expansionWrite(uint16_t offset, uint8_t byte);
+	void setROM(const uint8_t *rom);
+	void setExpansionROM(const uint8_t *expansionRom);
+	int getSlot(void) { return(slot); }
+
+protected:
+	MemoryBus *bus;
+	int slot;
+	const uint8_t *rom;           // SLOT_ROM_SIZE bytes, or NULL
+	const uint8_t *expansionRom;  // SLOT_EXPANSION_ROM_SIZE bytes, or NULL
+};
+
+#endif
@@ -0,0 +1,499 @@
+/*
+ * SmartPort.cc - ProDOS/SmartPort block device card
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * SmartPort.cc - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 17:12:48 2026
+ * Revision : $Id$
+ */
+
+#include "SmartPort.h"
+#include "Log.h"
+#include "MemoryBus.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+// Where the ProDOS driver is in the firmware. The SmartPort entry point
+// is always 3 bytes after it.
+#define SMARTPORT_PRODOS_ENTRY 0x20
+#define SMARTPORT_DRIVER 0x30
+
+// Fields of the .2mg header
+#define IMG2_MAGIC "2IMG"
+#define IMG2_FORMAT_OFFSET 0x0C
+#define IMG2_FLAGS_OFFSET 0x10
+#define IMG2_DATA_OFFSET 0x18
+#define IMG2_DATA_LEN_OFFSET 0x1C
+#define IMG2_FORMAT_PRODOS 1
+#define IMG2_FLAG_LOCKED 0x80000000
+
+// General status byte: block device, read, write, online
+#define SMARTPORT_STATUS_BYTE 0xF0
+#define SMARTPORT_STATUS_WRITE_PROTECTED 0x04
+
+static uint32_t
+getLong(const uint8_t *p)
+{
+	return(p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24));
+}
+
+SmartPort::SmartPort(void)
+	: imageFile(NULL),
+	  blocks(NULL),
+	  nbBlocks(0),
+	  dataOffset(0),
+	  fd(-1),
+	  writeProtected(true)
+{
+	memset(romData, 0, sizeof(romData));
+}
+
+SmartPort::~SmartPort(void)
+{
+	closeFile();
+}
+
+void
+SmartPort::install(MemoryBus *bus, int slot)
+{
+	SlotCard::install(bus, slot);
+
+	buildROM();
+	setROM(romData);
+}
+
+/* The firmware only depends on the slot, so it is generated rather than loaded */
+void
+SmartPort::buildROM(void)
+{
+	uint8_t io = (SLOT_IO_BASE & 0xFF) + slot * 16;
+	uint8_t page = 0xC0 + slot;
+
+	const uint8_t boot[] = {
+		0xA2, 0x20,             // LDX #$20     $Cn01, $Cn03, $Cn05 and $Cn07
+		0xA0, 0x00,             // LDY #$00     identify a SmartPort device
+		0xA2, 0x03,             // LDX #$03
+		0xA2, 0x00,             // LDX #$00
+		0x2C, (uint8_t) (io + SMARTPORT_TRAP_BOOT), 0xC0,       // BIT $C0n2    Block 0 to $0800
+		0xB0, 0x05,             // BCS fail
+		0xA2, (uint8_t) (slot << 4),                            // LDX #$n0
+		0x4C, 0x01, 0x08,       // JMP $0801
+		0x4C, 0x00, 0xC6,       // fail: JMP $C600    Let the Disk II boot instead
+	};
+
+	const uint8_t entry[] = {
+		0x4C, SMARTPORT_DRIVER, page,                           // JMP $Cn30    ProDOS
+		0x2C, (uint8_t) (io + SMARTPORT_TRAP_SMARTPORT), 0xC0,  // BIT $C0n1    SmartPort
+		0x60,                   // RTS
+	};
+
+	const uint8_t driver[] = {
+		0x2C, (uint8_t) (io + SMARTPORT_TRAP_PRODOS), 0xC0,     // BIT $C0n0
+		0x60,                   // RTS
+	};
+
+	memset(romData, 0, sizeof(romData));
+	memcpy(&romData[0], boot, sizeof(boot));
+	memcpy(&romData[SMARTPORT_PRODOS_ENTRY], entry, sizeof(entry));
+	memcpy(&romData[SMARTPORT_DRIVER], driver, sizeof(driver));
+
+	// $CnFC-$CnFD: number of blocks, 0 to ask with a STATUS call
+	romData[0xFC] = 0x00;
+	romData[0xFD] = 0x00;
+
+	// $CnFE: one volume, supports status, read, write and format
+	romData[0xFE] = 0x0F;
+
+	// $CnFF: offset of the ProDOS entry point
+	romData[0xFF] = SMARTPORT_PRODOS_ENTRY;
+}
+
+/* Open a .hdv, .po or .2mg image. Returns false if it can't be used. */
+bool
+SmartPort::openFile(std::string filename)
+{
+	MappedFile *file = MappedFile::open(filename);
+	uint32_t offset = 0;
+	uint32_t len;
+	bool locked = false;
+
+	if (! file)
+		return(false);
+
+	const uint8_t *data = file->getData();
+	size_t size = file->getSize();
+
+	if (size >= SMARTPORT_2MG_HEADER_LEN && memcmp(data, IMG2_MAGIC, 4) == 0) {
+		if (getLong(&data[IMG2_FORMAT_OFFSET]) != IMG2_FORMAT_PRODOS) {
+			LOG(LOG_DISK, LOG_ERROR, "%s: Not a ProDOS-order .2mg image\n", filename.c_str());
+			MappedFile::release(file);
+			return(false);
+		}
+
+		offset = getLong(&data[IMG2_DATA_OFFSET]);
+		len = getLong(&data[IMG2_DATA_LEN_OFFSET]);
+		locked = (getLong(&data[IMG2_FLAGS_OFFSET]) & IMG2_FLAG_LOCKED) != 0;
+	} else {
+		len = size;
+	}
+
+	if (offset > size || len > size - offset || len < SMARTPORT_BLOCK_SIZE
+	    || len / SMARTPORT_BLOCK_SIZE > SMARTPORT_MAX_BLOCKS) {
+		LOG(LOG_DISK, LOG_ERROR, "%s: Invalid hard disk image size %zu\n", filename.c_str(), size);
+		MappedFile::release(file);
+		return(false);
+	}
+
+	closeFile();
+
+	imageFile = file;
+	dataOffset = offset;
+	blocks = data + offset;
+	nbBlocks = len / SMARTPORT_BLOCK_SIZE;
+
+	// The blocks are read from the mapping, and written with this
+	if (! locked)
+		fd = ::open(filename.c_str(), O_WRONLY);
+
+	writeProtected = (fd < 0);
+
+	LOG(LOG_DISK, LOG_INFO, "Hard disk image %s: %u blocks%s\n", filename.c_str(), nbBlocks, writeProtected ? ", write protected" : "");
+
+	return(true);
+}
+
+void
+SmartPort::closeFile(void)
+{
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+		fd = -1;
+	}
+
+	if (imageFile) {
+		MappedFile::release(imageFile);
+		imageFile = NULL;
+	}
+
+	blocks = NULL;
+	nbBlocks = 0;
+	writeProtected = true;
+}
+
+uint8_t
+SmartPort::ioRead(uint8_t reg)
+{
+	switch(reg) {
+		case SMARTPORT_TRAP_PRODOS:
+			prodosCall();
+			break;
+
+		case SMARTPORT_TRAP_SMARTPORT:
+			smartportCall();
+			break;
+
+		case SMARTPORT_TRAP_BOOT:
+			boot();
+			break;
+
+		default:
+			break;
+	}
+
+	return(0x00);
+}
+
+void
+SmartPort::ioWrite(uint8_t reg, uint8_t byte)
+{
+}
+
+/* The firmware does the RTS: only A and the carry are left to set */
+void
+SmartPort::setResult(uint8_t error)
+{
+	registers_t *registers = bus->getRegisters();
+
+	registers->a = error;
+	registers->psw.f.c = (error != SMARTPORT_ERR_NONE);
+}
+
+uint8_t
+SmartPort::readBlock(uint32_t block, uint16_t buffer)
+{
+	if (! blocks)
+		return(SMARTPORT_ERR_NODEV);
+
+	if (block >= nbBlocks)
+		return(SMARTPORT_ERR_IO);
+
+	const uint8_t *src = &blocks[block * SMARTPORT_BLOCK_SIZE];
+
+	for (int x = 0; x < SMARTPORT_BLOCK_SIZE; x++)
+		bus->write(buffer + x, src[x]);
+
+	LOG(LOG_DISK, LOG_DEBUG, "Read block %u to $%04X\n", block, buffer);
+
+	return(SMARTPORT_ERR_NONE);
+}
+
+uint8_t
+SmartPort::writeBlock(uint32_t block, uint16_t buffer)
+{
+	uint8_t data[SMARTPORT_BLOCK_SIZE];
+
+	if (! blocks)
+		return(SMARTPORT_ERR_NODEV);
+
+	if (writeProtected)
+		return(SMARTPORT_ERR_WRITE_PROTECTED);
+
+	if (block >= nbBlocks)
+		return(SMARTPORT_ERR_IO);
+
+	for (int x = 0; x < SMARTPORT_BLOCK_SIZE; x++)
+		data[x] = bus->read(buffer + x);
+
+	// The mapping is shared with the page cache, so it sees the write
+	off_t offset = dataOffset + (off_t) block * SMARTPORT_BLOCK_SIZE;
+
+	if (pwrite(fd, data, sizeof(data), offset) != (ssize_t) sizeof(data)) {
+		LOG(LOG_DISK, LOG_ERROR, "Unable to write block %u: %s\n", block, strerror(errno));
+		return(SMARTPORT_ERR_IO);
+	}
+
+	LOG(LOG_DISK, LOG_DEBUG, "Wrote block %u from $%04X\n", block, buffer);
+
+	return(SMARTPORT_ERR_NONE);
+}
+
+/*
+ * ProDOS block device call. The parameters are in the zero page:
+ * $42 command, $43 unit, $44-$45 buffer, $46-$47 block.
+ */
+void
+SmartPort::prodosCall(void)
+{
+	registers_t *registers = bus->getRegisters();
+	uint8_t command = bus->read(0x42);
+	uint16_t buffer = bus->read(0x44) | (bus->read(0x45) << 8);
+	uint32_t block = bus->read(0x46) | (bus->read(0x47) << 8);
+	uint8_t error = SMARTPORT_ERR_NONE;
+
+	// Only drive 1 exists
+	if (bus->read(0x43) & 0x80) {
+		setResult(SMARTPORT_ERR_NODEV);
+		return;
+	}
+
+	switch(command) {
+		case PRODOS_CMD_STATUS:
+			if (! blocks) {
+				error = SMARTPORT_ERR_NODEV;
+			} else if (writeProtected) {
+				error = SMARTPORT_ERR_WRITE_PROTECTED;
+			}
+
+			// The size of the volume is in X and Y, even when write protected
+			registers->x = (nbBlocks > 0xFFFF ? 0xFFFF : nbBlocks) & 0xFF;
+			registers->y = (nbBlocks > 0xFFFF ? 0xFFFF : nbBlocks) >> 8;
+			break;
+
+		case PRODOS_CMD_READ:
+			error = readBlock(block, buffer);
+			break;
+
+		case PRODOS_CMD_WRITE:
+			error = writeBlock(block, buffer);
+			break;
+
+		case PRODOS_CMD_FORMAT:
+			// Nothing to do, the blocks are already there
+			if (! blocks)
+				error = SMARTPORT_ERR_NODEV;
+			else if (writeProtected)
+				error = SMARTPORT_ERR_WRITE_PROTECTED;
+			break;
+
+		default:
+			error = SMARTPORT_ERR_IO;
+			break;
+	}
+
+	setResult(error);
+}
+
+/*
+ * Fill a STATUS call's status list. Unit 0 is the SmartPort itself,
+ * unit 1 the image.
+ */
+uint8_t
+SmartPort::status(uint8_t unit, uint8_t code, uint16_t list, uint16_t *count)
+{
+	uint8_t buf[25];
+	uint8_t statusByte = 0x00;
+
+	memset(buf, 0, sizeof(buf));
+
+	if (blocks)
+		statusByte = SMARTPORT_STATUS_BYTE | (writeProtected ? SMARTPORT_STATUS_WRITE_PROTECTED : 0x00);
+
+	if (unit == 0) {
+		if (code != 0x00)
+			return(SMARTPORT_ERR_BADCTL);
+
+		buf[0] = 1;             // Number of devices
+		*count = 8;
+	} else if (code == 0x00) {
+		// General status
+		buf[0] = statusByte;
+		buf[1] = nbBlocks & 0xFF;
+		buf[2] = (nbBlocks >> 8) & 0xFF;
+		buf[3] = (nbBlocks >> 16) & 0xFF;
+		*count = 4;
+	} else if (code == 0x03) {
+		// Device information block
+		const char *name = "EMU HARD DISK";
+
+		buf[0] = statusByte;
+		buf[1] = nbBlocks & 0xFF;
+		buf[2] = (nbBlocks >> 8) & 0xFF;
+		buf[3] = (nbBlocks >> 16) & 0xFF;
+		buf[4] = strlen(name);
+		memset(&buf[5], ' ', 16);
+		memcpy(&buf[5], name, strlen(name));
+		buf[21] = 0x02;         // Hard disk
+		buf[22] = 0x00;
+		buf[23] = 0x01;         // Version 1.0
+		buf[24] = 0x00;
+		*count = 25;
+	} else {
+		return(SMARTPORT_ERR_BADCTL);
+	}
+
+	for (int x = 0; x < *count; x++)
+		bus->write(list + x, buf[x]);
+
+	return(SMARTPORT_ERR_NONE);
+}
+
+/*
+ * SmartPort call:
+ *   JSR entry
+ *   .byte command
+ *   .word parameters
+ * The return address on the stack is moved past the 3 inline bytes.
+ */
+void
+SmartPort::smartportCall(void)
+{
+	registers_t *registers = bus->getRegisters();
+	uint16_t stack = 0x100 + registers->sp;
+	uint16_t ret = bus->read(stack + 1) | (bus->read(stack + 2) << 8);
+	uint8_t command = bus->read(ret + 1);
+	uint16_t params = bus->read(ret + 2) | (bus->read(ret + 3) << 8);
+	uint8_t error = SMARTPORT_ERR_NONE;
+	uint16_t count = 0;
+
+	ret += 3;
+	bus->write(stack + 1, ret & 0xFF);
+	bus->write(stack + 2, ret >> 8);
+
+	uint8_t paramCount = bus->read(params);
+	uint8_t unit = bus->read(params + 1);
+	uint16_t buffer = bus->read(params + 2) | (bus->read(params + 3) << 8);
+	uint32_t block = bus->read(params + 4) | (bus->read(params + 5) << 8) | (bus->read(params + 6) << 16);
+
+	LOG(LOG_DISK, LOG_DEBUG, "SmartPort command $%02X unit %d from $%04X\n", command, unit, ret - 3);
+
+	switch(command) {
+		case SMARTPORT_CMD_STATUS:
+			if (paramCount != 3)
+				error = SMARTPORT_ERR_BADPCNT;
+			else if (unit > 1)
+				error = SMARTPORT_ERR_BADUNIT;
+			else
+				error = status(unit, bus->read(params + 4), buffer, &count);
+			break;
+
+		case SMARTPORT_CMD_READBLOCK:
+		case SMARTPORT_CMD_WRITEBLOCK:
+			if (paramCount != 3)
+				error = SMARTPORT_ERR_BADPCNT;
+			else if (unit != 1)
+				error = SMARTPORT_ERR_BADUNIT;
+			else if (block >= nbBlocks && blocks)
+				error = SMARTPORT_ERR_BADBLOCK;
+			else if (command == SMARTPORT_CMD_READBLOCK)
+				error = readBlock(block, buffer);
+			else
+				error = writeBlock(block, buffer);
+
+			if (error == SMARTPORT_ERR_NONE)
+				count = SMARTPORT_BLOCK_SIZE;
+			break;
+
+		case SMARTPORT_CMD_FORMAT:
+			if (paramCount != 1)
+				error = SMARTPORT_ERR_BADPCNT;
+			else if (unit != 1)
+				error = SMARTPORT_ERR_BADUNIT;
+			else if (writeProtected)
+				error = SMARTPORT_ERR_WRITE_PROTECTED;
+			break;
+
+		case SMARTPORT_CMD_CONTROL:
+			// No control codes, other than the reset every device accepts
+			if (paramCount != 3)
+				error = SMARTPORT_ERR_BADPCNT;
+			else if (bus->read(params + 4) != 0x00)
+				error = SMARTPORT_ERR_BADCTL;
+			break;
+
+		case SMARTPORT_CMD_INIT:
+			if (paramCount != 1)
+				error = SMARTPORT_ERR_BADPCNT;
+			break;
+
+		default:
+			// Extended ($40) commands aren't supported
+			error = SMARTPORT_ERR_BADCMD;
+			break;
+	}
+
+	// X and Y hold the number of bytes transferred
+	registers->x = count & 0xFF;
+	registers->y = count >> 8;
+
+	setResult(error);
+}
+
+/* Load block 0 at $0800, for the firmware to jump to $0801 */
+void
+SmartPort::boot(void)
+{
+	uint8_t error = readBlock(0, 0x0800);
+
+	if (error != SMARTPORT_ERR_NONE)
+		LOG(LOG_DISK, LOG_WARN, "Unable to boot from slot %d\n", slot);
+
+	setResult(error);
+}
@@ -0,0 +1,113 @@
+/*
+ * SmartPort.h - ProDOS/SmartPort block device card
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * SmartPort.h - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 17:12:48 2026
+ * Revision : $Id$
+ */
+
+#ifndef _SMARTPORT_H
+#define _SMARTPORT_H
+
+#include <stdint.h>
+
+#include <string>
+
+#include "MappedFile.h"
+#include "SlotCard.h"
+
+#define SMARTPORT_BLOCK_SIZE 512
+#define SMARTPORT_MAX_BLOCKS 65536          // 32MB, the largest ProDOS volume
+#define SMARTPORT_2MG_HEADER_LEN 64
+
+// Reading these registers calls into the card. The firmware does a
+// "BIT $C0nX" at each of its entry points.
+#define SMARTPORT_TRAP_PRODOS 0x00
+#define SMARTPORT_TRAP_SMARTPORT 0x01
+#define SMARTPORT_TRAP_BOOT 0x02
+
+// ProDOS block device commands, in $42
+#define PRODOS_CMD_STATUS 0x00
+#define PRODOS_CMD_READ 0x01
+#define PRODOS_CMD_WRITE 0x02
+#define PRODOS_CMD_FORMAT 0x03
+
+// SmartPort commands, inline after the JSR
+#define SMARTPORT_CMD_STATUS 0x00
+#define SMARTPORT_CMD_READBLOCK 0x01
+#define SMARTPORT_CMD_WRITEBLOCK 0x02
+#define SMARTPORT_CMD_FORMAT 0x03
+#define SMARTPORT_CMD_CONTROL 0x04
+#define SMARTPORT_CMD_INIT 0x05
+
+// Error codes returned in A, with the carry set
+#define SMARTPORT_ERR_NONE 0x00
+#define SMARTPORT_ERR_BADCMD 0x01
+#define SMARTPORT_ERR_BADPCNT 0x04
+#define SMARTPORT_ERR_BADUNIT 0x11
+#define SMARTPORT_ERR_BADCTL 0x21
+#define SMARTPORT_ERR_IO 0x27
+#define SMARTPORT_ERR_NODEV 0x28
+#define SMARTPORT_ERR_WRITE_PROTECTED 0x2B
+#define SMARTPORT_ERR_BADBLOCK 0x2D
+
+/*
+ * A mass storage card serving 512-byte blocks from a .hdv (or .po) or
+ * .2mg hard disk image, through both the ProDOS block device protocol
+ * and SmartPort.
+ *
+ * There is no 6502 driver: each firmware entry point reads one of the
+ * card's registers, and the card does the whole call right then, reading
+ * its parameters from the registers and memory, copying the block and
+ * setting A and the carry before the firmware's RTS. Blocks are read
+ * straight from the mapping of the image, and written through to the
+ * file.
+ */
+class SmartPort : public SlotCard
+{
+public:
+	SmartPort(void);
+	~SmartPort(void);
+	virtual void install(MemoryBus *bus, int slot);
+	virtual uint8_t ioRead(uint8_t reg);
+	virtual void ioWrite(uint8_t reg, uint8_t byte);
+	bool openFile(std::string filename);
+	void closeFile(void);
+	bool isWriteProtected(void) { return(writeProtected); }
+
+private:
+	void buildROM(void);
+	void prodosCall(void);
+	void smartportCall(void);
+	void boot(void);
+	uint8_t readBlock(uint32_t block, uint16_t buffer);
+	uint8_t writeBlock(uint32_t block, uint16_t buffer);
+	uint8_t status(uint8_t unit, uint8_t code, uint16_t list, uint16_t *count);
+	void setResult(uint8_t error);
+
+	uint8_t romData[SLOT_ROM_SIZE];
+
+	MappedFile *imageFile;
+	const uint8_t *blocks;      // First block of the image
+	uint32_t nbBlocks;
+	uint32_t dataOffset;        // Where the blocks start in the file: after the .2mg header
+	int fd;                     // To write the blocks through, -1 when write protected
+	bool writeProtected;
+};
+
+#endif
@@ -0,0 +1,470 @@
+/*
+ * WozImage.cc - WOZ 1 and 2 flux-level disk images
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * WozImage.cc - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 16:22:05 2026
+ * Revision : $Id$
+ */
+
+#include "WozImage.h"
+#include "Log.h"
+#include "MappedFile.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#define WOZ_CHUNK_HEADER_LEN 8
+#define WOZ_INFO_LEN 60
+#define WOZ_CREATOR_LEN 32
+#define WOZ_CRC_OFFSET 8
+#define WOZ1_TRK_LEN 6656               // Bitstream plus trailer, per track
+#define WOZ1_BITS_LEN 6646
+#define WOZ2_TRK_LEN 8                  // TRK entry: block, block count, bit count
+#define WOZ2_BLOCK_LEN 512
+
+#define WOZ_CHUNK_INFO 0x4F464E49       // "INFO"
+#define WOZ_CHUNK_TMAP 0x50414D54       // "TMAP"
+#define WOZ_CHUNK_TRKS 0x534B5254       // "TRKS"
+
+// Bit cells a completed nibble stays in the latch: 8 cycles
+#define WOZ_LATCH_HOLD_CELLS 2
+
+// Sync bytes are 0xFF followed by two zero bits, to realign the reader
+#define WOZ_SYNC_BITS 10
+#define WOZ_CREATOR "emu dskconv"
+
+// Header, INFO, TMAP and the TRKS entries fit in the first three blocks
+#define WOZ2_FIRST_TRACK_BLOCK 3
+
+static void
+put16(uint8_t *p, uint16_t value)
+{
+	p[0] = value & 0xFF;
+	p[1] = value >> 8;
+}
+
+static void
+put32(uint8_t *p, uint32_t value)
+{
+	put16(p, value & 0xFFFF);
+	put16(&p[2], value >> 16);
+}
+
+/* Bits of 'length' nibbles once written: sync bytes take WOZ_SYNC_BITS */
+static uint32_t
+countBits(const uint8_t *nibbles, uint16_t length)
+{
+	uint32_t bits = 0;
+
+	for (int x = 0; x < length; x++)
+		bits += (nibbles[x] == 0xFF) ? WOZ_SYNC_BITS : 8;
+
+	return(bits);
+}
+
+WozImage::WozImage(void)
+	: version(0),
+	  writeProtected(true),
+	  bitTiming(WOZ_DEFAULT_BIT_TIMING)
+{
+	memset(tmap, WOZ_NO_TRACK, sizeof(tmap));
+
+	for (int x = 0; x < WOZ_NB_QUARTER_TRACKS; x++) {
+		tracks[x].bits = NULL;
+		tracks[x].bitCount = 0;
+		tracks[x].latch = NULL;
+	}
+}
+
+WozImage::~WozImage(void)
+{
+	for (int x = 0; x < WOZ_NB_QUARTER_TRACKS; x++)
+		delete[] tracks[x].latch;
+}
+
+/* Look for the "WOZ1" or "WOZ2" signature */
+bool
+WozImage::isWoz(const uint8_t *data, size_t size)
+{
+	return(size >= WOZ_HEADER_LEN
+		&& memcmp(data, "WOZ", 3) == 0 && (data[3] == '1' || data[3] == '2')
+		&& data[4] == 0xFF && data[5] == 0x0A && data[6] == 0x0D && data[7] == 0x0A);
+}
+
+/*
+ * Find the chunks of a WOZ image. The bitstreams aren't copied: 'data'
+ * must stay mapped as long as the WozImage is used. Returns NULL if the
+ * image is invalid.
+ */
+WozImage *
+WozImage::parse(const uint8_t *data, size_t size)
+{
+	if (! isWoz(data, size))
+		return(NULL);
+
+	WozImage *woz = new WozImage();
+	bool hasInfo = false;
+	bool hasTmap = false;
+	bool hasTrks = false;
+	bool ok = true;
+	size_t offset = WOZ_HEADER_LEN;
+
+	woz->version = data[3] - '0';
+
+	// The CRC isn't checked: that would mean reading the whole image.
+	while (ok && offset + WOZ_CHUNK_HEADER_LEN <= size) {
+		uint32_t id = get32(&data[offset]);
+		uint32_t len = get32(&data[offset + 4]);
+		const uint8_t *chunk = &data[offset + WOZ_CHUNK_HEADER_LEN];
+
+		if (len > size - offset - WOZ_CHUNK_HEADER_LEN) {
+			LOG(LOG_DISK, LOG_ERROR, "WOZ: chunk goes past the end of the file\n");
+			ok = false;
+			break;
+		}
+
+		switch(id) {
+			case WOZ_CHUNK_INFO:
+				ok = woz->parseInfo(chunk, len);
+				hasInfo = true;
+				break;
+
+			case WOZ_CHUNK_TMAP:
+				if (len >= WOZ_NB_QUARTER_TRACKS) {
+					memcpy(woz->tmap, chunk, WOZ_NB_QUARTER_TRACKS);
+					hasTmap = true;
+				}
+				break;
+
+			case WOZ_CHUNK_TRKS:
+				if (woz->version == 1)
+					ok = woz->parseTracks1(chunk, len);
+				else
+					ok = woz->parseTracks2(data, size, chunk, len);
+				hasTrks = true;
+				break;
+
+			default:
+				// META, WRIT, FLUX...: not needed to read the disk
+				break;
+		}
+
+		offset += WOZ_CHUNK_HEADER_LEN + len;
+	}
+
+	if (ok && ! (hasInfo && hasTmap && hasTrks)) {
+		LOG(LOG_DISK, LOG_ERROR, "WOZ: INFO, TMAP or TRKS chunk missing\n");
+		ok = false;
+	}
+
+	// Every quarter track must point to a track that exists
+	for (int x = 0; ok && x < WOZ_NB_QUARTER_TRACKS; x++) {
+		if (woz->tmap[x] != WOZ_NO_TRACK && (woz->tmap[x] >= WOZ_NB_QUARTER_TRACKS || woz->tracks[woz->tmap[x]].bitCount == 0)) {
+			LOG(LOG_DISK, LOG_ERROR, "WOZ: quarter track %d maps to missing track %d\n", x, woz->tmap[x]);
+			ok = false;
+		}
+	}
+
+	if (! ok) {
+		delete woz;
+		woz = NULL;
+	}
+
+	return(woz);
+}
+
+/*
+ * Make a WOZ2 image of 'nbTracks' whole tracks, track x being the
+ * 'lengths[x]' nibbles of 'nibbles[x]'. Each track is under its quarter
+ * track and the ones on both sides, as on a real disk. Every 0xFF is
+ * written as a sync byte: for the 0xFF nibbles of the data, the extra
+ * zeros are dropped by the reader. Returns NULL if out of memory.
+ */
+MappedFile *
+WozImage::build(std::string filename, const uint8_t **nibbles, const uint16_t *lengths, unsigned int nbTracks, uint8_t bootFormat)
+{
+	uint16_t largestTrack = 0;
+	size_t size = WOZ2_FIRST_TRACK_BLOCK * WOZ2_BLOCK_LEN;
+
+	if (nbTracks * 4 > WOZ_NB_QUARTER_TRACKS)
+		return(NULL);
+
+	for (unsigned int t = 0; t < nbTracks; t++) {
+		uint16_t blocks = (countBits(nibbles[t], lengths[t]) + WOZ2_BLOCK_LEN * 8 - 1) / (WOZ2_BLOCK_LEN * 8);
+
+		if (blocks > largestTrack)
+			largestTrack = blocks;
+
+		size += blocks * WOZ2_BLOCK_LEN;
+	}
+
+	MappedFile *file = MappedFile::allocate(filename, size);
+
+	if (! file)
+		return(NULL);
+
+	// The anonymous mapping starts zeroed
+	uint8_t *data = file->getWritableData();
+	uint8_t *p = &data[WOZ_HEADER_LEN];
+
+	memcpy(data, "WOZ2\xFF\x0A\x0D\x0A", WOZ_CRC_OFFSET);
+
+	put32(p, WOZ_CHUNK_INFO);
+	put32(&p[4], WOZ_INFO_LEN);
+	p += WOZ_CHUNK_HEADER_LEN;
+	p[0] = 2;                               // INFO version
+	p[1] = 1;                               // 5.25"
+	p[4] = 1;                               // Cleaned: no stray bits
+	memset(&p[5], ' ', WOZ_CREATOR_LEN);
+	memcpy(&p[5], WOZ_CREATOR, strlen(WOZ_CREATOR));
+	p[37] = 1;                              // Sides
+	p[38] = bootFormat;
+	p[39] = WOZ_DEFAULT_BIT_TIMING;
+	put16(&p[44], largestTrack);
+	p += WOZ_INFO_LEN;
+
+	put32(p, WOZ_CHUNK_TMAP);
+	put32(&p[4], WOZ_NB_QUARTER_TRACKS);
+	p += WOZ_CHUNK_HEADER_LEN;
+	memset(p, WOZ_NO_TRACK, WOZ_NB_QUARTER_TRACKS);
+
+	for (unsigned int t = 0; t < nbTracks; t++) {
+		for (int q = (int) t * 4 - 1; q <= (int) t * 4 + 1; q++) {
+			if (q >= 0)
+				p[q] = t;
+		}
+	}
+
+	p += WOZ_NB_QUARTER_TRACKS;
+
+	put32(p, WOZ_CHUNK_TRKS);
+	put32(&p[4], size - (p + WOZ_CHUNK_HEADER_LEN - data));
+	p += WOZ_CHUNK_HEADER_LEN;
+
+	uint16_t block = WOZ2_FIRST_TRACK_BLOCK;
+
+	for (unsigned int t = 0; t < nbTracks; t++) {
+		uint8_t *bits = &data[block * WOZ2_BLOCK_LEN];
+		uint32_t bit = 0;
+		uint32_t pending = 0;                   // Bits not yet stored, LSB last
+		int nbPending = 0;
+
+		for (int x = 0; x < lengths[t]; x++) {
+			int width = (nibbles[t][x] == 0xFF) ? WOZ_SYNC_BITS : 8;
+
+			pending = (pending << width) | ((uint32_t) nibbles[t][x] << (width - 8));
+			nbPending += width;
+			bit += width;
+
+			while (nbPending >= 8) {
+				nbPending -= 8;
+				*bits++ = pending >> nbPending;
+			}
+		}
+
+		if (nbPending > 0)
+			*bits = pending << (8 - nbPending);
+
+		uint16_t blocks = (bit + WOZ2_BLOCK_LEN * 8 - 1) / (WOZ2_BLOCK_LEN * 8);
+
+		put16(&p[t * WOZ2_TRK_LEN], block);
+		put16(&p[t * WOZ2_TRK_LEN + 2], blocks);
+		put32(&p[t * WOZ2_TRK_LEN + 4], bit);
+		block += blocks;
+	}
+
+	put32(&data[WOZ_CRC_OFFSET], crc32(crc32(0L, Z_NULL, 0), &data[WOZ_HEADER_LEN], size - WOZ_HEADER_LEN));
+
+	return(file);
+}
+
+bool
+WozImage::parseInfo(const uint8_t *chunk, uint32_t len)
+{
+	if (len < WOZ_INFO_LEN) {
+		LOG(LOG_DISK, LOG_ERROR, "WOZ: INFO chunk too short\n");
+		return(false);
+	}
+
+	// 1 = 5.25", 2 = 3.5"
+	if (chunk[1] != 1) {
+		LOG(LOG_DISK, LOG_ERROR, "WOZ: Not a 5.25\" disk\n");
+		return(false);
+	}
+
+	writeProtected = (chunk[2] == 1);
+
+	// Version 2 and up know the disk's bit timing
+	if (chunk[0] >= 2 && chunk[39] != 0)
+		bitTiming = chunk[39];
+
+	return(true);
+}
+
+/* WOZ1: fixed-size TRK records, one per track, in order */
+bool
+WozImage::parseTracks1(const uint8_t *chunk, uint32_t len)
+{
+	for (uint32_t x = 0; x < len / WOZ1_TRK_LEN && x < WOZ_NB_QUARTER_TRACKS; x++) {
+		const uint8_t *trk = &chunk[x * WOZ1_TRK_LEN];
+		uint32_t bitCount = get16(&trk[WOZ1_BITS_LEN + 2]);
+
+		if (bitCount > WOZ1_BITS_LEN * 8) {
+			LOG(LOG_DISK, LOG_ERROR, "WOZ: track %u has too many bits\n", x);
+			return(false);
+		}
+
+		tracks[x].bits = trk;
+		tracks[x].bitCount = bitCount;
+	}
+
+	return(true);
+}
+
+/* WOZ2: 160 TRK entries pointing to 512-bytes blocks in the file */
+bool
+WozImage::parseTracks2(const uint8_t *data, size_t size, const uint8_t *chunk, uint32_t len)
+{
+	if (len < WOZ_NB_QUARTER_TRACKS * WOZ2_TRK_LEN) {
+		LOG(LOG_DISK, LOG_ERROR, "WOZ: TRKS chunk too short\n");
+		return(false);
+	}
+
+	for (int x = 0; x < WOZ_NB_QUARTER_TRACKS; x++) {
+		const uint8_t *trk = &chunk[x * WOZ2_TRK_LEN];
+		size_t start = (size_t) get16(&trk[0]) * WOZ2_BLOCK_LEN;
+		size_t blocks = get16(&trk[2]);
+		uint32_t bitCount = get32(&trk[4]);
+
+		if (bitCount == 0)
+			continue;
+
+		if (start + blocks * WOZ2_BLOCK_LEN > size || (bitCount + 7) / 8 > blocks * WOZ2_BLOCK_LEN) {
+			LOG(LOG_DISK, LOG_ERROR, "WOZ: track %d goes past the end of the file\n", x);
+			return(false);
+		}
+
+		tracks[x].bits = &data[start];
+		tracks[x].bitCount = bitCount;
+	}
+
+	return(true);
+}
+
+/* Returns the track under 'quarterTrack', or NULL if there is no flux there */
+struct woz_track *
+WozImage::getTrack(uint8_t quarterTrack)
+{
+	if (quarterTrack >= WOZ_NB_QUARTER_TRACKS || tmap[quarterTrack] == WOZ_NO_TRACK)
+		return(NULL);
+
+	struct woz_track *track = &tracks[tmap[quarterTrack]];
+
+	if (! track->latch)
+		buildLatch(track);
+
+	return(track);
+}
+
+/*
+ * Run the bitstream through the read sequencer and record the latch at
+ * every bit cell. Bits are shifted in until bit 7 is set. The complete
+ * nibble then stays in the latch for two more bit cells while the next
+ * one starts shifting in. Zeros before the first 1 of a nibble are lost,
+ * which is how sync bytes realign the reader. The track is a loop: a
+ * first pass over it sets up the sequencer for the start of the track.
+ */
+void
+WozImage::buildLatch(struct woz_track *track)
+{
+	uint8_t shift = 0;
+	uint8_t nibble = 0;
+	uint32_t sinceNibble = WOZ_LATCH_HOLD_CELLS;
+
+	track->latch = new uint8_t[track->bitCount];
+
+	for (int pass = 0; pass < 2; pass++) {
+		for (uint32_t x = 0; x < track->bitCount; x++) {
+			uint8_t bit = (track->bits[x >> 3] >> (7 - (x & 7))) & 0x01;
+
+			shift = (shift << 1) | bit;
+			sinceNibble++;
+
+			if (shift & 0x80) {
+				nibble = shift;
+				shift = 0;
+				sinceNibble = 0;
+			}
+
+			if (pass == 1)
+				track->latch[x] = (sinceNibble < WOZ_LATCH_HOLD_CELLS) ? nibble : shift;
+		}
+	}
+}
+
+/* The bit cell passing under the head after 'cycles' of rotation */
+uint64_t
+WozImage::getBitCell(uint64_t cycles)
+{
+	// bitTiming is in 125ns units, and a cycle is (about) 1us
+	return(cycles * 8 / bitTiming);
+}
+
+/* What a $C08C read finds in the latch when the disk rotated for 'cycles' */
+uint8_t
+WozImage::readLatch(uint8_t quarterTrack, uint64_t cycles)
+{
+	struct woz_track *track = getTrack(quarterTrack);
+
+	// No flux: the amplifier picks up noise
+	if (! track)
+		return(rand() & 0xFF);
+
+	return(track->latch[getBitCell(cycles) % track->bitCount]);
+}
+
+/*
+ * Without a clock, skip to the next complete nibble and move 'cycles'
+ * past it.
+ */
+uint8_t
+WozImage::readNextByte(uint8_t quarterTrack, uint64_t *cycles)
+{
+	struct woz_track *track = getTrack(quarterTrack);
+
+	if (! track)
+		return(rand() & 0xFF);
+
+	uint64_t cell = getBitCell(*cycles);
+	uint8_t previous = track->latch[cell % track->bitCount];
+
+	for (uint32_t x = 0; x < track->bitCount; x++) {
+		uint8_t latch = track->latch[++cell % track->bitCount];
+
+		// A nibble completes when bit 7 shows up
+		if ((latch & 0x80) && ! (previous & 0x80)) {
+			*cycles = (cell + WOZ_LATCH_HOLD_CELLS) * bitTiming / 8;
+			return(latch);
+		}
+
+		previous = latch;
+	}
+
+	return(0x00);
+}
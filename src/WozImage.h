@@ -0,0 +1,85 @@
+/*
+ * WozImage.h - WOZ 1 and 2 flux-level disk images
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * WozImage.h - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 16:22:05 2026
+ * Revision : $Id$
+ */
+
+#ifndef _WOZIMAGE_H
+#define _WOZIMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+class MappedFile;
+
+#define WOZ_HEADER_LEN 12
+#define WOZ_NB_QUARTER_TRACKS 160
+#define WOZ_NO_TRACK 0xFF               // TMAP entry of a quarter track without flux
+#define WOZ_DEFAULT_BIT_TIMING 32       // In 125ns units: 4us per bit cell
+#define WOZ_BOOT_16_SECTORS 1           // INFO boot sector format
+#define WOZ_BOOT_13_SECTORS 2
+
+struct woz_track {
+	const uint8_t *bits;            // Bitstream, MSB of bits[0] first
+	uint32_t bitCount;
+	uint8_t *latch;                 // Latch value for each bit cell, built on first use
+};
+
+/*
+ * A WOZ image is kept as it is in the file: the bitstreams are read from
+ * the mapping. The first time a track is read, the bits are run through
+ * the read sequencer once to record what the latch holds at each bit
+ * cell, so reading the latch later is a table lookup.
+ *
+ * build() goes the other way, for dskconv: it makes a WOZ2 image out of
+ * the nibbles of whole tracks.
+ */
+class WozImage
+{
+public:
+	static bool isWoz(const uint8_t *data, size_t size);
+	static WozImage *parse(const uint8_t *data, size_t size);
+	static MappedFile *build(std::string filename, const uint8_t **nibbles, const uint16_t *lengths,
+		unsigned int nbTracks, uint8_t bootFormat);
+	~WozImage(void);
+
+	uint8_t readLatch(uint8_t quarterTrack, uint64_t cycles);
+	uint8_t readNextByte(uint8_t quarterTrack, uint64_t *cycles);
+	bool isWriteProtected(void) { return(writeProtected); }
+
+private:
+	WozImage(void);
+	bool parseInfo(const uint8_t *chunk, uint32_t len);
+	bool parseTracks1(const uint8_t *chunk, uint32_t len);
+	bool parseTracks2(const uint8_t *data, size_t size, const uint8_t *chunk, uint32_t len);
+	struct woz_track *getTrack(uint8_t quarterTrack);
+	void buildLatch(struct woz_track *track);
+	uint64_t getBitCell(uint64_t cycles);
+
+	uint8_t version;
+	bool writeProtected;
+	uint8_t bitTiming;              // 125ns units per bit cell
+	uint8_t tmap[WOZ_NB_QUARTER_TRACKS];
+	struct woz_track tracks[WOZ_NB_QUARTER_TRACKS];
+};
+
+#endif
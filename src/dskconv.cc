@@ -0,0 +1,421 @@
+/*
+ * dskconv.cc - Convert disk images between formats
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * dskconv.cc - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 23:48:05 2026
+ * Revision : $Id$
+ */
+
+/*
+ * Converts disk images to .dsk (DOS order), .po (ProDOS order), .d13,
+ * .nib or .woz. Every image goes through its sectors: they are read
+ * with Disk::readTrack(), whatever the format of the source, and the
+ * nibbles of .nib and .woz images are those Disk builds for the drive.
+ *
+ * Nothing is written until the result has been read back with another
+ * Disk and gave the same sectors, so a converted image always loads in
+ * the emulator as its source did. Images with sectors that can't be
+ * decoded (copy protection, damaged tracks) are left alone.
+ *
+ * A pool of threads takes the images one after the other from a shared
+ * counter, as dskindex does. Each thread has its own Disks.
+ */
+
+#include "Disk.h"
+#include "Log.h"
+#include "MappedFile.h"
+#include "WozImage.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define CONV_MAX_THREADS 64
+
+enum conv_formats {
+	CONV_DOS_ORDER = 0,
+	CONV_PRODOS_ORDER,
+	CONV_NIB,
+	CONV_WOZ
+};
+
+struct conv_format {
+	const char *extension;
+	enum conv_formats format;
+};
+
+static const struct conv_format FORMATS[] = {
+	{ "dsk", CONV_DOS_ORDER },
+	{ "do",  CONV_DOS_ORDER },
+	{ "po",  CONV_PRODOS_ORDER },
+	{ "d13", CONV_DOS_ORDER },      // 13-sector images are in physical order
+	{ "nib", CONV_NIB },
+	{ "woz", CONV_WOZ },
+	{ NULL,  CONV_DOS_ORDER }
+};
+
+/* The sectors of one image, by physical sector number */
+struct conv_image {
+	uint8_t sectorsPerTrack;
+	uint8_t sectors[DISK_TRACKS_PER_DISK][DISK_SECTORS_PER_TRACK * DISK_BYTES_PER_SECTOR];
+};
+
+/* What each thread converts with */
+struct conv_worker {
+	Disk source;
+	Disk encoder;           // Nibblizes the sectors for .nib and .woz
+	Disk check;             // Reads the result back
+	struct conv_image image;
+};
+
+static const struct conv_format *target = NULL;
+static string outputDirectory("");
+static bool dryRun = false;
+static vector<string> filenames;
+static unsigned int nextImage = 0;
+static unsigned int nbConverted = 0;
+static unsigned int nbFailed = 0;
+
+void usage(char *argv0)
+{
+	printf("Usage: %s -t format [-j threads] [-d dir] [-n] image ...\n", argv0);
+	printf("  -t format  dsk (or do), po, d13, nib or woz\n");
+	printf("  -j threads Convert that many images at once (default: one per CPU)\n");
+	printf("  -d dir     Write the images to 'dir' rather than next to their source\n");
+	printf("  -n         Convert and verify, but don't write anything\n");
+	printf("  image      A .dsk, .do, .po, .d13, .nib or .woz image, which can be in a .gz or .zip\n");
+}
+
+/* 'path' with the extension of the target, without .gz or .zip, in outputDirectory if set */
+static string
+getOutputName(string path)
+{
+	string name = path;
+
+	if (Disk::getExtension(name) == "gz" || Disk::getExtension(name) == "zip")
+		name = name.substr(0, name.rfind('.'));
+
+	if (Disk::getExtension(name).size() > 0)
+		name = name.substr(0, name.rfind('.'));
+
+	if (outputDirectory.size() > 0) {
+		size_t slash = name.rfind('/');
+
+		name = outputDirectory + "/" + (slash == name.npos ? name : name.substr(slash + 1));
+	}
+
+	return(name + "." + target->extension);
+}
+
+/*
+ * Read every sector of the image in 'disk'. A 16-sector disk has
+ * sectors 13 to 15 on every track; a 13-sector one never does.
+ */
+static bool
+readImage(Disk *disk, struct conv_image *image, string path)
+{
+	uint16_t found[DISK_TRACKS_PER_DISK];
+	uint16_t all = 0;
+
+	for (int t = 0; t < DISK_TRACKS_PER_DISK; t++) {
+		found[t] = disk->readTrack(t, image->sectors[t]);
+		all |= found[t];
+	}
+
+	image->sectorsPerTrack = (all >> DISK_SECTORS_PER_TRACK_13) ? DISK_SECTORS_PER_TRACK : DISK_SECTORS_PER_TRACK_13;
+
+	for (int t = 0; t < DISK_TRACKS_PER_DISK; t++) {
+		uint16_t missing = ((1 << image->sectorsPerTrack) - 1) & ~found[t];
+
+		if (missing) {
+			fprintf(stderr, "%s: track %d: sectors %04X can't be decoded\n", path.c_str(), t, missing);
+			return(false);
+		}
+	}
+
+	return(true);
+}
+
+/* The sectors in the order of a .dsk/.d13 (DOS) or .po (ProDOS) image */
+static MappedFile *
+buildSectorImage(struct conv_image *image, string filename, enum conv_formats format)
+{
+	const unsigned int *xlat = (format == CONV_PRODOS_ORDER) ? PRODOS_SECTOR_XLAT : DOS33_SECTOR_XLAT;
+	unsigned int trackLen = image->sectorsPerTrack * DISK_BYTES_PER_SECTOR;
+	MappedFile *file = MappedFile::allocate(filename, DISK_TRACKS_PER_DISK * trackLen);
+
+	if (! file)
+		return(NULL);
+
+	uint8_t *data = file->getWritableData();
+
+	for (int t = 0; t < DISK_TRACKS_PER_DISK; t++) {
+		for (int s = 0; s < image->sectorsPerTrack; s++) {
+			unsigned int position = (image->sectorsPerTrack == DISK_SECTORS_PER_TRACK_13) ? s : xlat[s];
+
+			memcpy(&data[t * trackLen + position * DISK_BYTES_PER_SECTOR], &image->sectors[t][s * DISK_BYTES_PER_SECTOR], DISK_BYTES_PER_SECTOR);
+		}
+	}
+
+	return(file);
+}
+
+/*
+ * The tracks Disk builds from the sectors, as a .nib (each track padded
+ * with sync bytes to DISK_NIB_TRACK_LEN) or as a .woz.
+ */
+static MappedFile *
+buildNibbleImage(struct conv_worker *worker, string filename, enum conv_formats format)
+{
+	struct conv_image *image = &worker->image;
+	bool is13 = (image->sectorsPerTrack == DISK_SECTORS_PER_TRACK_13);
+	MappedFile *sectors = buildSectorImage(image, is13 ? "sectors.d13" : "sectors.do", CONV_DOS_ORDER);
+	const uint8_t *nibbles[DISK_TRACKS_PER_DISK];
+	uint16_t lengths[DISK_TRACKS_PER_DISK];
+	MappedFile *file = NULL;
+
+	if (! sectors || ! worker->encoder.openImage(sectors, is13 ? "sectors.d13" : "sectors.do"))
+		return(NULL);
+
+	for (int t = 0; t < DISK_TRACKS_PER_DISK; t++)
+		nibbles[t] = worker->encoder.getTrackNibbles(t, &lengths[t]);
+
+	if (format == CONV_WOZ) {
+		file = WozImage::build(filename, nibbles, lengths, DISK_TRACKS_PER_DISK, is13 ? WOZ_BOOT_13_SECTORS : WOZ_BOOT_16_SECTORS);
+	} else if ((file = MappedFile::allocate(filename, DISK_NIB_IMAGE_LEN))) {
+		uint8_t *data = file->getWritableData();
+
+		memset(data, DISK_SYNC_BYTE, DISK_NIB_IMAGE_LEN);
+
+		for (int t = 0; t < DISK_TRACKS_PER_DISK; t++)
+			memcpy(&data[t * DISK_NIB_TRACK_LEN], nibbles[t], lengths[t]);
+	}
+
+	worker->encoder.closeFile();
+
+	return(file);
+}
+
+/* Whether 'check' gives back the sectors of the source */
+static bool
+verify(struct conv_worker *worker)
+{
+	uint8_t sectors[DISK_SECTORS_PER_TRACK * DISK_BYTES_PER_SECTOR];
+	uint16_t all = (1 << worker->image.sectorsPerTrack) - 1;
+
+	for (int t = 0; t < DISK_TRACKS_PER_DISK; t++) {
+		if ((worker->check.readTrack(t, sectors) & all) != all
+		    || memcmp(sectors, worker->image.sectors[t], worker->image.sectorsPerTrack * DISK_BYTES_PER_SECTOR) != 0)
+			return(false);
+	}
+
+	return(true);
+}
+
+/* Write 'file' to 'filename' through a temporary file, so it's never half-written */
+static bool
+writeImage(MappedFile *file, string filename)
+{
+	string temporary = filename + ".tmp";
+	FILE *f = fopen(temporary.c_str(), "wb");
+
+	if (! f) {
+		perror(temporary.c_str());
+		return(false);
+	}
+
+	bool ok = (fwrite(file->getData(), file->getSize(), 1, f) == 1);
+
+	ok = (fclose(f) == 0) && ok;
+
+	if (! ok || rename(temporary.c_str(), filename.c_str()) != 0) {
+		perror(filename.c_str());
+		unlink(temporary.c_str());
+		return(false);
+	}
+
+	return(true);
+}
+
+static bool
+convert(struct conv_worker *worker, string path)
+{
+	string output = getOutputName(path);
+
+	if (output == path) {
+		fprintf(stderr, "%s: Already a .%s, use -d to write the result elsewhere\n", path.c_str(), target->extension);
+		return(false);
+	}
+
+	if (! worker->source.openImage(path))
+		return(false);
+
+	bool ok = readImage(&worker->source, &worker->image, path);
+
+	worker->source.closeFile();
+
+	if (! ok)
+		return(false);
+
+	bool is13 = (worker->image.sectorsPerTrack == DISK_SECTORS_PER_TRACK_13);
+
+	// ProDOS needs 16 sectors. A 13-sector .dsk is fine.
+	if ((is13 && target->format == CONV_PRODOS_ORDER) || (! is13 && strcmp(target->extension, "d13") == 0)) {
+		fprintf(stderr, "%s: A %d-sector disk can't be made a .%s\n", path.c_str(), worker->image.sectorsPerTrack, target->extension);
+		return(false);
+	}
+
+	MappedFile *file;
+
+	if (target->format == CONV_NIB || target->format == CONV_WOZ)
+		file = buildNibbleImage(worker, output, target->format);
+	else
+		file = buildSectorImage(&worker->image, output, target->format);
+
+	if (! file) {
+		fprintf(stderr, "%s: Out of memory\n", path.c_str());
+		return(false);
+	}
+
+	// The Disk releases the image when it's closed
+	if (! worker->check.openImage(file, output) || ! verify(worker)) {
+		fprintf(stderr, "%s: The .%s doesn't read back the same, not written\n", path.c_str(), target->extension);
+		worker->check.closeFile();
+		return(false);
+	}
+
+	ok = dryRun || writeImage(file, output);
+
+	worker->check.closeFile();
+
+	if (ok)
+		printf("%s -> %s%s\n", path.c_str(), output.c_str(), dryRun ? " (verified, not written)" : "");
+
+	return(ok);
+}
+
+/* Take the next image until there are none left */
+static void *
+convertThread(void *arg)
+{
+	struct conv_worker *worker = new struct conv_worker;
+
+	(void) arg;
+
+	for (;;) {
+		unsigned int x = __atomic_fetch_add(&nextImage, 1, __ATOMIC_RELAXED);
+
+		if (x >= filenames.size())
+			break;
+
+		if (convert(worker, filenames[x]))
+			__atomic_fetch_add(&nbConverted, 1, __ATOMIC_RELAXED);
+		else
+			__atomic_fetch_add(&nbFailed, 1, __ATOMIC_RELAXED);
+	}
+
+	delete worker;
+
+	return(NULL);
+}
+
+int main (int argc, char *argv[])
+{
+	long nbThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:j:d:nh")) != -1) {
+		switch(opt) {
+			case 't':
+				for (int x = 0; FORMATS[x].extension; x++) {
+					if (Disk::getExtension(string(".") + optarg) == FORMATS[x].extension)
+						target = &FORMATS[x];
+				}
+				break;
+
+			case 'j':
+				nbThreads = strtol(optarg, NULL, 0);
+				break;
+
+			case 'd':
+				outputDirectory = optarg;
+				break;
+
+			case 'n':
+				dryRun = true;
+				break;
+
+			default:
+				usage(argv[0]);
+				exit(1);
+		}
+	}
+
+	if (! target || optind >= argc) {
+		usage(argv[0]);
+		exit(1);
+	}
+
+	if (nbThreads < 1)
+		nbThreads = 1;
+
+	if (nbThreads > CONV_MAX_THREADS)
+		nbThreads = CONV_MAX_THREADS;
+
+	Log::setLevel(LOG_DISK, LOG_ERROR);
+
+	for (int x = optind; x < argc; x++)
+		filenames.push_back(argv[x]);
+
+	struct timespec start, end;
+	pthread_t threads[CONV_MAX_THREADS];
+	long nbStarted = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (nbStarted < nbThreads && pthread_create(&threads[nbStarted], NULL, convertThread, NULL) == 0)
+		nbStarted++;
+
+	if (nbStarted == 0) {
+		perror("pthread_create()");
+		exit(1);
+	}
+
+	for (long x = 0; x < nbStarted; x++)
+		pthread_join(threads[x], NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	fprintf(stderr, "Converted %u images to .%s (%u failed) in %.2f s with %ld threads\n",
+		nbConverted, target->extension, nbFailed, elapsed, nbStarted);
+
+	Log::shutdown();
+
+	return(nbFailed ? 1 : 0);
+}
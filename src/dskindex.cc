@@ -0,0 +1,586 @@
+/*
+ * dskindex.cc - Index the catalogs of a library of disk images
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * dskindex.cc - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 23:02:17 2026
+ * Revision : $Id$
+ */
+
+/*
+ * Walks directories of disk images and writes one index of what is on
+ * them: for each file of each DOS 3.3, DOS 3.2 or ProDOS disk, a line
+ * with the image, its title, the file's name, type and size. This does
+ * what scripts/read-vtoc.py does for one disk, for a whole library.
+ *
+ * The images are opened with Disk, so every format the emulator loads
+ * (.dsk, .do, .po, .d13, .nib, .woz, in a .gz or .zip or not) can be
+ * indexed. A pool of threads takes the images one after the other from
+ * a shared counter; each thread has its own Disk and track cache. The
+ * lines come out in the order of the sorted paths, whatever the number
+ * of threads.
+ */
+
+#include "Disk.h"
+#include "Log.h"
+#include "MappedFile.h"
+
+#include <ftw.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define INDEX_MAX_THREADS 64
+#define INDEX_FTW_FDS 32                // Directories nftw() keeps open
+
+#define DOS_VTOC_TRACK 17
+#define DOS_CATALOG_ENTRIES 7           // Per catalog sector
+#define DOS_CATALOG_ENTRY_OFFSET 0x0B
+#define DOS_CATALOG_ENTRY_LEN 0x23
+#define DOS_CATALOG_NAME_LEN 30
+#define DOS_DELETED_TRACK 0xFF
+#define DOS_TSLIST_DATA_OFFSET 0x0C     // First data sector in a track/sector list
+
+#define PRODOS_BLOCK_LEN 512
+#define PRODOS_NB_BLOCKS 280            // 140K
+#define PRODOS_VOLDIR_BLOCK 2
+#define PRODOS_ENTRIES_OFFSET 4         // After the previous and next block pointers
+#define PRODOS_STORAGE_DELETED 0x0
+#define PRODOS_STORAGE_SUBDIR 0xD
+#define PRODOS_STORAGE_SUBDIR_HEADER 0xE
+#define PRODOS_STORAGE_VOLUME_HEADER 0xF
+#define PRODOS_MAX_DEPTH 8              // Of subdirectories, against loops
+
+// By bit of the file type, after T (0x00)
+static const char *DOS_TYPES[] = { "I", "A", "B", "S", "R", "A", "B" };
+
+struct prodos_type {
+	uint8_t type;
+	const char *name;
+};
+
+static const struct prodos_type PRODOS_TYPES[] = {
+	{ 0x00, "UNK" }, { 0x01, "BAD" }, { 0x04, "TXT" }, { 0x06, "BIN" },
+	{ 0x08, "FOT" }, { 0x0F, "DIR" }, { 0x19, "ADB" }, { 0x1A, "AWP" },
+	{ 0x1B, "ASP" }, { 0xB3, "S16" }, { 0xC0, "PNT" }, { 0xC1, "PIC" },
+	{ 0xEF, "PAS" }, { 0xF0, "CMD" }, { 0xFA, "INT" }, { 0xFB, "IVR" },
+	{ 0xFC, "BAS" }, { 0xFD, "VAR" }, { 0xFE, "REL" }, { 0xFF, "SYS" },
+};
+
+/*
+ * One image being indexed. The tracks are read from the Disk the first
+ * time one of their sectors is needed.
+ */
+struct index_image {
+	Disk *disk;
+	bool trackRead[DISK_TRACKS_PER_DISK];
+	uint16_t sectorsFound[DISK_TRACKS_PER_DISK];   // By physical sector
+	uint8_t tracks[DISK_TRACKS_PER_DISK][DISK_SECTORS_PER_TRACK * DISK_BYTES_PER_SECTOR];
+	uint8_t dosPhysical[DISK_SECTORS_PER_TRACK];  // DOS sector -> physical sector
+	uint8_t prodosPhysical[DISK_SECTORS_PER_TRACK];
+
+	std::string path;
+	std::string title;
+	std::string lines;
+	unsigned int nbFiles;
+};
+
+static vector<string> filenames;
+static vector<string> results;
+static unsigned int nbImagesFailed = 0;
+static unsigned int nbFilesIndexed = 0;
+static unsigned int nextImage = 0;
+
+void usage(char *argv0)
+{
+	printf("Usage: %s [-j threads] [-o index.txt] dir|image ...\n", argv0);
+	printf("  -j threads Index that many images at once (default: one per CPU)\n");
+	printf("  -o file    Write the index to 'file' rather than to the standard output\n");
+	printf("  dir        Every .dsk, .do, .po, .d13, .nib and .woz under 'dir', also in a .gz or .zip\n");
+}
+
+static uint32_t
+get24(const uint8_t *p)
+{
+	return(p[0] | (p[1] << 8) | (p[2] << 16));
+}
+
+/* Images, and archives that may hold one. A .gz must have an image's extension before it. */
+static bool
+isImageName(string filename)
+{
+	string extension = Disk::getExtension(filename);
+
+	if (extension == "zip")
+		return(true);
+
+	if (extension == "gz")
+		return(Disk::isImageName(filename.substr(0, filename.size() - 3)));
+
+	return(Disk::isImageName(filename));
+}
+
+/* The name of the image without its directory and extensions, for the disks without a volume name */
+static string
+getTitle(string path)
+{
+	size_t slash = path.rfind('/');
+	string title = (slash == path.npos) ? path : path.substr(slash + 1);
+
+	if (Disk::getExtension(title) == "gz" || Disk::getExtension(title) == "zip")
+		title = title.substr(0, title.rfind('.'));
+
+	if (Disk::getExtension(title).size() > 0)
+		title = title.substr(0, title.rfind('.'));
+
+	return(title);
+}
+
+/* Control characters in a name (tabs, newlines, NULs) would break the index */
+static string
+clean(string s)
+{
+	for (size_t x = 0; x < s.size(); x++) {
+		if ((unsigned char) s[x] < 0x20 || s[x] == 0x7F)
+			s[x] = '?';
+	}
+
+	return(s);
+}
+
+/* Physical sector 'physical' of 'track', or NULL if it couldn't be read */
+static const uint8_t *
+getSector(struct index_image *image, uint8_t track, uint8_t physical)
+{
+	if (track >= DISK_TRACKS_PER_DISK || physical >= DISK_SECTORS_PER_TRACK)
+		return(NULL);
+
+	if (! image->trackRead[track]) {
+		image->sectorsFound[track] = image->disk->readTrack(track, image->tracks[track]);
+		image->trackRead[track] = true;
+	}
+
+	if (! (image->sectorsFound[track] & (1 << physical)))
+		return(NULL);
+
+	return(&image->tracks[track][physical * DISK_BYTES_PER_SECTOR]);
+}
+
+static const uint8_t *
+getDosSector(struct index_image *image, uint8_t track, uint8_t sector)
+{
+	if (sector >= DISK_SECTORS_PER_TRACK)
+		return(NULL);
+
+	return(getSector(image, track, image->dosPhysical[sector]));
+}
+
+/* Copy ProDOS block 'block' to 'out': two sectors, in the order of a .po image */
+static bool
+getBlock(struct index_image *image, unsigned int block, uint8_t *out)
+{
+	if (block >= PRODOS_NB_BLOCKS)
+		return(false);
+
+	for (int half = 0; half < 2; half++) {
+		uint8_t sector = (block % 8) * 2 + half;
+		const uint8_t *data = getSector(image, block / 8, image->prodosPhysical[sector]);
+
+		if (! data)
+			return(false);
+
+		memcpy(&out[half * DISK_BYTES_PER_SECTOR], data, DISK_BYTES_PER_SECTOR);
+	}
+
+	return(true);
+}
+
+static void
+addLine(struct index_image *image, const char *system, string name, const char *type, unsigned int size, long bytes)
+{
+	char numbers[40];
+
+	if (bytes >= 0)
+		snprintf(numbers, sizeof(numbers), "%u\t%ld", size, bytes);
+	else
+		snprintf(numbers, sizeof(numbers), "%u\t-", size);
+
+	image->lines += clean(image->path) + "\t" + clean(image->title) + "\t" + system + "\t"
+		+ clean(name) + "\t" + type + "\t" + numbers + "\n";
+
+	image->nbFiles++;
+}
+
+/* One bit per type, or none for a text file */
+static const char *
+getDosType(uint8_t type)
+{
+	if (type == 0x00)
+		return("T");
+
+	for (int bit = 0; bit < 7; bit++) {
+		if (type == (1 << bit))
+			return(DOS_TYPES[bit]);
+	}
+
+	return("?");
+}
+
+/*
+ * The length in bytes of a DOS file, from the start of its first data
+ * sector: Integer and Applesoft programs begin with their length, binary
+ * files with their address and length. It isn't recorded for the others.
+ */
+static long
+getDosLength(struct index_image *image, const uint8_t *entry)
+{
+	uint8_t type = entry[0x02] & 0x7F;
+	const uint8_t *list = getDosSector(image, entry[0x00], entry[0x01]);
+
+	if (! list || (type != 0x01 && type != 0x02 && type != 0x04))
+		return(-1);
+
+	const uint8_t *data = getDosSector(image, list[DOS_TSLIST_DATA_OFFSET], list[DOS_TSLIST_DATA_OFFSET + 1]);
+
+	if (! data || list[DOS_TSLIST_DATA_OFFSET] == 0)
+		return(-1);
+
+	return(type == 0x04 ? get16(&data[2]) : get16(&data[0]));
+}
+
+/* Follow the catalog chain from the VTOC, on track 17 */
+static bool
+indexDos(struct index_image *image)
+{
+	const uint8_t *vtoc = getDosSector(image, DOS_VTOC_TRACK, 0);
+
+	if (! vtoc || vtoc[0x27] != 122 || vtoc[0x34] != DISK_TRACKS_PER_DISK
+	    || (vtoc[0x35] != DISK_SECTORS_PER_TRACK && vtoc[0x35] != DISK_SECTORS_PER_TRACK_13))
+		return(false);
+
+	// DOS 3.2 numbers the sectors like the address fields do
+	const char *system = "DOS3.3";
+
+	if (vtoc[0x35] == DISK_SECTORS_PER_TRACK_13) {
+		system = "DOS3.2";
+
+		for (int x = 0; x < DISK_SECTORS_PER_TRACK; x++)
+			image->dosPhysical[x] = x;
+	}
+
+	uint8_t track = vtoc[0x01];
+	uint8_t sector = vtoc[0x02];
+	int nbSectors = 0;
+
+	// A damaged catalog could link back to itself
+	while (track != 0 && nbSectors++ < DISK_TRACKS_PER_DISK * DISK_SECTORS_PER_TRACK) {
+		const uint8_t *catalog = getDosSector(image, track, sector);
+
+		if (! catalog)
+			break;
+
+		for (int x = 0; x < DOS_CATALOG_ENTRIES; x++) {
+			const uint8_t *entry = &catalog[DOS_CATALOG_ENTRY_OFFSET + x * DOS_CATALOG_ENTRY_LEN];
+
+			if (entry[0x00] == 0x00 || entry[0x00] == DOS_DELETED_TRACK)
+				continue;
+
+			string name("");
+
+			for (int c = 0; c < DOS_CATALOG_NAME_LEN; c++)
+				name += (char) (entry[0x03 + c] & 0x7F);
+
+			name.erase(name.find_last_not_of(' ') + 1);
+
+			// Bit 7 is the lock
+			string type(entry[0x02] & 0x80 ? "*" : "");
+
+			type += getDosType(entry[0x02] & 0x7F);
+
+			addLine(image, system, name, type.c_str(), get16(&entry[0x21]), getDosLength(image, entry));
+		}
+
+		track = catalog[0x01];
+		sector = catalog[0x02];
+	}
+
+	// A formatted disk without files still gets its line
+	if (image->nbFiles == 0)
+		addLine(image, system, "", "", 0, -1);
+
+	return(true);
+}
+
+static const char *
+getProdosType(uint8_t type, char *buf)
+{
+	for (unsigned int x = 0; x < sizeof(PRODOS_TYPES) / sizeof(PRODOS_TYPES[0]); x++) {
+		if (PRODOS_TYPES[x].type == type)
+			return(PRODOS_TYPES[x].name);
+	}
+
+	sprintf(buf, "$%02X", type);
+
+	return(buf);
+}
+
+/* List the directory starting at 'keyBlock', and its subdirectories */
+static void
+indexProdosDirectory(struct index_image *image, unsigned int keyBlock, string prefix, int depth, unsigned int *nbBlocks)
+{
+	uint8_t block[PRODOS_BLOCK_LEN];
+	unsigned int blockNumber = keyBlock;
+	uint8_t entryLength = 0;
+	uint8_t entriesPerBlock = 0;
+	bool first = true;
+
+	while (blockNumber != 0 && (*nbBlocks)++ < PRODOS_NB_BLOCKS) {
+		if (! getBlock(image, blockNumber, block))
+			return;
+
+		// The header, first in the key block, has the length of the entries
+		if (first && ((block[PRODOS_ENTRIES_OFFSET] >> 4) < PRODOS_STORAGE_SUBDIR_HEADER || block[0x23] < 0x27 || block[0x24] == 0))
+			return;
+
+		if (first) {
+			entryLength = block[0x23];
+			entriesPerBlock = block[0x24];
+		}
+
+		for (int x = first ? 1 : 0; x < entriesPerBlock; x++) {
+			unsigned int offset = PRODOS_ENTRIES_OFFSET + x * entryLength;
+
+			if (offset + entryLength > PRODOS_BLOCK_LEN)
+				break;
+
+			const uint8_t *entry = &block[offset];
+			uint8_t storage = entry[0x00] >> 4;
+
+			if (storage == PRODOS_STORAGE_DELETED || storage >= PRODOS_STORAGE_SUBDIR_HEADER)
+				continue;
+
+			string name = prefix + string((const char *) &entry[0x01], entry[0x00] & 0x0F);
+			char buf[4];
+
+			addLine(image, "ProDOS", name, getProdosType(entry[0x10], buf), get16(&entry[0x13]), get24(&entry[0x15]));
+
+			if (storage == PRODOS_STORAGE_SUBDIR && depth < PRODOS_MAX_DEPTH)
+				indexProdosDirectory(image, get16(&entry[0x11]), name + "/", depth + 1, nbBlocks);
+		}
+
+		first = false;
+		blockNumber = get16(&block[0x02]);
+	}
+}
+
+/* The volume directory is in block 2, and its header has the volume name */
+static bool
+indexProdos(struct index_image *image)
+{
+	uint8_t block[PRODOS_BLOCK_LEN];
+
+	if (! getBlock(image, PRODOS_VOLDIR_BLOCK, block))
+		return(false);
+
+	if (block[0x00] != 0 || block[0x01] != 0 || (block[0x04] >> 4) != PRODOS_STORAGE_VOLUME_HEADER
+	    || (block[0x04] & 0x0F) == 0 || block[0x23] != 0x27 || block[0x24] != 0x0D)
+		return(false);
+
+	unsigned int nbBlocks = 0;
+
+	image->title = string((const char *) &block[0x05], block[0x04] & 0x0F);
+	indexProdosDirectory(image, PRODOS_VOLDIR_BLOCK, "", 0, &nbBlocks);
+
+	if (image->nbFiles == 0)
+		addLine(image, "ProDOS", "", "", 0, -1);
+
+	return(true);
+}
+
+/* Index 'path' with 'disk'. Returns false if it couldn't be opened. */
+static bool
+indexImage(struct index_image *image, Disk *disk, string path)
+{
+	image->disk = disk;
+	image->path = path;
+	image->title = getTitle(path);
+	image->lines = "";
+	image->nbFiles = 0;
+
+	for (int x = 0; x < DISK_TRACKS_PER_DISK; x++)
+		image->trackRead[x] = false;
+
+	for (int x = 0; x < DISK_SECTORS_PER_TRACK; x++) {
+		image->dosPhysical[DOS33_SECTOR_XLAT[x]] = x;
+		image->prodosPhysical[PRODOS_SECTOR_XLAT[x]] = x;
+	}
+
+	if (! disk->openImage(path))
+		return(false);
+
+	// 13-sector images are in physical order
+	if (disk->getSectorsPerTrack() == DISK_SECTORS_PER_TRACK_13) {
+		for (int x = 0; x < DISK_SECTORS_PER_TRACK; x++)
+			image->dosPhysical[x] = x;
+	}
+
+	if (! indexProdos(image) && ! indexDos(image))
+		addLine(image, "?", "", "", 0, -1);
+
+	disk->closeFile();
+
+	return(true);
+}
+
+/* Take the next image until there are none left */
+static void *
+indexThread(void *arg)
+{
+	struct index_image *image = new struct index_image;
+	Disk disk;
+
+	(void) arg;
+
+	disk.init();
+
+	for (;;) {
+		unsigned int x = __atomic_fetch_add(&nextImage, 1, __ATOMIC_RELAXED);
+
+		if (x >= filenames.size())
+			break;
+
+		if (indexImage(image, &disk, filenames[x])) {
+			results[x] = image->lines;
+			__atomic_fetch_add(&nbFilesIndexed, image->nbFiles, __ATOMIC_RELAXED);
+		} else {
+			__atomic_fetch_add(&nbImagesFailed, 1, __ATOMIC_RELAXED);
+		}
+	}
+
+	delete image;
+
+	return(NULL);
+}
+
+static int
+addFile(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+{
+	(void) sb;
+	(void) ftwbuf;
+
+	if (typeflag == FTW_F && isImageName(path))
+		filenames.push_back(path);
+
+	return(0);
+}
+
+int main (int argc, char *argv[])
+{
+	long nbThreads = sysconf(_SC_NPROCESSORS_ONLN);
+	FILE *out = stdout;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "j:o:h")) != -1) {
+		switch(opt) {
+			case 'j':
+				nbThreads = strtol(optarg, NULL, 0);
+				break;
+
+			case 'o':
+				out = fopen(optarg, "w");
+
+				if (! out) {
+					perror(optarg);
+					exit(1);
+				}
+				break;
+
+			default:
+				usage(argv[0]);
+				exit(1);
+		}
+	}
+
+	if (optind >= argc) {
+		usage(argv[0]);
+		exit(1);
+	}
+
+	if (nbThreads < 1)
+		nbThreads = 1;
+
+	if (nbThreads > INDEX_MAX_THREADS)
+		nbThreads = INDEX_MAX_THREADS;
+
+	// Opening the images mustn't flood the terminal with warnings
+	Log::setLevel(LOG_DISK, LOG_ERROR);
+
+	for (int x = optind; x < argc; x++) {
+		if (nftw(argv[x], addFile, INDEX_FTW_FDS, FTW_PHYS) != 0)
+			perror(argv[x]);
+	}
+
+	sort(filenames.begin(), filenames.end());
+	results.resize(filenames.size());
+
+	struct timespec start, end;
+	pthread_t threads[INDEX_MAX_THREADS];
+	long nbStarted = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (nbStarted < nbThreads && pthread_create(&threads[nbStarted], NULL, indexThread, NULL) == 0)
+		nbStarted++;
+
+	if (nbStarted == 0) {
+		perror("pthread_create()");
+		exit(1);
+	}
+
+	for (long x = 0; x < nbStarted; x++)
+		pthread_join(threads[x], NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	fprintf(out, "# image\ttitle\tsystem\tfile\ttype\tsectors/blocks\tbytes\n");
+
+	for (unsigned int x = 0; x < results.size(); x++)
+		fputs(results[x].c_str(), out);
+
+	if (out != stdout)
+		fclose(out);
+
+	double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+	fprintf(stderr, "Indexed %lu images (%u files, %u unreadable) in %.2f s with %ld threads\n",
+		(unsigned long) filenames.size() - nbImagesFailed, nbFilesIndexed, nbImagesFailed, elapsed, nbStarted);
+
+	Log::shutdown();
+
+	return(0);
+}
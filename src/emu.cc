@@ -27,6 +27,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h> // strlen
+#include <unistd.h> // getopt
 #include <SDL.h>
 
 #include <iostream>
@@ -38,15 +39,63 @@ using namespace std;
 // The enhanced Apple IIe (AKA Apple //e) is a 65C02
 void usage(char *argv0)
 {
-	printf("Usage: %s <file.dsk>\n", argv0);
+	printf("Usage: %s [-x banks] [-o delta] [-s file.hdv] [-r] [-t ms] [file.dsk ...]\n", argv0);
+	printf("  -x banks   Install a RamWorks-style card with 'banks' 64K aux banks (1-128)\n");
+	printf("  -o delta   Never write to file.dsk: keep the changes in the 'delta' overlay\n");
+	printf("  -r         Do DOS 3.3's disk accesses directly on the image (RWTS accelerator)\n");
+	printf("  -s image   Boot from the .hdv or .2mg hard disk 'image', in slot 7\n");
+	printf("  -t ms      Run at full speed until 'ms' after the disks stop (default %d, -1 never)\n", WARP_DEFAULT_TAIL_MS);
+	printf("  file.dsk   A .dsk, .do, .po, .d13, .nib or .woz image, which can be in a .gz or .zip\n");
+	printf("             Up to 4 go in slot 6 drives 1 and 2, then slot 5 drives 1 and 2\n");
 }
 
 int main (int argc, char *argv[])
 {
 	Machine machine;
 	string romFilename(ROM_FILENAME);
+	unsigned int auxBanks = 0;
+	string overlayFilename("");
+	string hardDiskFilename("");
+	bool rwtsAcceleration = false;
+	int warpTailMs = WARP_DEFAULT_TAIL_MS;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "x:o:s:rt:h")) != -1) {
+		switch(opt) {
+			case 'x':
+				auxBanks = strtoul(optarg, NULL, 0);
+				break;
+
+			case 'o':
+				overlayFilename = optarg;
+				break;
+
+			case 'r':
+				rwtsAcceleration = true;
+				break;
+
+			case 's':
+				hardDiskFilename = optarg;
+				break;
+
+			case 't':
+				warpTailMs = strtol(optarg, NULL, 0);
+				break;
+
+			default:
+				usage(argv[0]);
+				exit(1);
+		}
+	}
 
 	machine.init();
+	machine.setRwtsAcceleration(rwtsAcceleration);
+	machine.setWarp(warpTailMs >= 0, warpTailMs >= 0 ? warpTailMs : 0);
+
+	if (auxBanks > 0 && ! machine.enableRamWorks(auxBanks)) {
+		cerr << "Invalid number of aux banks: " << auxBanks << endl;
+		exit(1);
+	}
 
 	if (! machine.loadApple2eROM(romFilename)) {
 		cerr << "Could not load the apple ROM " << ROM_FILENAME << endl;
@@ -57,12 +106,24 @@ int main (int argc, char *argv[])
 
 	machine.setPC(BOOTSTRAP_ADDRESS);
 
-	if (argc > 1) {
-		std::string diskFile(argv[1]);
-		machine.loadDisk(0, diskFile);
+	for (int drive = 0; optind + drive < argc && drive < DISK_NB_DRIVES; drive++) {
+		std::string diskFile(argv[optind + drive]);
+
+		// The overlay is for the first disk
+		if (drive == 0 && overlayFilename.size() > 0)
+			machine.loadOverlay(drive, diskFile, overlayFilename);
+		else
+			machine.loadDisk(drive, diskFile);
+	}
+
+	if (hardDiskFilename.size() > 0 && ! machine.loadHardDisk(hardDiskFilename)) {
+		cerr << "Could not load the hard disk image " << hardDiskFilename << endl;
+		exit(1);
 	}
 
 	machine.interactive();
+	machine.printDiskStats(true);
+	machine.closeDisks();
 
 	return (0);
 }
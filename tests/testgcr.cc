@@ -0,0 +1,63 @@
+/*
+ * testgcr.cc - Checks the GCR kernels against each other, and times them
+ * Copyright (C) 2026 Benjamin Charron <bcharron@pobox.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ *
+ * testgcr.cc - Benjamin Charron <bcharron@pobox.com>
+ * Created  : Mon Oct 19 16:41:07 2026
+ * Revision : $Id$
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "Gcr.h"
+
+void usage(char *argv0)
+{
+	printf("Usage: %s [-b sectors]\n", argv0);
+	printf("  -b sectors Also time that many encodes and decodes per kernel\n");
+}
+
+/* Exits with 1 if a kernel doesn't give the same results as the plain C one */
+int main(int argc, char *argv[])
+{
+	unsigned int nbSectors = 0;
+	int c;
+
+	while ((c = getopt(argc, argv, "b:h")) != -1) {
+		switch(c) {
+			case 'b':
+				nbSectors = atoi(optarg);
+				break;
+
+			default:
+				usage(argv[0]);
+				exit(2);
+		}
+	}
+
+	if (! Gcr::selfTest()) {
+		printf("GCR self-test FAILED\n");
+		return(1);
+	}
+
+	if (nbSectors > 0)
+		Gcr::benchmark(nbSectors);
+
+	return(0);
+}